@@ -0,0 +1,576 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "opcodes.h"
+
+/**
+ * ahead-of-time recompiler
+ *
+ * reads a rom and writes a C translation of it: every instruction
+ * reachable from PROGRAM_START by following jumps, calls, skips and
+ * fall-through is discovered by recursive descent, and each basic
+ * block becomes a label in chip8_aot_run (see aot.h) with its
+ * instructions inlined as plain C on the Chip8 struct
+ *
+ * control only goes through the switch on PC for targets that cannot
+ * be known statically (returns and BNNN); anything not discovered
+ * (computed targets into the middle of a block, code outside the rom)
+ * is executed one instruction at a time by chip8_cycle, and so is any
+ * block whose bytes the program has overwritten (see
+ * chip8_code_written)
+ *
+ * the quirks are fixed at translation time (--profile), so quirk
+ * dependent instructions are emitted for exactly one variant
+ *
+ * the generated file is compiled together with headless.c (built with
+ * CHIP8_AOT defined) and libchip8 into a per-rom executable, see the
+ * aot target in the Makefile
+ */
+
+static uint8_t memory[MEMORY_SIZE];
+static uint32_t rom_end;
+static const Chip8Quirks *quirks = &chip8_quirks_vip;
+
+// an instruction starts at this address
+static bool is_code[MEMORY_SIZE];
+// a basic block starts at this address
+static bool is_leader[MEMORY_SIZE];
+
+static uint16_t worklist[MEMORY_SIZE];
+static int worklist_len;
+
+/**
+ * both bytes of an instruction at addr belong to the rom
+ */
+static bool in_rom(uint32_t addr) {
+  return addr >= PROGRAM_START && addr + 1 < rom_end;
+}
+
+static void decode_at(uint32_t addr, Chip8Instruction *ins) {
+  chip8_decode(quirks, memory[addr] << 8 | memory[addr + 1], ins);
+}
+
+static void visit(uint32_t addr) {
+  if (in_rom(addr) && !is_code[addr]) {
+    is_code[addr] = true;
+    worklist[worklist_len++] = addr;
+  }
+}
+
+static void visit_leader(uint32_t addr) {
+  if (in_rom(addr)) {
+    is_leader[addr] = true;
+    visit(addr);
+  }
+}
+
+/**
+ * instructions after which straight-line translation stops
+ */
+static bool ends_block(uint8_t op) {
+  switch (op) {
+  case OP_UNKNOWN:
+  case OP_00EE:
+  case OP_1NNN:
+  case OP_2NNN:
+  case OP_3XNN:
+  case OP_4XNN:
+  case OP_5XY0:
+  case OP_9XY0:
+  case OP_BNNN:
+  case OP_BXNN:
+  case OP_EX9E:
+  case OP_EXA1:
+  case OP_FX0A:
+  case OP_FX33:
+  case OP_FX55:
+  case OP_FX55_INC_I:
+    return true;
+  default:
+    return opcode_is_draw(op);
+  }
+}
+
+/**
+ * find all statically reachable instructions and block leaders
+ */
+static void discover(void) {
+  visit_leader(PROGRAM_START);
+
+  while (worklist_len > 0) {
+    uint16_t addr = worklist[--worklist_len];
+    Chip8Instruction ins;
+    decode_at(addr, &ins);
+
+    switch (ins.op) {
+    case OP_UNKNOWN:
+    case OP_00EE:
+    case OP_BNNN:
+    case OP_BXNN:
+      break;
+    case OP_1NNN:
+      visit_leader(ins.nnn);
+      break;
+    case OP_2NNN:
+      visit_leader(ins.nnn);
+      visit_leader(addr + 2);
+      break;
+    case OP_3XNN:
+    case OP_4XNN:
+    case OP_5XY0:
+    case OP_9XY0:
+    case OP_EX9E:
+    case OP_EXA1:
+      visit_leader(addr + 2);
+      visit_leader(addr + 4);
+      break;
+    case OP_FX0A:
+    case OP_FX33:
+    case OP_FX55:
+    case OP_FX55_INC_I:
+      visit_leader(addr + 2);
+      break;
+    default:
+      if (opcode_is_draw(ins.op)) {
+        // a throttled draw is re-executed from the dispatcher
+        is_leader[addr] = true;
+        visit_leader(addr + 2);
+      } else {
+        visit(addr + 2);
+      }
+      break;
+    }
+  }
+}
+
+/**
+ * continue at a known target, or through the dispatcher otherwise
+ */
+static void emit_goto(FILE *out, const char *indent, uint32_t target) {
+  if (in_rom(target) && is_leader[target]) {
+    fprintf(out, "%sgoto L_%03X;\n", indent, target);
+  } else {
+    fprintf(out, "%schip->PC = 0x%03X;\n%sgoto dispatch;\n", indent,
+            target & 0xFFFF, indent);
+  }
+}
+
+/**
+ * instructions executed by their handler from opcodes.c, which needs a
+ * decoded instruction to read the operands from
+ */
+static const char *const handler_names[OP_COUNT] = {
+    [OP_BNNN] = "op_BNNN",
+    [OP_BXNN] = "op_BXNN",
+    [OP_DXYN] = "op_DXYN",
+    [OP_DXYN_CLIP] = "op_DXYN_clip",
+    [OP_DXYN_VBLANK] = "op_DXYN_vblank",
+    [OP_DXYN_VBLANK_CLIP] = "op_DXYN_vblank_clip",
+    [OP_FX0A] = "op_FX0A",
+    [OP_FX33] = "op_FX33",
+    [OP_FX55] = "op_FX55",
+    [OP_FX55_INC_I] = "op_FX55_inc_i",
+    [OP_FX65] = "op_FX65",
+    [OP_FX65_INC_I] = "op_FX65_inc_i",
+};
+
+static bool uses_handler(uint8_t op) { return handler_names[op] != NULL; }
+
+static void emit_handler_instructions(FILE *out) {
+  for (uint32_t addr = PROGRAM_START; addr < rom_end; addr++) {
+    if (!is_code[addr]) {
+      continue;
+    }
+    Chip8Instruction ins;
+    decode_at(addr, &ins);
+    if (uses_handler(ins.op)) {
+      fprintf(out,
+              "static const Chip8Instruction ins_%03X = {.nnn = 0x%03X, "
+              ".x = %u, .y = %u, .n = %u, .nn = 0x%02X, .op = %u, "
+              ".length = 1};\n",
+              addr, ins.nnn, ins.x, ins.y, ins.n, ins.nn, ins.op);
+    }
+  }
+  fprintf(out, "\n");
+}
+
+/**
+ * emit the checks done on entry to a block: enough budget left to run
+ * all of it, and none of its bytes overwritten since the rom was loaded
+ */
+static void emit_block_guard(FILE *out, uint32_t start, uint32_t end,
+                             int count) {
+  fprintf(out, "L_%03X:\n  if (cycles - executed < %d", start, count);
+  uint32_t first = start >> 1;
+  uint32_t last = (end - 1) >> 1;
+  for (uint32_t word = first >> 6; word <= last >> 6; word++) {
+    uint64_t mask = 0;
+    for (uint32_t e = first; e <= last; e++) {
+      if (e >> 6 == word) {
+        mask |= 1ULL << (e & 63);
+      }
+    }
+    fprintf(out, " ||\n      (chip->code_written[%u] & 0x%016llXULL)", word,
+            (unsigned long long)mask);
+  }
+  fprintf(out, ") {\n    chip->PC = 0x%03X;\n    goto interpret;\n  }\n",
+          start);
+}
+
+/**
+ * emit the C statements for one instruction; instructions that end the
+ * block also account for the count executed instructions of the block
+ */
+static void emit_instruction(FILE *out, uint32_t addr,
+                             const Chip8Instruction *ins, int count) {
+  unsigned x = ins->x;
+  unsigned y = ins->y;
+  unsigned nn = ins->nn;
+  unsigned nnn = ins->nnn;
+
+  fprintf(out, "  // %03X: %02X%02X\n", addr, memory[addr], memory[addr + 1]);
+  switch (ins->op) {
+  case OP_00E0:
+    fprintf(out, "  memset(chip->display, 0, sizeof(chip->display));\n"
+                 "  chip->draw_flag = true;\n");
+    break;
+  case OP_00EE:
+    fprintf(out,
+            "  executed += %d;\n  chip->PC = chip->stack[chip->SP];\n"
+            "  chip->SP--;\n  goto dispatch;\n",
+            count);
+    break;
+  case OP_1NNN:
+    fprintf(out, "  executed += %d;\n", count);
+    emit_goto(out, "  ", nnn);
+    break;
+  case OP_2NNN:
+    fprintf(out,
+            "  executed += %d;\n  chip->SP++;\n"
+            "  chip->stack[chip->SP] = 0x%03X;\n",
+            count, addr + 2);
+    emit_goto(out, "  ", nnn);
+    break;
+  case OP_3XNN:
+  case OP_4XNN:
+  case OP_5XY0:
+  case OP_9XY0:
+  case OP_EX9E:
+  case OP_EXA1: {
+    char cond[64];
+    if (ins->op == OP_3XNN) {
+      snprintf(cond, sizeof(cond), "V[0x%X] == 0x%02X", x, nn);
+    } else if (ins->op == OP_4XNN) {
+      snprintf(cond, sizeof(cond), "V[0x%X] != 0x%02X", x, nn);
+    } else if (ins->op == OP_5XY0) {
+      snprintf(cond, sizeof(cond), x == y ? "1" : "V[0x%X] == V[0x%X]", x, y);
+    } else if (ins->op == OP_9XY0) {
+      snprintf(cond, sizeof(cond), x == y ? "0" : "V[0x%X] != V[0x%X]", x, y);
+    } else if (ins->op == OP_EX9E) {
+      snprintf(cond, sizeof(cond), "chip->keypad[V[0x%X] & 0xF]", x);
+    } else {
+      snprintf(cond, sizeof(cond), "!chip->keypad[V[0x%X] & 0xF]", x);
+    }
+    fprintf(out, "  executed += %d;\n  if (%s) {\n", count, cond);
+    emit_goto(out, "    ", addr + 4);
+    fprintf(out, "  }\n");
+    emit_goto(out, "  ", addr + 2);
+    break;
+  }
+  case OP_6XNN:
+    fprintf(out, "  V[0x%X] = 0x%02X;\n", x, nn);
+    break;
+  case OP_7XNN:
+    fprintf(out, "  V[0x%X] += 0x%02X;\n", x, nn);
+    break;
+  case OP_8XY0:
+    fprintf(out, "  V[0x%X] = V[0x%X];\n", x, y);
+    break;
+  case OP_8XY1:
+  case OP_8XY2:
+  case OP_8XY3:
+  case OP_8XY1_RESET_VF:
+  case OP_8XY2_RESET_VF:
+  case OP_8XY3_RESET_VF: {
+    bool reset_vf = ins->op >= OP_8XY1_RESET_VF;
+    uint8_t base = reset_vf ? ins->op - OP_8XY1_RESET_VF + OP_8XY1 : ins->op;
+    const char *op = base == OP_8XY1 ? "|" : base == OP_8XY2 ? "&" : "^";
+    fprintf(out, "  V[0x%X] %s= V[0x%X];\n", x, op, y);
+    if (reset_vf) {
+      fprintf(out, "  V[0xF] = 0;\n");
+    }
+    break;
+  }
+  case OP_8XY4:
+    fprintf(out,
+            "  {\n    uint16_t res = V[0x%X] + V[0x%X];\n"
+            "    V[0x%X] = res;\n    V[0xF] = res >> 8;\n  }\n",
+            x, y, x);
+    break;
+  case OP_8XY5:
+  case OP_8XY7: {
+    unsigned a = ins->op == OP_8XY5 ? x : y;
+    unsigned b = ins->op == OP_8XY5 ? y : x;
+    fprintf(out,
+            "  {\n    uint16_t res = V[0x%X] - V[0x%X];\n"
+            "    V[0x%X] = res;\n    V[0xF] = res <= 255;\n  }\n",
+            a, b, x);
+    break;
+  }
+  case OP_8XY6_VX:
+    y = x;
+    // fall through
+  case OP_8XY6:
+    fprintf(out,
+            "  {\n    uint8_t carry = V[0x%X] & 1;\n"
+            "    V[0x%X] = V[0x%X] >> 1;\n    V[0xF] = carry;\n  }\n",
+            y, x, y);
+    break;
+  case OP_8XYE_VX:
+    y = x;
+    // fall through
+  case OP_8XYE:
+    fprintf(out,
+            "  {\n    uint8_t carry = V[0x%X] >> 7;\n"
+            "    V[0x%X] = V[0x%X] << 1;\n    V[0xF] = carry;\n  }\n",
+            y, x, y);
+    break;
+  case OP_ANNN:
+    fprintf(out, "  chip->I = 0x%03X;\n", nnn);
+    break;
+  case OP_BNNN:
+  case OP_BXNN:
+    fprintf(out,
+            "  executed += %d;\n  chip->PC = 0x%03X;\n"
+            "  %s(chip, &ins_%03X);\n  goto dispatch;\n",
+            count, addr, handler_names[ins->op], addr);
+    break;
+  case OP_CXNN:
+    fprintf(out, "  V[0x%X] = chip8_random(chip) & 0x%02X;\n", x, nn);
+    break;
+  case OP_DXYN:
+  case OP_DXYN_CLIP:
+  case OP_DXYN_VBLANK:
+  case OP_DXYN_VBLANK_CLIP:
+    // a throttled draw leaves PC unchanged and would be retried for the
+    // rest of the budget without changing any state
+    fprintf(out,
+            "  executed += %d;\n  chip->PC = 0x%03X;\n"
+            "  %s(chip, &ins_%03X);\n"
+            "  if (chip->PC == 0x%03X) {\n    return cycles;\n  }\n",
+            count, addr, handler_names[ins->op], addr, addr);
+    emit_goto(out, "  ", addr + 2);
+    break;
+  case OP_FX07:
+    fprintf(out, "  V[0x%X] = chip->delay_timer;\n", x);
+    break;
+  case OP_FX0A:
+    // waiting for a key consumes the rest of the budget
+    fprintf(out,
+            "  executed += %d;\n  chip->PC = 0x%03X;\n"
+            "  op_FX0A(chip, &ins_%03X);\n  return cycles;\n",
+            count, addr, addr);
+    break;
+  case OP_FX15:
+    fprintf(out, "  chip->delay_timer = V[0x%X];\n", x);
+    break;
+  case OP_FX18:
+    fprintf(out, "  chip->sound_timer = V[0x%X];\n", x);
+    break;
+  case OP_FX1E:
+    fprintf(out, "  chip->I += V[0x%X];\n", x);
+    break;
+  case OP_FX29:
+    fprintf(out, "  chip->I = 0x%03X + %d * (V[0x%X] & 0x0F);\n", FONT_START,
+            FONT_SIZE_BYTES, x);
+    break;
+  case OP_FX33:
+  case OP_FX55:
+  case OP_FX55_INC_I:
+    // the next block re-checks whether the store hit translated code
+    fprintf(out,
+            "  executed += %d;\n  chip->PC = 0x%03X;\n"
+            "  %s(chip, &ins_%03X);\n",
+            count, addr, handler_names[ins->op], addr);
+    emit_goto(out, "  ", addr + 2);
+    break;
+  case OP_FX65:
+  case OP_FX65_INC_I:
+    fprintf(out, "  %s(chip, &ins_%03X);\n", handler_names[ins->op], addr);
+    break;
+  default:
+    // not part of the instruction set: leave it to the interpreter
+    fprintf(out,
+            "  executed += %d;\n  chip->PC = 0x%03X;\n  goto interpret;\n",
+            count - 1, addr);
+    break;
+  }
+}
+
+/**
+ * emit the basic block starting at a leader
+ */
+static void emit_block(FILE *out, uint32_t start) {
+  // find the extent of the block first, the guard needs its length
+  uint32_t addr = start;
+  int count = 0;
+  for (;;) {
+    Chip8Instruction ins;
+    decode_at(addr, &ins);
+    count++;
+    if (ends_block(ins.op) || !in_rom(addr + 2) || is_leader[addr + 2]) {
+      break;
+    }
+    addr += 2;
+  }
+  uint32_t end = addr + 2;
+
+  emit_block_guard(out, start, end, count);
+
+  count = 0;
+  for (addr = start; addr < end; addr += 2) {
+    Chip8Instruction ins;
+    decode_at(addr, &ins);
+    count++;
+    emit_instruction(out, addr, &ins, count);
+    if (addr + 2 == end && !ends_block(ins.op)) {
+      // falls through into the next block
+      fprintf(out, "  executed += %d;\n", count);
+      emit_goto(out, "  ", end);
+    }
+  }
+  fprintf(out, "\n");
+}
+
+static void emit_program(FILE *out, const char *rom_path, size_t size) {
+  fprintf(out,
+          "// generated by chip8-aot from %s, do not edit\n\n"
+          "#include <stdint.h>\n#include <string.h>\n\n"
+          "#include \"aot.h\"\n#include \"chip8.h\"\n"
+          "#include \"opcodes.h\"\n\n",
+          rom_path);
+
+  fprintf(out,
+          "const Chip8Quirks chip8_aot_quirks = {.logic_resets_vf = %d, "
+          ".load_store_increment_i = %d, .draw_waits_for_vblank = %d, "
+          ".clip_sprites = %d, .shift_uses_vx = %d, .jump_uses_vx = %d};\n\n",
+          quirks->logic_resets_vf, quirks->load_store_increment_i,
+          quirks->draw_waits_for_vblank, quirks->clip_sprites,
+          quirks->shift_uses_vx, quirks->jump_uses_vx);
+
+  fprintf(out, "const size_t chip8_aot_rom_size = %zu;\n\n", size);
+  fprintf(out, "const uint8_t chip8_aot_rom[] = {");
+  for (size_t i = 0; i < size; i++) {
+    fprintf(out, "%s0x%02X,", i % 12 == 0 ? "\n    " : " ",
+            memory[PROGRAM_START + i]);
+  }
+  fprintf(out, "\n};\n\n");
+
+  emit_handler_instructions(out);
+
+  fprintf(out, "uint64_t chip8_aot_run(Chip8 *chip, uint64_t cycles) {\n"
+               "  uint8_t *const V = chip->V;\n"
+               "  uint64_t executed = 0;\n\n"
+               "dispatch:\n"
+               "  if (chip->FX0A_waiting) {\n"
+               "    return cycles;\n"
+               "  }\n"
+               "  switch (chip->PC) {\n");
+  for (uint32_t addr = PROGRAM_START; addr < rom_end; addr++) {
+    if (is_code[addr] && is_leader[addr]) {
+      fprintf(out, "  case 0x%03X:\n    goto L_%03X;\n", addr, addr);
+    }
+  }
+  fprintf(out, "  default:\n    break;\n  }\n\n"
+               "  // not translated, or translation is out of date\n"
+               "interpret:\n"
+               "  if (executed >= cycles) {\n"
+               "    return executed;\n"
+               "  }\n"
+               "  executed += chip8_cycle(chip);\n"
+               "  goto dispatch;\n\n");
+
+  for (uint32_t addr = PROGRAM_START; addr < rom_end; addr++) {
+    if (is_code[addr] && is_leader[addr]) {
+      emit_block(out, addr);
+    }
+  }
+  fprintf(out, "}\n");
+}
+
+int main(int argc, char *argv[]) {
+  const char *rom_path = NULL;
+  const char *out_path = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--profile") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "Missing value for --profile\n");
+        return 1;
+      }
+      if (chip8_parse_profile(argv[++i], &quirks)) {
+        fprintf(stderr, "Unknown profile: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "-o") == 0) {
+      if (i + 1 < argc) {
+        out_path = argv[++i];
+      } else {
+        fprintf(stderr, "Missing value for -o\n");
+        return 1;
+      }
+    } else if (rom_path == NULL) {
+      rom_path = argv[i];
+    } else {
+      fprintf(stderr, "Unknown extra argument: %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  if (!rom_path) {
+    fprintf(stderr,
+            "Usage: %s <rom_file> [-o output.c] "
+            "[--profile vip|schip|xo-chip]\n",
+            argv[0]);
+    return 1;
+  }
+
+  FILE *file = fopen(rom_path, "rb");
+  if (!file) {
+    perror("Failed to open ROM");
+    return 1;
+  }
+  fseek(file, 0, SEEK_END);
+  size_t size = ftell(file);
+  rewind(file);
+
+  if (size > (MEMORY_SIZE - PROGRAM_START)) {
+    fprintf(stderr, "ROM too large\n");
+    fclose(file);
+    return 1;
+  }
+
+  fread(&memory[PROGRAM_START], size, 1, file);
+  fclose(file);
+  rom_end = PROGRAM_START + size;
+
+  discover();
+
+  FILE *out = stdout;
+  if (out_path) {
+    out = fopen(out_path, "w");
+    if (!out) {
+      perror("Failed to open output");
+      return 1;
+    }
+  }
+  emit_program(out, rom_path, size);
+  if (out != stdout) {
+    fclose(out);
+  }
+  return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+/**
+ * symbols defined by a program generated with chip8-aot (see aot.c)
+ */
+
+// the rom the program was generated from, loaded at PROGRAM_START
+extern const uint8_t chip8_aot_rom[];
+extern const size_t chip8_aot_rom_size;
+
+// the quirks the rom was recompiled for
+extern const Chip8Quirks chip8_aot_quirks;
+
+/**
+ * run the recompiled rom for the given number of cycles; same contract
+ * as chip8_run_cycles (never overshoots)
+ */
+uint64_t chip8_aot_run(Chip8 *chip, uint64_t cycles);
+
+#endif
@@ -0,0 +1,574 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chip8.h"
+
+/**
+ * batch runner
+ *
+ * runs every job of a manifest headless (like chip8-headless) on a pool
+ * of worker threads and streams one result line per job, in completion
+ * order, to stdout or the -o file
+ *
+ * a manifest line is a rom path followed by key=value options:
+ *
+ *   roms/pong.ch8 profile=schip frames=600 input=pong.keys seed=7
+ *
+ *   profile  vip (default), schip or xo-chip
+ *   engine   table (default), block, jit or threaded
+ *   clock    clock speed in Hz (default 6000)
+ *   cycles   cycle budget
+ *   frames   frame budget (at least one of the two budgets is required)
+ *   seed     random number generator seed
+ *   input    script of "<frame> <key> down|up" lines, each applied
+ *            before that frame runs, in frame order
+ *
+ * blank lines and lines starting with # are skipped; result lines start
+ * with job=<manifest line number>
+ *
+ * jobs are dealt round robin into one deque per worker before the
+ * workers start; a worker takes jobs from its own deque and, once that
+ * is empty, steals from the others, so long jobs landing on one worker
+ * do not leave the rest idle
+ */
+
+#define FRAMES_PER_SECOND 60.0
+#define MAX_RESULT_LENGTH 512
+
+typedef struct InputEvent {
+  uint64_t frame;
+  uint8_t key;
+  Chip8EventType type;
+} InputEvent;
+
+typedef struct Job {
+  unsigned line;
+  char *rom_path;
+  char *input_path;
+  const Chip8Quirks *quirks;
+  Chip8Engine engine;
+  double clock_speed;
+  uint64_t max_cycles;
+  uint64_t max_frames;
+  uint64_t seed;
+  bool seeded;
+} Job;
+
+/**
+ * WORK-STEALING DEQUES
+ *
+ * Chase-Lev deques of job indices: the owner pops from the bottom and
+ * thieves take from the top, with a compare and swap on top settling
+ * races for the last job; all pushes happen before the workers start,
+ * so the deques never grow
+ */
+
+#define DEQUE_EMPTY -1
+// lost a race with another thief; the deque may still hold jobs
+#define DEQUE_RETRY -2
+
+typedef struct Deque {
+  _Atomic int64_t top;
+  _Atomic int64_t bottom;
+  int64_t *jobs;
+} Deque;
+
+static int64_t deque_pop(Deque *deque) {
+  int64_t bottom =
+      atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+  if (top > bottom) {
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return DEQUE_EMPTY;
+  }
+  int64_t job = deque->jobs[bottom];
+  if (top == bottom) {
+    // the last job: race the thieves for it
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed)) {
+      job = DEQUE_EMPTY;
+    }
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+  }
+  return job;
+}
+
+static int64_t deque_steal(Deque *deque) {
+  int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+  if (top >= bottom) {
+    return DEQUE_EMPTY;
+  }
+  int64_t job = deque->jobs[top];
+  if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                               memory_order_seq_cst,
+                                               memory_order_relaxed)) {
+    return DEQUE_RETRY;
+  }
+  return job;
+}
+
+typedef struct Pool {
+  const Job *jobs;
+  Deque *deques;
+  unsigned workers;
+  FILE *out;
+  atomic_uint failed;
+} Pool;
+
+typedef struct Worker {
+  Pool *pool;
+  unsigned index;
+  pthread_t thread;
+} Worker;
+
+/**
+ * next job for a worker: its own first, then stolen from the others
+ * starting with its neighbour; -1 once every deque is empty
+ */
+static int64_t next_job(Worker *worker) {
+  Pool *pool = worker->pool;
+  int64_t job = deque_pop(&pool->deques[worker->index]);
+  if (job >= 0) {
+    return job;
+  }
+
+  bool contended;
+  do {
+    contended = false;
+    for (unsigned i = 1; i < pool->workers; i++) {
+      unsigned victim = (worker->index + i) % pool->workers;
+      job = deque_steal(&pool->deques[victim]);
+      if (job >= 0) {
+        return job;
+      }
+      contended |= job == DEQUE_RETRY;
+    }
+  } while (contended);
+  return DEQUE_EMPTY;
+}
+
+/**
+ * read an input script; returns nonzero and describes the problem in
+ * error if it cannot be used
+ */
+static int load_input(const char *path, InputEvent **events, size_t *count,
+                      char *error, size_t error_size) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    snprintf(error, error_size, "cannot open input %s", path);
+    return 1;
+  }
+
+  size_t capacity = 0;
+  *events = NULL;
+  *count = 0;
+  char *line = NULL;
+  size_t line_size = 0;
+  unsigned line_number = 0;
+  int err = 0;
+
+  while (getline(&line, &line_size, file) != -1) {
+    line_number++;
+    char *text = line + strspn(line, " \t");
+    if (*text == '#' || *text == '\n' || *text == '\0') {
+      continue;
+    }
+
+    uint64_t frame;
+    unsigned key;
+    char direction[5];
+    if (sscanf(text, "%" SCNu64 " %x %4s", &frame, &key, direction) != 3 ||
+        key > 0xF ||
+        (strcmp(direction, "down") != 0 && strcmp(direction, "up") != 0) ||
+        (*count && frame < (*events)[*count - 1].frame)) {
+      snprintf(error, error_size, "bad input %s:%u", path, line_number);
+      err = 1;
+      break;
+    }
+
+    if (*count == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      InputEvent *grown = realloc(*events, capacity * sizeof(InputEvent));
+      if (!grown) {
+        snprintf(error, error_size, "out of memory");
+        err = 1;
+        break;
+      }
+      *events = grown;
+    }
+    (*events)[(*count)++] = (InputEvent){
+        .frame = frame,
+        .key = key,
+        .type = direction[0] == 'd' ? CHIP8_KEY_DOWN : CHIP8_KEY_UP,
+    };
+  }
+
+  free(line);
+  fclose(file);
+  if (err) {
+    free(*events);
+    *events = NULL;
+  }
+  return err;
+}
+
+/**
+ * run one job on the worker's chip and format its result line
+ */
+static int run_job(Chip8 *chip, const Job *job, char *result) {
+  char error[256];
+  InputEvent *events = NULL;
+  size_t event_count = 0;
+  if (job->input_path && load_input(job->input_path, &events, &event_count,
+                                    error, sizeof(error))) {
+    goto fail;
+  }
+
+  chip8_init(chip, job->clock_speed, false, job->quirks);
+  if (job->seeded) {
+    chip8_seed(chip, job->seed);
+  }
+  if (chip8_set_engine(chip, job->engine)) {
+    // a result from the table engine would pass for one from the engine
+    // asked for
+    snprintf(error, sizeof(error), "engine not available");
+    chip8_destroy(chip);
+    free(events);
+    goto fail;
+  }
+  if (chip8_load_rom(chip, job->rom_path)) {
+    snprintf(error, sizeof(error), "cannot load rom");
+    chip8_destroy(chip);
+    free(events);
+    goto fail;
+  }
+
+  // same timing as chip8-headless: a frame every (clock / 60) cycles,
+  // with the fraction carried over
+  const double cycles_per_frame = job->clock_speed / FRAMES_PER_SECOND;
+  double cycle_accumulator = 0.0;
+  uint64_t cycles = 0;
+  uint64_t frames = 0;
+  size_t next_event = 0;
+
+  while ((job->max_cycles == 0 || cycles < job->max_cycles) &&
+         (job->max_frames == 0 || frames < job->max_frames)) {
+    while (next_event < event_count && events[next_event].frame <= frames) {
+      chip8_key_event(chip, events[next_event].key, events[next_event].type);
+      next_event++;
+    }
+
+    cycle_accumulator += cycles_per_frame;
+    uint64_t batch = (uint64_t)cycle_accumulator;
+    cycle_accumulator -= batch;
+
+    if (job->max_cycles && batch > job->max_cycles - cycles) {
+      cycles += chip8_run_cycles(chip, job->max_cycles - cycles);
+      break;
+    }
+
+    cycles += chip8_run_cycles(chip, batch);
+    chip8_frame_tick(chip);
+    frames++;
+  }
+
+  snprintf(result, MAX_RESULT_LENGTH,
+           "job=%u rom=%s status=ok cycles=%" PRIu64 " frames=%" PRIu64
+           " pc=%03X i=%03X display=%016" PRIx64 "\n",
+           job->line, job->rom_path, cycles, frames, chip->PC, chip->I,
+           chip8_display_hash(chip));
+  chip8_destroy(chip);
+  free(events);
+  return 0;
+
+fail:
+  snprintf(result, MAX_RESULT_LENGTH, "job=%u rom=%s status=error (%s)\n",
+           job->line, job->rom_path, error);
+  return 1;
+}
+
+static void *work(void *data) {
+  Worker *worker = (Worker *)data;
+  Pool *pool = worker->pool;
+
+  // one chip per worker, reinitialized for every job
+  Chip8 *chip = malloc(sizeof(Chip8));
+  if (!chip) {
+    perror("Failed to allocate emulator");
+    return NULL;
+  }
+
+  char result[MAX_RESULT_LENGTH];
+  int64_t job;
+  while ((job = next_job(worker)) >= 0) {
+    if (run_job(chip, &pool->jobs[job], result)) {
+      atomic_fetch_add_explicit(&pool->failed, 1, memory_order_relaxed);
+    }
+    // a single stdio call, so lines from different workers never mix
+    fputs(result, pool->out);
+  }
+
+  free(chip);
+  return NULL;
+}
+
+/**
+ * parse an unsigned manifest value; returns nonzero unless the whole
+ * value is a number in range
+ */
+static int parse_u64(const char *value, int base, uint64_t *out) {
+  char *end;
+  errno = 0;
+  *out = strtoull(value, &end, base);
+  return value[0] == '\0' || value[0] == '-' || *end != '\0' ||
+         errno == ERANGE;
+}
+
+/**
+ * parse the key=value options of a manifest line into job
+ */
+static int parse_option(Job *job, char *option) {
+  char *value = strchr(option, '=');
+  if (!value) {
+    return 1;
+  }
+  *value++ = '\0';
+
+  if (strcmp(option, "profile") == 0) {
+    return chip8_parse_profile(value, &job->quirks);
+  } else if (strcmp(option, "engine") == 0) {
+    return chip8_parse_engine(value, &job->engine);
+  } else if (strcmp(option, "clock") == 0) {
+    job->clock_speed = atof(value);
+    return job->clock_speed <= 0;
+  } else if (strcmp(option, "cycles") == 0) {
+    return parse_u64(value, 10, &job->max_cycles);
+  } else if (strcmp(option, "frames") == 0) {
+    return parse_u64(value, 10, &job->max_frames);
+  } else if (strcmp(option, "seed") == 0) {
+    job->seeded = true;
+    return parse_u64(value, 0, &job->seed);
+  } else if (strcmp(option, "input") == 0) {
+    job->input_path = strdup(value);
+  } else {
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * read all jobs of a manifest; returns nonzero on the first bad line
+ */
+static int load_manifest(const char *path, Job **jobs, size_t *count) {
+  *jobs = NULL;
+  *count = 0;
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    perror("Failed to open manifest");
+    return 1;
+  }
+
+  size_t capacity = 0;
+  char *line = NULL;
+  size_t line_size = 0;
+  unsigned line_number = 0;
+  int err = 0;
+
+  while (getline(&line, &line_size, file) != -1) {
+    line_number++;
+    char *save;
+    char *rom = strtok_r(line, " \t\r\n", &save);
+    if (!rom || rom[0] == '#') {
+      continue;
+    }
+
+    if (*count == capacity) {
+      capacity = capacity ? capacity * 2 : 256;
+      Job *grown = realloc(*jobs, capacity * sizeof(Job));
+      if (!grown) {
+        perror("Failed to allocate jobs");
+        err = 1;
+        break;
+      }
+      *jobs = grown;
+    }
+
+    Job *job = &(*jobs)[(*count)++];
+    *job = (Job){
+        .line = line_number,
+        .rom_path = strdup(rom),
+        .quirks = &chip8_quirks_vip,
+        .engine = CHIP8_ENGINE_TABLE,
+        .clock_speed = 6000.0,
+    };
+
+    char *option;
+    while ((option = strtok_r(NULL, " \t\r\n", &save))) {
+      if (parse_option(job, option)) {
+        fprintf(stderr, "%s:%u: bad option %s\n", path, line_number, option);
+        err = 1;
+      }
+    }
+    if (job->max_cycles == 0 && job->max_frames == 0) {
+      fprintf(stderr, "%s:%u: missing cycles or frames\n", path, line_number);
+      err = 1;
+    }
+    if (err) {
+      break;
+    }
+  }
+
+  free(line);
+  fclose(file);
+  return err;
+}
+
+static void free_jobs(Job *jobs, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    free(jobs[i].rom_path);
+    free(jobs[i].input_path);
+  }
+  free(jobs);
+}
+
+int main(int argc, char *argv[]) {
+  const char *manifest_path = NULL;
+  const char *output_path = NULL;
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0) {
+      if (i + 1 < argc) {
+        output_path = argv[++i];
+      } else {
+        fprintf(stderr, "Missing value for -o\n");
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--threads") == 0) {
+      if (i + 1 < argc) {
+        threads = atol(argv[++i]);
+      } else {
+        fprintf(stderr, "Missing value for --threads\n");
+        return 1;
+      }
+    } else {
+      if (manifest_path == NULL) {
+        manifest_path = argv[i];
+      } else {
+        fprintf(stderr, "Unknown extra argument: %s\n", argv[i]);
+        return 1;
+      }
+    }
+  }
+
+  if (!manifest_path || threads < 1) {
+    fprintf(stderr, "Usage: %s <manifest> [-o results] [--threads N]\n",
+            argv[0]);
+    return 1;
+  }
+
+  Job *jobs;
+  size_t job_count;
+  if (load_manifest(manifest_path, &jobs, &job_count)) {
+    free_jobs(jobs, job_count);
+    return 1;
+  }
+
+  FILE *out = stdout;
+  if (output_path) {
+    out = fopen(output_path, "w");
+    if (!out) {
+      perror("Failed to open output");
+      free_jobs(jobs, job_count);
+      return 1;
+    }
+  }
+
+  if ((size_t)threads > job_count) {
+    threads = job_count ? (long)job_count : 1;
+  }
+  unsigned workers = (unsigned)threads;
+
+  Pool pool = {.jobs = jobs, .workers = workers, .out = out};
+  atomic_init(&pool.failed, 0);
+  pool.deques = calloc(workers, sizeof(Deque));
+  Worker *worker = calloc(workers, sizeof(Worker));
+  // deal the jobs round robin; each deque gets a contiguous slice of
+  // slots, large enough for its share
+  size_t share = job_count ? (job_count + workers - 1) / workers : 1;
+  int64_t *slots = calloc(share * workers, sizeof(int64_t));
+  int err = 0;
+  if (!pool.deques || !worker || !slots) {
+    perror("Failed to allocate workers");
+    err = 1;
+    goto cleanup;
+  }
+
+  for (unsigned w = 0; w < workers; w++) {
+    Deque *deque = &pool.deques[w];
+    deque->jobs = slots + w * share;
+    int64_t n = 0;
+    for (size_t job = w; job < job_count; job += workers) {
+      deque->jobs[n++] = (int64_t)job;
+    }
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, n);
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // the workers that did start steal the jobs dealt to any that did not
+  unsigned started = 0;
+  for (; started < workers; started++) {
+    worker[started] = (Worker){.pool = &pool, .index = started};
+    if (pthread_create(&worker[started].thread, NULL, work,
+                       &worker[started])) {
+      fprintf(stderr, "Failed to start worker %u\n", started);
+      break;
+    }
+  }
+  if (started == 0) {
+    err = 1;
+    goto cleanup;
+  }
+  for (unsigned w = 0; w < started; w++) {
+    pthread_join(worker[w].thread, NULL);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds =
+      (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  unsigned failed = atomic_load(&pool.failed);
+  fprintf(stderr, "%zu jobs (%u failed) on %u workers in %.3f s\n",
+          job_count, failed, started, seconds);
+  err = failed != 0;
+
+cleanup:
+  if (out != stdout) {
+    fclose(out);
+  }
+  free(slots);
+  free(worker);
+  free(pool.deques);
+  free_jobs(jobs, job_count);
+  return err;
+}
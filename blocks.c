@@ -0,0 +1,200 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "blocks.h"
+#include "chip8.h"
+#include "opcodes.h"
+
+/**
+ * BASIC BLOCKS AND SUPERINSTRUCTIONS
+ *
+ * a basic block is a run of straight-line instructions ending at the
+ * first jump, skip, call or return (or at an instruction that may leave
+ * PC unchanged, such as a throttled draw)
+ *
+ * a few short sequences dominate the execution profile of typical ROMs;
+ * when the block engine is selected, chip8_decode_block recognizes them
+ * at the start of a block and caches a single superinstruction covering
+ * the whole sequence, so it costs one dispatch instead of several
+ *
+ * every superinstruction leaves PC, VF and all other state exactly as
+ * executing the individual handlers in opcodes.c would
+ */
+
+/**
+ * HELPER FUNCTIONS
+ */
+
+/**
+ * true if control may not fall through to the next instruction
+ */
+static bool ends_block(uint8_t op) {
+  switch (op) {
+  case OP_UNKNOWN:
+  case OP_00EE:
+  case OP_1NNN:
+  case OP_2NNN:
+  case OP_3XNN:
+  case OP_4XNN:
+  case OP_5XY0:
+  case OP_9XY0:
+  case OP_BNNN:
+  case OP_BXNN:
+  case OP_DXYN:
+  case OP_DXYN_CLIP:
+  case OP_DXYN_VBLANK:
+  case OP_DXYN_VBLANK_CLIP:
+  case OP_EX9E:
+  case OP_EXA1:
+  case OP_FX0A:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static uint16_t read_opcode(Chip8 *chip, uint16_t addr) {
+  return chip->memory[addr] << 8 | chip->memory[addr + 1];
+}
+
+/**
+ * decode the instruction at pc (which must be even) into the decode
+ * cache, fusing it with the instructions that follow it into a
+ * superinstruction if they form one of the recognized sequences
+ */
+void chip8_decode_block(Chip8 *chip, uint16_t pc) {
+  Chip8Instruction *ins = &chip->decode_cache[pc >> 1];
+  Chip8Instruction seq[MAX_SUPERINSTRUCTION_LENGTH] = {0};
+  int count = 0;
+
+  // decode the rest of the basic block
+  for (uint32_t addr = pc;
+       count < MAX_SUPERINSTRUCTION_LENGTH && addr + 1 < MEMORY_SIZE;
+       addr += 2) {
+    Chip8Instruction *next = &seq[count++];
+    chip8_decode(chip->quirks, read_opcode(chip, addr), next);
+    if (ends_block(next->op)) {
+      break;
+    }
+  }
+
+  *ins = seq[0];
+
+  // FX07 3XNN: read the delay timer and skip if it has reached NN
+  if (count >= 2 && seq[0].op == OP_FX07 && seq[1].op == OP_3XNN &&
+      seq[1].x == seq[0].x) {
+    ins->handler = op_super_delay_poll;
+    ins->op = OP_SUPER_DELAY_POLL;
+    ins->nn = seq[1].nn;
+    ins->length = 2;
+    return;
+  }
+
+  // 1NNN back to an FX07 3XNN poll just before it: the rest of a delay
+  // timer spin loop, so that each further iteration is one dispatch
+  // (chip8_invalidate_code knows this entry depends on the two before)
+  uint16_t loop = pc - 4;
+  if (pc >= 4 && seq[0].op == OP_1NNN && seq[0].nnn == loop) {
+    Chip8Instruction poll[2];
+    chip8_decode(chip->quirks, read_opcode(chip, loop), &poll[0]);
+    chip8_decode(chip->quirks, read_opcode(chip, loop + 2), &poll[1]);
+    if (poll[0].op == OP_FX07 && poll[1].op == OP_3XNN &&
+        poll[1].x == poll[0].x) {
+      ins->handler = op_super_delay_spin;
+      ins->op = OP_SUPER_DELAY_SPIN;
+      ins->x = poll[0].x;
+      ins->nn = poll[1].nn;
+      ins->length = 3;
+      return;
+    }
+  }
+
+  // ANNN DXYN: point I at a sprite and draw it; nn records which
+  // variant of the draw the quirks select
+  if (count >= 2 && seq[0].op == OP_ANNN && opcode_is_draw(seq[1].op)) {
+    ins->handler = op_super_draw;
+    ins->op = OP_SUPER_DRAW;
+    ins->nn = seq[1].op;
+    ins->x = seq[1].x;
+    ins->y = seq[1].y;
+    ins->n = seq[1].n;
+    ins->length = 2;
+    return;
+  }
+
+  // run of 6XNN / 7XNN register loads and adds; nn records which of
+  // the instructions are adds (one bit each, first instruction in bit 0)
+  int run = 0;
+  uint8_t adds = 0;
+  while (run < count && (seq[run].op == OP_6XNN || seq[run].op == OP_7XNN)) {
+    if (seq[run].op == OP_7XNN) {
+      adds |= 1 << run;
+    }
+    run++;
+  }
+  if (run >= 2) {
+    ins->handler = op_super_load_run;
+    ins->op = OP_SUPER_LOAD_RUN;
+    ins->nn = adds;
+    ins->length = run;
+  }
+}
+
+/**
+ * SUPERINSTRUCTIONS
+ */
+
+/**
+ * 6XNN / 7XNN run (VX := NN or VX += NN for each instruction)
+ *
+ * operands are read straight from memory; the decode cache guarantees
+ * they are unchanged since the run was recognized
+ */
+void op_super_load_run(Chip8 *chip, const Chip8Instruction *ins) {
+  const uint8_t *code = &chip->memory[chip->PC];
+  for (int i = 0; i < ins->length; i++) {
+    uint8_t x = code[2 * i] & 0x0F;
+    uint8_t n = code[2 * i + 1];
+    if (ins->nn & (1 << i)) {
+      chip->V[x] += n;
+    } else {
+      chip->V[x] = n;
+    }
+  }
+  chip->PC += 2 * ins->length;
+}
+
+/**
+ * FX07 3XNN (VX := delay; skip the next instruction if VX == NN)
+ */
+void op_super_delay_poll(Chip8 *chip, const Chip8Instruction *ins) {
+  chip->V[ins->x] = chip->delay_timer;
+  chip->PC += chip->V[ins->x] == ins->nn ? 6 : 4;
+}
+
+/**
+ * 1NNN FX07 3XNN, where the jump goes back to the FX07 3XNN right
+ * before it (one more iteration of a delay timer spin loop)
+ *
+ * PC ends up back on the jump if the loop continues, or on the
+ * instruction after it if VX == NN
+ */
+void op_super_delay_spin(Chip8 *chip, const Chip8Instruction *ins) {
+  chip->V[ins->x] = chip->delay_timer;
+  if (chip->V[ins->x] == ins->nn) {
+    chip->PC += 2;
+  }
+}
+
+/**
+ * ANNN DXYN (I := NNN; draw sprite)
+ *
+ * if the draw is throttled, PC is left on the DXYN, exactly as if the
+ * two instructions had been executed one at a time
+ */
+void op_super_draw(Chip8 *chip, const Chip8Instruction *ins) {
+  chip->I = ins->nnn;
+  chip->PC += 2;
+  Chip8Instruction draw = {.x = ins->x, .y = ins->y, .n = ins->n};
+  opcode_handlers[ins->nn](chip, &draw);
+}
@@ -0,0 +1,14 @@
+#ifndef BLOCKS_H
+#define BLOCKS_H
+
+#include "chip8.h"
+#include <stdint.h>
+
+void chip8_decode_block(Chip8 *chip, uint16_t pc);
+
+void op_super_load_run(Chip8 *chip, const Chip8Instruction *ins);
+void op_super_delay_poll(Chip8 *chip, const Chip8Instruction *ins);
+void op_super_delay_spin(Chip8 *chip, const Chip8Instruction *ins);
+void op_super_draw(Chip8 *chip, const Chip8Instruction *ins);
+
+#endif
@@ -1,3 +1,5 @@
+#define _DEFAULT_SOURCE
+
 #include <inttypes.h>
 #include <math.h>
 #include <stdbool.h>
@@ -6,11 +8,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include "blocks.h"
 #include "chip8.h"
+#include "jit.h"
+#include "profile.h"
+#include "replay.h"
+#include "rewind.h"
+#include "threaded.h"
+#include "trace.h"
 #include "opcodes.h"
 
-uint8_t vip_font[] = {
+static const uint8_t vip_font[] = {
     0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
     0x60, 0x20, 0x20, 0x20, 0x70, // 1
     0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
@@ -28,25 +38,123 @@ uint8_t vip_font[] = {
     0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
     0xF0, 0x80, 0xF0, 0x80, 0x80, // F
 };
-int font_len = sizeof(vip_font) / sizeof(vip_font[0]);
+static const int font_len = sizeof(vip_font) / sizeof(vip_font[0]);
 
-bool debug;
-double cycles_per_second;
+// seed used until chip8_seed is called, so runs are reproducible by default
+#define DEFAULT_SEED 0x9E3779B97F4A7C15ULL
 
 /**
- * initialize chip8 struct and set global variables
+ * FNV-1a hash of the whole memory, taken when a rom is loaded
  */
-void chip8_init(Chip8 *chip, double clock_speed, bool debug_flag,
-                Chip8Quirks *quirks) {
+static uint64_t hash_memory(const Chip8 *chip) {
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  for (int addr = 0; addr < MEMORY_SIZE; addr++) {
+    hash = (hash ^ chip->memory[addr]) * 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+/**
+ * initialize chip8 struct
+ *
+ * all emulator state lives in the struct, so any number of instances
+ * can be initialized and run independently (including on separate
+ * threads)
+ */
+void chip8_init(Chip8 *chip, double clock_speed, bool debug,
+                const Chip8Quirks *quirks) {
   memset(chip, 0, sizeof(Chip8));
   chip->PC = PROGRAM_START;
-  cycles_per_second = clock_speed;
-  debug = debug_flag;
+  chip->cycles_per_second = clock_speed;
+  chip->debug = debug;
   chip->quirks = quirks;
+  chip8_seed(chip, DEFAULT_SEED);
   // load font
   memcpy(&chip->memory[FONT_START], vip_font, font_len);
   // not waiting for any key input on init
   chip->FX0A_key = -1;
+  chip->rom_hash = hash_memory(chip);
+}
+
+/**
+ * seed the instance's random number generator
+ *
+ * the seed is scrambled with a splitmix64 step because xorshift
+ * generators must never be in the all zero state
+ */
+void chip8_seed(Chip8 *chip, uint64_t seed) {
+  uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  z ^= z >> 31;
+  chip->rng_state = z ? z : DEFAULT_SEED;
+}
+
+/**
+ * return the next random byte from the instance's xorshift64*
+ * generator (no locking, unlike libc rand())
+ */
+uint8_t chip8_random(Chip8 *chip) {
+  uint64_t x = chip->rng_state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  chip->rng_state = x;
+  // the high bits of the multiplied output have the best quality
+  return (x * 0x2545F4914F6CDD1DULL) >> 56;
+}
+
+/**
+ * release resources owned by the instance (currently only the JIT
+ * arena); the struct itself belongs to the caller
+ */
+void chip8_destroy(Chip8 *chip) {
+  chip8_jit_destroy(chip->jit);
+  chip->jit = NULL;
+}
+
+/**
+ * QUIRK PROFILES
+ *
+ * the original COSMAC VIP interpreter, SUPER-CHIP 1.1 (as on the HP48)
+ * and XO-CHIP (Octo)
+ */
+const Chip8Quirks chip8_quirks_vip = {.logic_resets_vf = true,
+                                      .load_store_increment_i = true,
+                                      .draw_waits_for_vblank = true,
+                                      .clip_sprites = true,
+                                      .shift_uses_vx = false,
+                                      .jump_uses_vx = false};
+
+const Chip8Quirks chip8_quirks_schip = {.logic_resets_vf = false,
+                                        .load_store_increment_i = false,
+                                        .draw_waits_for_vblank = false,
+                                        .clip_sprites = true,
+                                        .shift_uses_vx = true,
+                                        .jump_uses_vx = true};
+
+const Chip8Quirks chip8_quirks_xochip = {.logic_resets_vf = false,
+                                         .load_store_increment_i = true,
+                                         .draw_waits_for_vblank = false,
+                                         .clip_sprites = false,
+                                         .shift_uses_vx = false,
+                                         .jump_uses_vx = false};
+
+/**
+ * look up a quirk profile by name ("vip", "schip" or "xo-chip");
+ * returns nonzero if the name is unknown
+ */
+int chip8_parse_profile(const char *name, const Chip8Quirks **quirks) {
+  if (strcmp(name, "vip") == 0) {
+    *quirks = &chip8_quirks_vip;
+  } else if (strcmp(name, "schip") == 0) {
+    *quirks = &chip8_quirks_schip;
+  } else if (strcmp(name, "xo-chip") == 0) {
+    *quirks = &chip8_quirks_xochip;
+  } else {
+    return 1;
+  }
+  return 0;
 }
 
 /**
@@ -71,26 +179,315 @@ int chip8_load_rom(Chip8 *chip, const char *filename) {
 
   fread(&chip->memory[PROGRAM_START], size, 1, file);
   fclose(file);
+  chip8_invalidate_code(chip, PROGRAM_START, size);
+  memset(chip->code_written, 0, sizeof(chip->code_written));
+  chip->rom_hash = hash_memory(chip);
   return 0;
 }
 
 /**
- * run the interpreter
+ * load a rom image that is already in memory (e.g. embedded in a
+ * recompiled program, see aot.c)
  */
-void chip8_run(Chip8 *chip, chip8_draw_callback draw,
-               chip8_event_callback handle_events,
-               chip8_time_func get_current_time,
-               chip8_sleep_func sleep_for_milliseconds, void *userdata) {
+int chip8_load_rom_data(Chip8 *chip, const uint8_t *data, size_t size) {
+  if (size > (MEMORY_SIZE - PROGRAM_START)) {
+    fprintf(stderr, "ROM too large\n");
+    return 1;
+  }
+
+  memcpy(&chip->memory[PROGRAM_START], data, size);
+  chip8_invalidate_code(chip, PROGRAM_START, size);
+  memset(chip->code_written, 0, sizeof(chip->code_written));
+  chip->rom_hash = hash_memory(chip);
+  return 0;
+}
 
+/**
+ * SNAPSHOTS
+ *
+ * a Chip8State holds everything a program can change, so restoring one
+ * makes an instance continue exactly where the snapshot was taken; one
+ * warmed-up state can be restored into any number of instances (e.g. to
+ * search over inputs from the same position)
+ */
+
+/**
+ * copy the state of the instance into a snapshot
+ */
+void chip8_snapshot(const Chip8 *chip, Chip8State *state) {
+  state->rng_state = chip->rng_state;
+  state->rom_hash = chip->rom_hash;
+  memcpy(state->V, chip->V, sizeof(state->V));
+  memcpy(state->stack, chip->stack, sizeof(state->stack));
+  state->I = chip->I;
+  state->PC = chip->PC;
+  state->SP = chip->SP;
+  state->delay_timer = chip->delay_timer;
+  state->sound_timer = chip->sound_timer;
+  memcpy(state->keypad, chip->keypad, sizeof(state->keypad));
+  state->FX0A_waiting = chip->FX0A_waiting;
+  state->FX0A_key = chip->FX0A_key;
+  state->FX0A_reg = chip->FX0A_reg;
+  state->draw_permitted = chip->draw_permitted;
+  memcpy(state->display, chip->display, sizeof(state->display));
+  memcpy(state->code_written, chip->code_written,
+         sizeof(state->code_written));
+  memcpy(state->memory, chip->memory, MEMORY_SIZE);
+}
+
+/**
+ * put the instance back into the state of a snapshot; quirks, engine
+ * and clock speed stay as they are
+ *
+ * if the snapshot was taken from the same rom, memory can only differ
+ * where either program wrote to it since loading, so only those bytes
+ * are copied and only their cached decodings dropped; restoring then
+ * costs a few cache lines instead of all of memory and the decode cache
+ */
+void chip8_restore(Chip8 *chip, const Chip8State *state) {
+  chip->rng_state = state->rng_state;
+  memcpy(chip->V, state->V, sizeof(chip->V));
+  memcpy(chip->stack, state->stack, sizeof(chip->stack));
+  chip->I = state->I;
+  chip->PC = state->PC;
+  chip->SP = state->SP;
+  chip->delay_timer = state->delay_timer;
+  chip->sound_timer = state->sound_timer;
+  memcpy(chip->keypad, state->keypad, sizeof(chip->keypad));
+  chip->FX0A_waiting = state->FX0A_waiting;
+  chip->FX0A_key = state->FX0A_key;
+  chip->FX0A_reg = state->FX0A_reg;
+  chip->draw_permitted = state->draw_permitted;
+
+  for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+    if (chip->display[y] != state->display[y]) {
+      chip->display[y] = state->display[y];
+      chip->draw_flag = true;
+    }
+  }
+
+  if (chip->rom_hash == state->rom_hash) {
+    for (int word = 0; word < MEMORY_SIZE / 128; word++) {
+      uint64_t bits = chip->code_written[word] | state->code_written[word];
+      while (bits) {
+        uint16_t addr = (word * 64 + __builtin_ctzll(bits)) * 2;
+        bits &= bits - 1;
+        if (memcmp(&chip->memory[addr], &state->memory[addr], 2) != 0) {
+          memcpy(&chip->memory[addr], &state->memory[addr], 2);
+          chip8_invalidate_code(chip, addr, 2);
+        }
+      }
+    }
+  } else {
+    memcpy(chip->memory, state->memory, MEMORY_SIZE);
+    chip8_invalidate_code(chip, 0, MEMORY_SIZE);
+    chip->rom_hash = state->rom_hash;
+  }
+  memcpy(chip->code_written, state->code_written,
+         sizeof(chip->code_written));
+}
+
+/**
+ * make child an independent copy of parent, settings and decode cache
+ * included; child is overwritten like by chip8_init (destroy it first if
+ * it was in use)
+ *
+ * returns nonzero if the parent's engine could not be set up for the
+ * child (see chip8_set_engine)
+ */
+int chip8_fork(const Chip8 *parent, Chip8 *child) {
+  memcpy(child, parent, sizeof(Chip8));
+  // recompiled code, recordings and profiles are owned by one instance
+  child->jit = NULL;
+  child->recorder = NULL;
+  child->profile = NULL;
+  child->trace = NULL;
+  if (parent->engine == CHIP8_ENGINE_JIT) {
+    return chip8_set_engine(child, CHIP8_ENGINE_JIT);
+  }
+  return 0;
+}
+
+/**
+ * RUN LOOP
+ */
+
+#define FRAMES_PER_SECOND 60
+#define NS_PER_SECOND 1000000000ull
+#define NS_PER_MS 1000000ull
+
+// precise pacing: bounds of the early wake-up margin that is spun
+// instead of slept (see wait_until)
+#define SPIN_MARGIN_MIN_NS 20000ull
+#define SPIN_MARGIN_MAX_NS 2000000ull
+
+/**
+ * nanosecond monotonic clock, the default for precise pacing
+ */
+uint64_t chip8_time_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * NS_PER_SECOND + (uint64_t)ts.tv_nsec;
+}
+
+void chip8_sleep_ns(uint64_t ns) {
+  struct timespec ts = {.tv_sec = ns / NS_PER_SECOND,
+                        .tv_nsec = ns % NS_PER_SECOND};
+  nanosleep(&ts, NULL);
+}
+
+/**
+ * defaults: precise pacing with the clock above, four batches per frame
+ * (240 Hz, 25 instructions per batch at the default clock speed), a
+ * quarter second catch-up window, at most four frames in a row
+ * skipped while catching up, and for virtual pacing unlimited speed
+ * with up to 60 presented frames per second
+ */
+void chip8_run_options_init(Chip8RunOptions *options) {
+  *options = (Chip8RunOptions){
+      .pacing = CHIP8_PACING_PRECISE,
+      .current_time_ns = chip8_time_ns,
+      .sleep_ns = chip8_sleep_ns,
+      .batches_per_frame = 4,
+      .max_catch_up_ns = 250 * NS_PER_MS,
+      .max_frame_skip = 4,
+      .speed = 0.0,
+      .present_rate = 60.0,
+  };
+}
+
+int chip8_parse_pacing(const char *name, Chip8Pacing *pacing) {
+  if (strcmp(name, "coarse") == 0) {
+    *pacing = CHIP8_PACING_COARSE;
+  } else if (strcmp(name, "precise") == 0) {
+    *pacing = CHIP8_PACING_PRECISE;
+  } else if (strcmp(name, "virtual") == 0) {
+    *pacing = CHIP8_PACING_VIRTUAL;
+  } else {
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * bookkeeping shared by the pacing loops
+ */
+typedef struct RunState {
+  const Chip8RunOptions *options;
+  // stats of the current second, for debug output
+  Chip8RunStats second;
+  uint64_t instructions;
+  // frames in a row that skipped presenting
+  uint32_t frames_skipped;
+} RunState;
+
+static void record_frame(Chip8RunStats *stats, uint64_t late_ns,
+                         bool dropped) {
+  stats->frames++;
+  stats->frames_dropped += dropped;
+  stats->late_total_ns += late_ns;
+  if (late_ns > stats->late_max_ns) {
+    stats->late_max_ns = late_ns;
+  }
+}
+
+static void record_time_lost(RunState *state, uint64_t lost_ns) {
+  state->second.time_lost_ns += lost_ns;
+  if (state->options->stats) {
+    state->options->stats->time_lost_ns += lost_ns;
+  }
+}
+
+/**
+ * whether frames currently step through the rewind buffer instead of
+ * running
+ */
+static bool replaying(const Chip8RunOptions *options) {
+  return options->rewind && options->rewind_direction != 0;
+}
+
+/**
+ * end a frame: tick the timers and record the frame into the rewind
+ * buffer, or while replaying, move one frame through the buffer instead
+ */
+static void tick_frame(Chip8 *chip, const Chip8RunOptions *options) {
+  if (!options->rewind) {
+    chip8_frame_tick(chip);
+  } else if (options->rewind_direction < 0) {
+    chip8_rewind_back(options->rewind, chip);
+  } else if (options->rewind_direction > 0) {
+    chip8_rewind_forward(options->rewind, chip);
+  } else {
+    chip8_frame_tick(chip);
+    chip8_rewind_record(options->rewind, chip);
+  }
+}
+
+/**
+ * update timers and draw if the display changed, unless the frame is so
+ * late that the next one is already due: then only the timers tick and
+ * the draw is left for a later frame, until max_frame_skip frames in a
+ * row have been skipped
+ */
+static void run_frame(Chip8 *chip, chip8_draw_callback draw, void *userdata,
+                      RunState *state, uint64_t late_ns) {
+  tick_frame(chip, state->options);
+
+  bool behind = late_ns >= NS_PER_SECOND / FRAMES_PER_SECOND;
+  bool dropped =
+      behind && state->frames_skipped < state->options->max_frame_skip;
+  if (dropped) {
+    state->frames_skipped++;
+  } else {
+    state->frames_skipped = 0;
+    if (draw && chip->draw_flag) {
+      draw(userdata);
+      chip->draw_flag = false;
+    }
+  }
+
+  record_frame(&state->second, late_ns, dropped);
+  if (state->options->stats) {
+    record_frame(state->options->stats, late_ns, dropped);
+  }
+}
+
+/**
+ * print execution speed, FPS and frame pacing info for the last second
+ */
+static void print_debug_stats(RunState *state) {
+  Chip8RunStats *second = &state->second;
+  printf("Executed %" PRIu64 " instructions in last second\n",
+         state->instructions);
+  printf("Rendered %" PRIu64 " frames in last second\n",
+         second->frames - second->frames_dropped);
+  if (second->frames) {
+    printf("Frame lateness: mean %.1f us, max %.1f us\n",
+           second->late_total_ns / 1000.0 / second->frames,
+           second->late_max_ns / 1000.0);
+  }
+  if (second->frames_dropped || second->time_lost_ns) {
+    printf("Dropped %" PRIu64 " frames, lost %.1f ms\n",
+           second->frames_dropped, second->time_lost_ns / 1e6);
+  }
+  state->second = (Chip8RunStats){0};
+  state->instructions = 0;
+}
+
+static void run_coarse(Chip8 *chip, const Chip8RunOptions *options,
+                       chip8_draw_callback draw,
+                       chip8_event_callback handle_events, void *userdata) {
+  chip8_time_func get_current_time = options->current_time;
+  chip8_sleep_func sleep_for_milliseconds = options->sleep;
+
+  RunState state = {.options = options};
   double debug_timer = 0.0;
-  uint64_t instruction_counter = 0;
-  uint64_t frame_counter = 0;
 
   bool running = true;
-  const double frames_per_second = 60.0;
 
-  const double milliseconds_per_cycle = 1000.0 / cycles_per_second;
-  const double milliseconds_per_frame = 1000.0 / frames_per_second;
+  const double milliseconds_per_cycle = 1000.0 / chip->cycles_per_second;
+  const double milliseconds_per_frame = 1000.0 / FRAMES_PER_SECOND;
+  const double max_catch_up = (double)options->max_catch_up_ns / NS_PER_MS;
 
   double cycle_accumulator = 0.0;
   double frame_accumulator = 0.0;
@@ -99,7 +496,7 @@ void chip8_run(Chip8 *chip, chip8_draw_callback draw,
 
   while (running) {
     // for each iteration, update keypad data
-    running = handle_events(chip);
+    running = handle_events(chip, userdata);
 
     // get amount of time since last iteration
     double current_time = get_current_time();
@@ -111,59 +508,314 @@ void chip8_run(Chip8 *chip, chip8_draw_callback draw,
     cycle_accumulator += elapsed_time;
     frame_accumulator += elapsed_time;
 
+    // after a host stall, drop the time beyond the catch-up window
+    // instead of replaying all of it at once
+    double behind = fmax(cycle_accumulator, frame_accumulator);
+    if (max_catch_up > 0 && behind > max_catch_up) {
+      double lost = behind - max_catch_up;
+      cycle_accumulator -= lost;
+      frame_accumulator -= lost;
+      record_time_lost(&state, (uint64_t)(lost * NS_PER_MS));
+    }
+
     // run the number of CPU cycles that should have run since the last
-    // iteration (this can vary depending on the host)
-    while (cycle_accumulator >= milliseconds_per_cycle) {
-      chip8_cycle(chip);
-      instruction_counter++;
-      cycle_accumulator -= milliseconds_per_cycle;
+    // iteration (this can vary depending on the host); the fraction of a
+    // cycle left over is carried over
+    if (replaying(options)) {
+      cycle_accumulator = 0.0;
+    } else if (cycle_accumulator >= milliseconds_per_cycle) {
+      uint64_t cycles =
+          chip8_run_cycles(chip, cycle_accumulator / milliseconds_per_cycle);
+      state.instructions += cycles;
+      cycle_accumulator -= milliseconds_per_cycle * cycles;
     }
 
     // run a frame update if enough time has elapsed (update timers and
-    // draw screen if display has been updated)
+    // draw screen if display has been updated); whatever is left in the
+    // accumulator is how late the frame is
     while (frame_accumulator >= milliseconds_per_frame) {
-      chip8_update_timers(chip);
       frame_accumulator -= milliseconds_per_frame;
-      frame_counter++;
-
-      // allow one draw instruction to be executed this frame
-      chip->draw_permitted = true;
-
-      if (draw && chip->draw_flag) {
-        draw(userdata);
-        chip->draw_flag = false;
-      }
+      run_frame(chip, draw, userdata, &state,
+                (uint64_t)(frame_accumulator * NS_PER_MS));
     }
 
     // calculate the amount of time we can safely sleep (so the program
     // does not use 100% and waste iterations) before we need to
-    // run another loop
+    // run another loop; an idle chip has nothing to run before the
+    // next frame tick or key event
     double next_cycle_due = milliseconds_per_cycle - cycle_accumulator;
     double next_timer_due = milliseconds_per_frame - frame_accumulator;
-    uint32_t sleep_time =
-        (uint32_t)fmax(1.0, fmin(next_cycle_due, next_timer_due));
+    bool idle = chip8_idle(chip);
+    uint32_t sleep_time = (uint32_t)fmax(
+        1.0, idle ? next_timer_due : fmin(next_cycle_due, next_timer_due));
 
-    sleep_for_milliseconds(sleep_time);
+    if (idle && options->wait_for_input) {
+      options->wait_for_input(userdata, sleep_time * NS_PER_MS);
+    } else {
+      sleep_for_milliseconds(sleep_time);
+    }
 
-    if (debug) {
-      // print execution speed and FPS info
+    if (chip->debug) {
       debug_timer += elapsed_time;
       if (debug_timer >= 1000.0) {
-        printf("Executed %" PRIu64 " instructions in last second\n",
-               instruction_counter);
-        instruction_counter = 0;
-        printf("Rendered %" PRIu64 " frames in last second\n", frame_counter);
-        frame_counter = 0;
+        print_debug_stats(&state);
         debug_timer = 0.0;
       }
     }
   }
 }
 
+/**
+ * block until the deadline: sleep while comfortably ahead, then spin
+ * for the last stretch; returns the time it got to
+ *
+ * the spun margin follows how late sleeps typically wake up, so the
+ * spin costs little CPU on a quiet host and mostly lands on time on a
+ * noisy one
+ */
+static uint64_t wait_until(const Chip8RunOptions *options, uint64_t deadline,
+                           uint64_t *margin) {
+  uint64_t now = options->current_time_ns();
+  if (now + *margin < deadline) {
+    uint64_t requested = deadline - *margin - now;
+    options->sleep_ns(requested);
+    uint64_t woke = options->current_time_ns();
+    uint64_t slept = woke - now;
+    uint64_t overshoot = slept > requested ? slept - requested : 0;
+    // moving average of the overshoot with a quarter on top as
+    // headroom; single outliers only nudge it
+    int64_t target = overshoot + overshoot / 4;
+    *margin += (target - (int64_t)*margin) / 8;
+    if (*margin < SPIN_MARGIN_MIN_NS) {
+      *margin = SPIN_MARGIN_MIN_NS;
+    } else if (*margin > SPIN_MARGIN_MAX_NS) {
+      *margin = SPIN_MARGIN_MAX_NS;
+    }
+    now = woke;
+  }
+  while (now < deadline) {
+    now = options->current_time_ns();
+  }
+  return now;
+}
+
+/**
+ * wait_until for an idle chip: the sleep is done in wait_for_input when
+ * there is one, returning early (false) if input arrives
+ */
+static bool wait_idle(const Chip8RunOptions *options, void *userdata,
+                      uint64_t deadline, uint64_t *margin) {
+  uint64_t now = options->current_time_ns();
+  if (options->wait_for_input && now + *margin < deadline &&
+      options->wait_for_input(userdata, deadline - *margin - now)) {
+    return false;
+  }
+  wait_until(options, deadline, margin);
+  return true;
+}
+
+static void run_precise(Chip8 *chip, const Chip8RunOptions *options,
+                        chip8_draw_callback draw,
+                        chip8_event_callback handle_events, void *userdata) {
+  const uint64_t batches_per_frame =
+      options->batches_per_frame ? options->batches_per_frame : 1;
+  const uint64_t batches_per_second = FRAMES_PER_SECOND * batches_per_frame;
+  const double cycles_per_batch =
+      chip->cycles_per_second / (double)batches_per_second;
+
+  RunState state = {.options = options};
+
+  double cycle_accumulator = 0.0;
+  uint64_t margin = SPIN_MARGIN_MIN_NS;
+  // batches run, and batches given up after stalls (whole frames, so
+  // frame boundaries stay where they are)
+  uint64_t batch = 0;
+  uint64_t batches_lost = 0;
+  const uint64_t start = options->current_time_ns();
+
+  while (handle_events(chip, userdata)) {
+    batch++;
+    // deadlines are computed from the start rather than the previous
+    // deadline so rounding never accumulates into drift
+    uint64_t deadline =
+        start + (batch + batches_lost) * NS_PER_SECOND / batches_per_second;
+
+    // an idle chip cannot change before the frame tick or a key event:
+    // block until the end of the frame (or input) instead of waking up
+    // for every batch; the batches in between then run back to back,
+    // each skipping straight through the wait
+    if (batch % batches_per_frame && chip8_idle(chip)) {
+      uint64_t frame_end = batch - batch % batches_per_frame +
+                           batches_per_frame + batches_lost;
+      uint64_t frame_deadline =
+          start + frame_end * NS_PER_SECOND / batches_per_second;
+      if (!wait_idle(options, userdata, frame_deadline, &margin)) {
+        // input arrived: handle it and reconsider this batch
+        batch--;
+        continue;
+      }
+    }
+
+    uint64_t now = wait_until(options, deadline, &margin);
+
+    // after a host stall, give up whole frames until the loop is back
+    // within the catch-up window instead of replaying all of them
+    if (options->max_catch_up_ns && now - deadline > options->max_catch_up_ns) {
+      uint64_t frames = (now - deadline - options->max_catch_up_ns) *
+                            FRAMES_PER_SECOND / NS_PER_SECOND +
+                        1;
+      batches_lost += frames * batches_per_frame;
+      uint64_t skipped_to =
+          start + (batch + batches_lost) * NS_PER_SECOND / batches_per_second;
+      record_time_lost(&state, skipped_to - deadline);
+      deadline = skipped_to;
+    }
+
+    // the batch covers the interval that ended at the deadline; the
+    // fraction of a cycle left over is carried over
+    cycle_accumulator += cycles_per_batch;
+    if (replaying(options)) {
+      cycle_accumulator = 0.0;
+    } else if (cycle_accumulator >= 1.0) {
+      uint64_t cycles = chip8_run_cycles(chip, (uint64_t)cycle_accumulator);
+      state.instructions += cycles;
+      cycle_accumulator -= cycles;
+    }
+
+    if (batch % batches_per_frame == 0) {
+      now = options->current_time_ns();
+      run_frame(chip, draw, userdata, &state,
+                now > deadline ? now - deadline : 0);
+
+      if (chip->debug && state.second.frames == FRAMES_PER_SECOND) {
+        print_debug_stats(&state);
+      }
+    }
+  }
+}
+
+static void run_virtual(Chip8 *chip, const Chip8RunOptions *options,
+                        chip8_draw_callback draw,
+                        chip8_event_callback handle_events, void *userdata) {
+  const double cycles_per_frame =
+      chip->cycles_per_second / (double)FRAMES_PER_SECOND;
+
+  RunState state = {.options = options};
+  uint64_t presented = 0;
+
+  double cycle_accumulator = 0.0;
+  uint64_t margin = SPIN_MARGIN_MIN_NS;
+  uint64_t now = options->current_time_ns();
+  uint64_t last_present = 0;
+  uint64_t debug_start = now;
+
+  // virtual frames are mapped onto real time from an anchor that moves
+  // whenever the speed changes
+  double speed = options->speed;
+  uint64_t anchor = now;
+  uint64_t frames_since_anchor = 0;
+
+  while (handle_events(chip, userdata)) {
+    if (options->speed != speed) {
+      speed = options->speed;
+      anchor = options->current_time_ns();
+      frames_since_anchor = 0;
+    }
+
+    // a whole virtual frame of instructions, then its timer tick; the
+    // fraction carries over to the next frame
+    cycle_accumulator += cycles_per_frame;
+    if (replaying(options)) {
+      cycle_accumulator = 0.0;
+    } else if (cycle_accumulator >= 1.0) {
+      uint64_t cycles = chip8_run_cycles(chip, (uint64_t)cycle_accumulator);
+      state.instructions += cycles;
+      cycle_accumulator -= cycles;
+    }
+    tick_frame(chip, options);
+    frames_since_anchor++;
+
+    // unlimited speed never sleeps, otherwise wait for the real time
+    // the frame maps to
+    if (speed > 0.0) {
+      double frame_ns = (double)NS_PER_SECOND / FRAMES_PER_SECOND / speed;
+      uint64_t deadline = anchor + (uint64_t)(frames_since_anchor * frame_ns);
+      now = wait_until(options, deadline, &margin);
+    } else {
+      now = options->current_time_ns();
+    }
+
+    // presenting is throttled by real time so a fast run is not bound
+    // by the draw callback
+    if (draw && chip->draw_flag &&
+        (options->present_rate <= 0.0 ||
+         now - last_present >= NS_PER_SECOND / options->present_rate)) {
+      draw(userdata);
+      chip->draw_flag = false;
+      last_present = now;
+      presented++;
+    }
+
+    record_frame(&state.second, 0, false);
+    if (options->stats) {
+      record_frame(options->stats, 0, false);
+    }
+
+    if (chip->debug && now - debug_start >= NS_PER_SECOND) {
+      printf("Ran %" PRIu64 " virtual frames (%.1fx real time), "
+             "%" PRIu64 " instructions, presented %" PRIu64 "\n",
+             state.second.frames,
+             state.second.frames * (double)NS_PER_SECOND /
+                 (FRAMES_PER_SECOND * (double)(now - debug_start)),
+             state.instructions, presented);
+      state.second = (Chip8RunStats){0};
+      state.instructions = 0;
+      presented = 0;
+      debug_start = now;
+    }
+  }
+}
+
+/**
+ * run the interpreter with the given pacing until handle_events returns
+ * false
+ */
+void chip8_run_with_options(Chip8 *chip, const Chip8RunOptions *options,
+                            chip8_draw_callback draw,
+                            chip8_event_callback handle_events,
+                            void *userdata) {
+  if (options->pacing == CHIP8_PACING_PRECISE) {
+    run_precise(chip, options, draw, handle_events, userdata);
+  } else if (options->pacing == CHIP8_PACING_VIRTUAL) {
+    run_virtual(chip, options, draw, handle_events, userdata);
+  } else {
+    run_coarse(chip, options, draw, handle_events, userdata);
+  }
+}
+
+/**
+ * run the interpreter with coarse pacing on a millisecond clock
+ */
+void chip8_run(Chip8 *chip, chip8_draw_callback draw,
+               chip8_event_callback handle_events,
+               chip8_time_func get_current_time,
+               chip8_sleep_func sleep_for_milliseconds, void *userdata) {
+  Chip8RunOptions options;
+  chip8_run_options_init(&options);
+  options.pacing = CHIP8_PACING_COARSE;
+  options.current_time = get_current_time;
+  options.sleep = sleep_for_milliseconds;
+  chip8_run_with_options(chip, &options, draw, handle_events, userdata);
+}
+
 /**
  * handle key event
  */
 void chip8_key_event(Chip8 *chip, uint8_t key, Chip8EventType dir) {
+  if (chip->recorder) {
+    chip8_recorder_key(chip->recorder, chip, key, dir);
+  }
+
   if (dir == CHIP8_KEY_DOWN) {
     chip->keypad[key] = true;
 
@@ -183,6 +835,64 @@ void chip8_key_event(Chip8 *chip, uint8_t key, Chip8EventType dir) {
   }
 }
 
+/**
+ * true if the pixel at (x, y) is lit; frontends should read the
+ * display through this rather than depend on its packed layout
+ */
+bool chip8_pixel(const Chip8 *chip, int x, int y) {
+  return chip->display[y] >> (DISPLAY_WIDTH - 1 - x) & 1;
+}
+
+/**
+ * FNV-1a hash of the display contents, one row word at a time; lets a
+ * frontend skip presenting frames whose draws cancelled out (e.g. a
+ * sprite erased and redrawn in place)
+ */
+uint64_t chip8_display_hash(const Chip8 *chip) {
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+    hash = (hash ^ chip->display[y]) * 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+/**
+ * FNV-1a hash of everything a running program can change (see
+ * Chip8State), cheap enough to take every frame: memory only enters it
+ * where the program wrote to it, since the rest is still the rom
+ */
+uint64_t chip8_state_hash(const Chip8 *chip) {
+  uint64_t words[8];
+  memcpy(&words[0], chip->V, sizeof(chip->V));
+  memcpy(&words[2], chip->keypad, sizeof(chip->keypad));
+  words[4] = (uint64_t)chip->I | (uint64_t)chip->PC << 16 |
+             (uint64_t)chip->SP << 32 | (uint64_t)chip->delay_timer << 40 |
+             (uint64_t)chip->sound_timer << 48;
+  words[5] = (uint64_t)chip->FX0A_waiting | (uint64_t)chip->FX0A_key << 8 |
+             (uint64_t)chip->FX0A_reg << 16 |
+             (uint64_t)chip->draw_permitted << 24;
+  words[6] = chip->rng_state;
+  words[7] = chip->rom_hash;
+
+  uint64_t hash = chip8_display_hash(chip);
+  for (int i = 0; i < 8; i++) {
+    hash = (hash ^ words[i]) * 0x100000001B3ULL;
+  }
+  for (int i = 0; i < STACK_SIZE; i++) {
+    hash = (hash ^ chip->stack[i]) * 0x100000001B3ULL;
+  }
+  for (int word = 0; word < MEMORY_SIZE / 128; word++) {
+    for (uint64_t bits = chip->code_written[word]; bits; bits &= bits - 1) {
+      uint16_t addr = (word * 64 + __builtin_ctzll(bits)) * 2;
+      uint64_t written = (uint64_t)addr << 16 |
+                         (uint64_t)chip->memory[addr] << 8 |
+                         chip->memory[addr + 1];
+      hash = (hash ^ written) * 0x100000001B3ULL;
+    }
+  }
+  return hash;
+}
+
 /**
  * update timers
  *
@@ -197,23 +907,281 @@ void chip8_update_timers(Chip8 *chip) {
 }
 
 /**
- * execute a single CPU cycle (fetch, decode, execute)
+ * end the current frame: update timers and allow one draw instruction
+ * to be executed in the next frame
+ */
+void chip8_frame_tick(Chip8 *chip) {
+  chip8_update_timers(chip);
+  chip->draw_permitted = true;
+  if (chip->recorder) {
+    chip8_recorder_frame(chip->recorder, chip);
+  }
+}
+
+/**
+ * IDLE DETECTION
+ *
+ * programs mostly wait by spinning: on FX0A, on a draw stalled until the
+ * vertical blank, in a jump to itself, or polling the delay timer
+ *
+ *   FX07       VX := delay
+ *   3XNN/4XNN  skip the jump once VX reaches (or leaves) NN
+ *   1NNN       back to the FX07
+ *
+ * until the next frame tick or key event every iteration of such a loop
+ * does exactly the same thing, so whole iterations can be skipped at
+ * once, leaving the chip as if it had spun through them
+ */
+
+static uint16_t read_opcode(const Chip8 *chip, uint16_t addr) {
+  return chip->memory[addr] << 8 | chip->memory[addr + 1];
+}
+
+/**
+ * if the delay timer poll around PC is idle, return the address of its
+ * FX07 (the loop head), otherwise -1
+ */
+static int idle_delay_poll(const Chip8 *chip) {
+  uint16_t pc = chip->PC;
+  for (uint16_t offset = 0; offset <= 4 && offset <= pc; offset += 2) {
+    uint16_t head = pc - offset;
+    if (head + 6 > MEMORY_SIZE) {
+      continue;
+    }
+    uint16_t load = read_opcode(chip, head);
+    uint16_t test = read_opcode(chip, head + 2);
+    uint8_t x = load >> 8 & 0xF;
+    if ((load & 0xF0FF) != 0xF007 || (test & 0x0F00) >> 8 != x ||
+        ((test & 0xF000) != 0x3000 && (test & 0xF000) != 0x4000) ||
+        read_opcode(chip, head + 4) != (0x1000 | head)) {
+      continue;
+    }
+    // entering at the test, the first iteration tests the current VX
+    // instead of the timer
+    if (offset == 2 && chip->V[x] != chip->delay_timer) {
+      return -1;
+    }
+    bool exits = (test & 0xF000) == 0x3000
+                     ? chip->delay_timer == (test & 0xFF)
+                     : chip->delay_timer != (test & 0xFF);
+    return exits ? -1 : head;
+  }
+  return -1;
+}
+
+/**
+ * true if nothing the program does can change until the next frame tick
+ * or key event
+ */
+bool chip8_idle(const Chip8 *chip) {
+  if (chip->FX0A_waiting) {
+    return true;
+  }
+  uint16_t pc = chip->PC;
+  if ((pc & 1) || pc + 2 > MEMORY_SIZE) {
+    return false;
+  }
+  uint16_t opcode = read_opcode(chip, pc);
+  if (opcode == (0x1000 | pc)) {
+    return true;
+  }
+  if ((opcode & 0xF000) == 0xD000 && chip->quirks->draw_waits_for_vblank &&
+      !chip->draw_permitted) {
+    return true;
+  }
+  return idle_delay_poll(chip) >= 0;
+}
+
+/**
+ * if the chip is idle (see chip8_idle), consume as many whole
+ * iterations of its wait as fit in the given number of cycles and
+ * return the number of cycles consumed, otherwise return 0
+ */
+uint64_t chip8_skip_idle(Chip8 *chip, uint64_t cycles) {
+  if (chip->FX0A_waiting) {
+    return cycles;
+  }
+  int head = idle_delay_poll(chip);
+  if (head >= 0) {
+    // three instructions per iteration; each one reloads VX
+    uint64_t skipped = cycles - cycles % 3;
+    if (skipped) {
+      chip->V[read_opcode(chip, head) >> 8 & 0xF] = chip->delay_timer;
+    }
+    return skipped;
+  }
+  // one instruction per iteration, without any effect
+  return chip8_idle(chip) ? cycles : 0;
+}
+
+/**
+ * chip8_skip_idle, with the skipped cycles counted by the trace and the
+ * profiler
  */
-void chip8_cycle(Chip8 *chip) {
+static uint64_t skip_idle(Chip8 *chip, uint64_t cycles) {
+  uint64_t skipped = chip8_skip_idle(chip, cycles);
+  if (chip->trace && skipped) {
+    chip8_trace_idle(chip, skipped);
+  }
+#ifdef CHIP8_PROFILE
+  if (chip->profile && skipped) {
+    chip8_profile_idle(chip, skipped);
+  }
+#endif
+  return skipped;
+}
+
+/**
+ * chip8_cycle, executing no more than budget cycles: a superinstruction
+ * longer than that is left for later and only the instruction it starts
+ * with is executed
+ */
+static inline uint32_t cycle(Chip8 *chip, uint64_t budget) {
   // TODO investigate how early return affects cycle_accumulator
   if (chip->FX0A_waiting) {
-    return;
+    return 1;
+  }
+
+  // translated code runs a whole block per cycle (not traced)
+  if (chip->engine == CHIP8_ENGINE_JIT) {
+    return chip8_jit_run(chip, 1);
+  }
+  if (chip->engine == CHIP8_ENGINE_THREADED) {
+    return chip8_threaded_run(chip, 1);
+  }
+
+  uint16_t pc = chip->PC;
+  if ((pc & 1) || pc >= MEMORY_SIZE) {
+    chip8_decode_execute(chip, chip8_fetch(chip));
+    return 1;
+  }
+
+  Chip8Instruction *ins = &chip->decode_cache[pc >> 1];
+  if (!ins->length) {
+    if (chip->engine == CHIP8_ENGINE_BLOCK) {
+      chip8_decode_block(chip, pc);
+    } else {
+      chip8_decode(chip->quirks, chip8_fetch(chip), ins);
+    }
+  }
+  Chip8Instruction single;
+  if (ins->length > budget) {
+    chip8_decode(chip->quirks, chip8_fetch(chip), &single);
+    ins = &single;
+  }
+#ifdef CHIP8_PROFILE
+  if (chip->profile) {
+    return chip8_profile_execute(chip, ins);
+  }
+#endif
+  if (chip->trace) {
+    return chip8_trace_execute(chip, ins);
+  }
+  // read the length first: the handler may overwrite (and so
+  // invalidate) its own entry
+  uint32_t length = ins->length;
+  ins->handler(chip, ins);
+  return length;
+}
+
+/**
+ * execute a single CPU cycle (fetch, decode, execute)
+ *
+ * instructions at even addresses are decoded once and then served from
+ * the decode cache, so the steady state is a single indexed load and an
+ * indirect call; odd addresses (rare, but legal) take the slow path
+ *
+ * returns the number of cycles consumed, which is more than one when a
+ * superinstruction was executed
+ */
+uint32_t chip8_cycle(Chip8 *chip) { return cycle(chip, UINT64_MAX); }
+
+/**
+ * execute the given number of CPU cycles back to back without any
+ * timing; the caller is responsible for calling chip8_frame_tick at the
+ * appropriate points; idle waits are skipped rather than spun through
+ * (see chip8_skip_idle)
+ *
+ * returns the number of cycles executed, which is the number asked for
+ * with every engine
+ */
+uint64_t chip8_run_cycles(Chip8 *chip, uint64_t cycles) {
+  uint64_t executed = skip_idle(chip, cycles);
+  if (executed < cycles && chip->engine == CHIP8_ENGINE_JIT) {
+    executed += chip8_jit_run(chip, cycles - executed);
+  } else if (executed < cycles && chip->engine == CHIP8_ENGINE_THREADED) {
+    executed += chip8_threaded_run(chip, cycles - executed);
+  }
+
+  while (executed < cycles) {
+    uint16_t pc = chip->PC;
+    executed += cycle(chip, cycles - executed);
+    // idle waits are one instruction (PC stays put) or three (PC goes
+    // back from the jump to the FX07) long
+    if ((chip->PC == pc || chip->PC + 4 == pc) && executed < cycles) {
+      executed += skip_idle(chip, cycles - executed);
+    }
+  }
+  chip->cycles += executed;
+  return executed;
+}
+
+/**
+ * select the dispatch engine used by chip8_cycle
+ *
+ * the decode cache is flushed because engines decode the same address
+ * differently (e.g. into superinstructions)
+ *
+ * returns nonzero if the engine is not available on this host, in
+ * which case the table engine is selected instead
+ */
+int chip8_set_engine(Chip8 *chip, Chip8Engine engine) {
+  memset(chip->decode_cache, 0, sizeof(chip->decode_cache));
+  if (chip->jit) {
+    // translations pass the entries just cleared to their handlers
+    chip8_jit_invalidate(chip->jit, 0, MEMORY_SIZE);
   }
-  uint16_t opcode = chip8_fetch(chip);
 
-  if (debug) {
-    printf("PC=%03X OPCODE=%04X V0=%02X V1=%02X ... I=%03X\n", chip->PC, opcode,
-           chip->V[0], chip->V[1], chip->I);
+  int unavailable = 0;
+  if (engine == CHIP8_ENGINE_THREADED && !chip8_threaded_available()) {
+    engine = CHIP8_ENGINE_TABLE;
+    unavailable = 1;
   }
 
-  chip8_decode_execute(chip, opcode);
+  if (engine != CHIP8_ENGINE_JIT) {
+    chip8_jit_destroy(chip->jit);
+    chip->jit = NULL;
+  } else if (!chip->jit) {
+    chip->jit = chip8_jit_create();
+    if (!chip->jit) {
+      engine = CHIP8_ENGINE_TABLE;
+      unavailable = 1;
+    }
+  }
+
+  chip->engine = engine;
+  return unavailable;
 }
 
+/**
+ * parse an engine name as given on the command line
+ */
+int chip8_parse_engine(const char *name, Chip8Engine *engine) {
+  if (strcmp(name, "table") == 0) {
+    *engine = CHIP8_ENGINE_TABLE;
+  } else if (strcmp(name, "block") == 0) {
+    *engine = CHIP8_ENGINE_BLOCK;
+  } else if (strcmp(name, "jit") == 0) {
+    *engine = CHIP8_ENGINE_JIT;
+  } else if (strcmp(name, "threaded") == 0) {
+    *engine = CHIP8_ENGINE_THREADED;
+  } else {
+    return 1;
+  }
+  return 0;
+}
+
+
 /**
  * fetch the instruction at program counter from memory
  * instructions consist of two bytes that are combined into a single
@@ -224,47 +1192,119 @@ uint16_t chip8_fetch(Chip8 *chip) {
 }
 
 /**
- * dispatch instruction to appropriate opcode handler
+ * decode an instruction: resolve its handler and extract its operands
  *
- * there are five opcode tables; each instruction is dispatched to one
+ * there are five opcode tables; each instruction is looked up in one
  * of them according to the value of its highest nibble (leftmost 4
- * bits or half byte)
+ * bits or half byte), then resolved to the variant implementing the
+ * given quirks
  */
-void chip8_decode_execute(Chip8 *chip, uint16_t opcode) {
+void chip8_decode(const Chip8Quirks *quirks, uint16_t opcode,
+                  Chip8Instruction *ins) {
   uint8_t first_nibble = opcode >> 12;
   uint8_t last_nibble = opcode & 0x000F;
   uint8_t last_byte = opcode & 0x00FF;
-  OpcodeHandler handler;
+  uint8_t op;
 
   switch (first_nibble) {
   case 0x0:
-    handler = opcode_0XXX_table[last_byte];
-    if (handler)
-      handler(chip, opcode);
+    op = opcode_0XXX_table[last_byte];
     break;
-
   case 0x8:
-    handler = opcode_8XYN_table[last_nibble];
-    if (handler)
-      handler(chip, opcode);
+    op = opcode_8XYN_table[last_nibble];
     break;
-
   case 0xE:
-    handler = opcode_EXXX_table[last_byte];
-    if (handler)
-      handler(chip, opcode);
+    op = opcode_EXXX_table[last_byte];
     break;
-
   case 0xF:
-    handler = opcode_FXXX_table[last_byte];
-    if (handler)
-      handler(chip, opcode);
+    op = opcode_FXXX_table[last_byte];
     break;
-
   default:
-    handler = opcode_main_table[first_nibble];
-    if (handler)
-      handler(chip, opcode);
+    op = opcode_main_table[first_nibble];
     break;
   }
+
+  op = opcode_specialize(quirks, op);
+  ins->handler = opcode_handlers[op];
+  ins->nnn = opcode & 0x0FFF;
+  ins->x = (opcode & 0x0F00) >> 8;
+  ins->y = (opcode & 0x00F0) >> 4;
+  ins->n = last_nibble;
+  ins->nn = last_byte;
+  ins->op = op;
+  ins->length = 1;
+}
+
+/**
+ * decode and execute an instruction without going through the decode
+ * cache
+ */
+void chip8_decode_execute(Chip8 *chip, uint16_t opcode) {
+  Chip8Instruction ins;
+  chip8_decode(chip->quirks, opcode, &ins);
+  ins.handler(chip, &ins);
+}
+
+/**
+ * drop cached decodings of the len bytes starting at addr; must be
+ * called after anything writes to memory, since any byte may be code
+ *
+ * superinstructions starting shortly before addr are dropped as well
+ * if they cover any of the written bytes
+ */
+void chip8_invalidate_code(Chip8 *chip, uint16_t addr, uint16_t len) {
+  if (len == 0 || addr >= MEMORY_SIZE) {
+    return;
+  }
+  uint32_t first = addr >> 1;
+  uint32_t last = ((uint32_t)addr + len - 1) >> 1;
+  if (last >= MEMORY_SIZE / 2) {
+    last = MEMORY_SIZE / 2 - 1;
+  }
+
+  for (uint32_t e = first; e <= last; e++) {
+    chip->decode_cache[e].length = 0;
+    chip->code_written[e >> 6] |= 1ULL << (e & 63);
+  }
+
+  for (uint32_t back = 1; back < MAX_SUPERINSTRUCTION_LENGTH && back <= first;
+       back++) {
+    Chip8Instruction *ins = &chip->decode_cache[first - back];
+    if (ins->length > back) {
+      ins->length = 0;
+    }
+  }
+
+  // a delay timer spin loop's jump is fused with the two instructions
+  // before it (see blocks.c)
+  for (uint32_t e = last + 1; e <= last + 2 && e < MEMORY_SIZE / 2; e++) {
+    if (chip->decode_cache[e].op == OP_SUPER_DELAY_SPIN) {
+      chip->decode_cache[e].length = 0;
+    }
+  }
+
+  if (chip->jit) {
+    chip8_jit_invalidate(chip->jit, addr, len);
+  }
+}
+
+/**
+ * check whether any byte in [addr, addr + len) was written by the
+ * program since the rom was loaded (used by recompiled code to detect
+ * that it no longer matches memory)
+ */
+bool chip8_code_written(const Chip8 *chip, uint16_t addr, uint16_t len) {
+  if (len == 0 || addr >= MEMORY_SIZE) {
+    return false;
+  }
+  uint32_t last = ((uint32_t)addr + len - 1) >> 1;
+  if (last >= MEMORY_SIZE / 2) {
+    last = MEMORY_SIZE / 2 - 1;
+  }
+  for (uint32_t e = addr >> 1; e <= last; e++) {
+    if (chip->code_written[e >> 6] & (1ULL << (e & 63))) {
+      return true;
+    }
+  }
+  return false;
 }
@@ -2,6 +2,7 @@
 #define CHIP8_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define FONT_START 0x050
@@ -18,17 +19,69 @@
 typedef struct Chip8Quirks {
   // logic opcodes reset VF to 0
   bool logic_resets_vf;
+  // FX55 / FX65 leave I pointing past the last register stored/loaded
   bool load_store_increment_i;
   // throttle draw opcode to one execution per frame
   bool draw_waits_for_vblank;
   // sprites get clipped at edge of display (no wrap)
   bool clip_sprites;
+  // 8XY6 / 8XYE shift VX in place instead of storing shifted VY in VX
   bool shift_uses_vx;
+  // BNNN jumps to XNN + VX instead of NNN + V0
   bool jump_uses_vx;
 } Chip8Quirks;
 
+// quirk profiles of common interpreters (see chip8_parse_profile)
+extern const Chip8Quirks chip8_quirks_vip;
+extern const Chip8Quirks chip8_quirks_schip;
+extern const Chip8Quirks chip8_quirks_xochip;
+
+struct Chip8;
+struct Chip8Instruction;
+
+typedef void (*OpcodeHandler)(struct Chip8 *chip,
+                              const struct Chip8Instruction *ins);
+
+/**
+ * an instruction decoded once and cached: the resolved handler and
+ * operand fields pre-extracted from the opcode
+ */
+typedef struct Chip8Instruction {
+  OpcodeHandler handler;
+  uint16_t nnn;
+  uint8_t x;
+  uint8_t y;
+  uint8_t n;
+  uint8_t nn;
+  // Chip8Op (see opcodes.h)
+  uint8_t op;
+  // number of instructions executed by the handler (more than one for
+  // superinstructions), or 0 if the entry has not been decoded
+  uint8_t length;
+} Chip8Instruction;
+
+// longest instruction sequence a single superinstruction may cover
+#define MAX_SUPERINSTRUCTION_LENGTH 8
+
+/**
+ * how instructions are dispatched by chip8_cycle
+ */
+typedef enum Chip8Engine {
+  // one cached decoded instruction per cycle (default)
+  CHIP8_ENGINE_TABLE,
+  // common instruction sequences within basic blocks are fused into
+  // superinstructions (see blocks.c)
+  CHIP8_ENGINE_BLOCK,
+  // basic blocks are recompiled to native x86-64 code (see jit.c)
+  CHIP8_ENGINE_JIT,
+  // direct threaded code using computed goto (see threaded.c)
+  CHIP8_ENGINE_THREADED,
+} Chip8Engine;
+
 typedef struct Chip8 {
-  uint8_t display[DISPLAY_WIDTH * DISPLAY_HEIGHT];
+  // one word per row, leftmost pixel in the most significant bit (see
+  // chip8_pixel)
+  uint64_t display[DISPLAY_HEIGHT];
   uint8_t keypad[KEYPAD_SIZE];
   uint8_t delay_timer;
   uint8_t sound_timer;
@@ -43,33 +96,212 @@ typedef struct Chip8 {
   uint8_t FX0A_key;
   uint8_t FX0A_reg;
   bool draw_permitted;
-  Chip8Quirks *quirks;
+  // per-instance settings (formerly process globals)
+  bool debug;
+  double cycles_per_second;
+  // state of the per-instance xorshift64* random number generator
+  uint64_t rng_state;
+  const Chip8Quirks *quirks;
+  Chip8Engine engine;
+  // recompiler state, only allocated while the JIT engine is selected
+  struct Chip8Jit *jit;
+  // input recorder, notified of key events and frames when not NULL
+  // (see replay.c)
+  struct Chip8Recorder *recorder;
+  // profile counting every instruction when not NULL, in builds with
+  // CHIP8_PROFILE (see profile.c)
+  struct Chip8Profile *profile;
+  // instruction trace recording every instruction when not NULL (see
+  // trace.c)
+  struct Chip8Trace *trace;
+  // instructions executed through chip8_run_cycles since init
+  uint64_t cycles;
+  // one decoded instruction per even address, filled on first
+  // execution and invalidated whenever the underlying memory changes
+  Chip8Instruction decode_cache[MEMORY_SIZE / 2];
+  // one bit per even address, set when the program itself writes to
+  // that address after the rom was loaded (see chip8_code_written)
+  uint64_t code_written[MEMORY_SIZE / 128];
+  // hash of memory right after the rom was loaded, telling chip8_restore
+  // whether a snapshot was taken from the same program
+  uint64_t rom_hash;
 } Chip8;
 
+/**
+ * the state a running program can change, without pointers or settings
+ * (quirks, engine, clock), so it can be copied and stored as plain bytes
+ * (see chip8_snapshot)
+ */
+typedef struct Chip8State {
+  uint64_t rng_state;
+  uint64_t rom_hash;
+  uint8_t V[NUM_REGISTERS];
+  uint16_t stack[STACK_SIZE];
+  uint16_t I;
+  uint16_t PC;
+  uint8_t SP;
+  uint8_t delay_timer;
+  uint8_t sound_timer;
+  uint8_t keypad[KEYPAD_SIZE];
+  bool FX0A_waiting;
+  uint8_t FX0A_key;
+  uint8_t FX0A_reg;
+  bool draw_permitted;
+  uint64_t display[DISPLAY_HEIGHT];
+  // memory bytes outside the bitmap still hold the rom as loaded
+  uint64_t code_written[MEMORY_SIZE / 128];
+  uint8_t memory[MEMORY_SIZE];
+} Chip8State;
+
 typedef enum Chip8EventType { CHIP8_KEY_DOWN, CHIP8_KEY_UP } Chip8EventType;
 
 typedef void (*chip8_draw_callback)(void *userdata);
-typedef bool (*chip8_event_callback)(Chip8 *chip);
+typedef bool (*chip8_event_callback)(Chip8 *chip, void *userdata);
 typedef uint64_t (*chip8_time_func)(void);
 typedef void (*chip8_sleep_func)(uint32_t ms);
+typedef uint64_t (*chip8_time_ns_func)(void);
+typedef void (*chip8_sleep_ns_func)(uint64_t ns);
+typedef bool (*chip8_wait_func)(void *userdata, uint64_t timeout_ns);
+
+/**
+ * how chip8_run_with_options spaces instruction batches and frames
+ */
+typedef enum Chip8Pacing {
+  // millisecond clock; runs whatever is due each time the loop wakes up
+  // from a sleep of at least 1 ms
+  CHIP8_PACING_COARSE,
+  // nanosecond monotonic clock; runs fixed size batches at evenly spaced
+  // deadlines, sleeping most of the wait and spinning the rest
+  CHIP8_PACING_PRECISE,
+  // ignores the wall clock: every virtual frame runs exactly
+  // cycles_per_second / 60 instructions and one timer tick, as fast as
+  // the speed multiplier allows
+  CHIP8_PACING_VIRTUAL,
+} Chip8Pacing;
+
+/**
+ * pacing statistics, accumulated over a run
+ */
+typedef struct Chip8RunStats {
+  uint64_t frames;
+  // how late frame ticks ran against their deadline, in nanoseconds
+  uint64_t late_total_ns;
+  uint64_t late_max_ns;
+  // frames whose timers ticked but that were not presented because the
+  // loop was catching up
+  uint64_t frames_dropped;
+  // emulated time given up after falling behind by more than the
+  // catch-up window, in nanoseconds
+  uint64_t time_lost_ns;
+} Chip8RunStats;
+
+typedef struct Chip8RunOptions {
+  Chip8Pacing pacing;
+  // clock and sleep for coarse pacing, in milliseconds
+  chip8_time_func current_time;
+  chip8_sleep_func sleep;
+  // clock and sleep for precise pacing, in nanoseconds
+  chip8_time_ns_func current_time_ns;
+  chip8_sleep_ns_func sleep_ns;
+  // while the chip is idle (see chip8_idle) the loop blocks in this
+  // instead of sleeping, so it can return early (true) when input
+  // arrives; NULL just sleeps until the next frame tick
+  chip8_wait_func wait_for_input;
+  // precise pacing: instruction batches per 60 Hz frame
+  uint32_t batches_per_frame;
+  // furthest the loop catches up after a stall, in nanoseconds; time
+  // beyond it is dropped (0 catches up on everything)
+  uint64_t max_catch_up_ns;
+  // most frames in a row that skip presenting while catching up
+  uint32_t max_frame_skip;
+  // virtual pacing: how many times faster than real time virtual frames
+  // run, 0 for as fast as possible; read every frame, so it may be
+  // changed while running (e.g. from the event callback)
+  double speed;
+  // virtual pacing: most presented frames per second of real time, 0
+  // to present every virtual frame
+  double present_rate;
+  // updated while running when not NULL
+  Chip8RunStats *stats;
+  // when not NULL, every frame is recorded into it (see rewind.c)
+  struct Chip8Rewind *rewind;
+  // with a rewind buffer: -1 steps back one recorded frame per frame
+  // instead of running, 1 steps forward again, 0 runs and records; read
+  // every frame like speed
+  int rewind_direction;
+} Chip8RunOptions;
 
 void chip8_init(Chip8 *chip, double clock_speed, bool debug,
-                Chip8Quirks *quirks);
+                const Chip8Quirks *quirks);
+
+void chip8_seed(Chip8 *chip, uint64_t seed);
+
+uint8_t chip8_random(Chip8 *chip);
+
+void chip8_destroy(Chip8 *chip);
 
 int chip8_load_rom(Chip8 *chip, const char *filename);
 
+int chip8_load_rom_data(Chip8 *chip, const uint8_t *data, size_t size);
+
+void chip8_snapshot(const Chip8 *chip, Chip8State *state);
+
+void chip8_restore(Chip8 *chip, const Chip8State *state);
+
+int chip8_fork(const Chip8 *parent, Chip8 *child);
+
 void chip8_run(Chip8 *chip, chip8_draw_callback draw,
                chip8_event_callback handle_events, chip8_time_func current_time,
                chip8_sleep_func sleep, void *userdata);
 
-void chip8_cycle(Chip8 *chip);
+void chip8_run_options_init(Chip8RunOptions *options);
+
+void chip8_run_with_options(Chip8 *chip, const Chip8RunOptions *options,
+                            chip8_draw_callback draw,
+                            chip8_event_callback handle_events,
+                            void *userdata);
+
+uint64_t chip8_time_ns(void);
+
+void chip8_sleep_ns(uint64_t ns);
+
+uint32_t chip8_cycle(Chip8 *chip);
 
 void chip8_key_event(Chip8 *chip, uint8_t key, Chip8EventType event_type);
 
 void chip8_update_timers(Chip8 *chip);
 
+bool chip8_pixel(const Chip8 *chip, int x, int y);
+
+uint64_t chip8_display_hash(const Chip8 *chip);
+
+uint64_t chip8_state_hash(const Chip8 *chip);
+
+void chip8_frame_tick(Chip8 *chip);
+
+uint64_t chip8_run_cycles(Chip8 *chip, uint64_t cycles);
+
+bool chip8_idle(const Chip8 *chip);
+
+uint64_t chip8_skip_idle(Chip8 *chip, uint64_t cycles);
+
+int chip8_set_engine(Chip8 *chip, Chip8Engine engine);
+
+int chip8_parse_engine(const char *name, Chip8Engine *engine);
+
+int chip8_parse_profile(const char *name, const Chip8Quirks **quirks);
+
+int chip8_parse_pacing(const char *name, Chip8Pacing *pacing);
+
 uint16_t chip8_fetch(Chip8 *chip);
 
+void chip8_decode(const Chip8Quirks *quirks, uint16_t opcode,
+                  Chip8Instruction *ins);
+
 void chip8_decode_execute(Chip8 *chip, uint16_t opcode);
 
+void chip8_invalidate_code(Chip8 *chip, uint16_t addr, uint16_t len);
+
+bool chip8_code_written(const Chip8 *chip, uint16_t addr, uint16_t len);
+
 #endif
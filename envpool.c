@@ -0,0 +1,272 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "envpool.h"
+#include "lockstep.h"
+
+/**
+ * ENVIRONMENT POOL
+ *
+ * a fixed number of environments for training agents against a rom:
+ * each step applies one keypad action per environment, advances all of
+ * them by the same number of frames in lockstep (see lockstep.c) and
+ * writes every display into one observation buffer
+ *
+ * everything is allocated when the pool is created, so stepping and
+ * resetting never allocate; the observation buffer may belong to the
+ * caller (e.g. a numpy array), in which case the displays are written
+ * straight into it. arguments are only pointers and plain numbers, so
+ * the pool can be driven from python with ctypes:
+ *
+ *   lib = ctypes.CDLL("./libchip8.so")
+ *   lib.chip8_env_pool_create.restype = ctypes.c_void_p
+ *   obs = numpy.zeros((n, 32, 64), numpy.uint8)
+ *   pool = ctypes.c_void_p(lib.chip8_env_pool_create(
+ *       b"pong.ch8", b"vip", n, 4, ctypes.c_double(600.0), 0,
+ *       obs.ctypes.data_as(ctypes.c_void_p)))
+ *   actions = numpy.zeros((n, 16), numpy.uint8)
+ *   lib.chip8_env_pool_step(pool, actions.ctypes.data_as(ctypes.c_void_p))
+ */
+
+#define FRAMES_PER_SECOND 60.0
+
+struct Chip8EnvPool {
+  Chip8Lockstep *lockstep;
+  uint32_t envs;
+  uint32_t frames_per_step;
+  double cycles_per_frame;
+  double cycle_accumulator;
+  Chip8Observation observation;
+  uint8_t *observations;
+  // allocated by the pool because the caller passed none
+  bool owns_observations;
+  // what environments are reset to: the freshly loaded rom until
+  // chip8_env_pool_snapshot replaces it
+  Chip8 *reset_state;
+  // keys held by each environment's last action, one bit per key
+  uint16_t *held;
+  // the eight pixel bytes of every display byte, in memory order
+  uint64_t pixels[256];
+};
+
+static size_t env_observation_size(Chip8Observation observation) {
+  return observation == CHIP8_OBSERVATION_PACKED
+             ? DISPLAY_HEIGHT * sizeof(uint64_t)
+             : DISPLAY_HEIGHT * DISPLAY_WIDTH;
+}
+
+/**
+ * write an environment's display into its slot of the observation buffer
+ */
+static void observe(Chip8EnvPool *pool, uint32_t env) {
+  const uint64_t *display = chip8_lockstep_display(pool->lockstep, env);
+  uint8_t *slot =
+      pool->observations + env * env_observation_size(pool->observation);
+
+  if (pool->observation == CHIP8_OBSERVATION_PACKED) {
+    memcpy(slot, display, DISPLAY_HEIGHT * sizeof(uint64_t));
+    return;
+  }
+  for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+    uint64_t row = display[y];
+    for (int x = 0; x < DISPLAY_WIDTH; x += 8) {
+      uint8_t bits = row >> (DISPLAY_WIDTH - 8 - x);
+      memcpy(&slot[y * DISPLAY_WIDTH + x], &pool->pixels[bits], 8);
+    }
+  }
+}
+
+static uint16_t keypad_bits(const Chip8 *chip) {
+  uint16_t bits = 0;
+  for (int key = 0; key < KEYPAD_SIZE; key++) {
+    bits |= (chip->keypad[key] != 0) << key;
+  }
+  return bits;
+}
+
+/**
+ * create a pool of envs environments, all starting from the rom freshly
+ * loaded with the given quirk profile (NULL for vip); every step runs
+ * frames_per_step frames at clock_speed instructions per second
+ *
+ * observation is a Chip8Observation; observations is the buffer the
+ * displays are written to, envs * chip8_env_pool_observation_size bytes
+ * large, or NULL to have the pool allocate it
+ *
+ * returns NULL if the arguments or rom are invalid or memory runs out
+ */
+Chip8EnvPool *chip8_env_pool_create(const char *rom_path, const char *profile,
+                                    uint32_t envs, uint32_t frames_per_step,
+                                    double clock_speed, int observation,
+                                    void *observations) {
+  const Chip8Quirks *quirks = &chip8_quirks_vip;
+  if (profile && chip8_parse_profile(profile, &quirks)) {
+    fprintf(stderr, "Unknown profile: %s\n", profile);
+    return NULL;
+  }
+  if (envs == 0 || frames_per_step == 0 || clock_speed <= 0 ||
+      (observation != CHIP8_OBSERVATION_PIXELS &&
+       observation != CHIP8_OBSERVATION_PACKED)) {
+    fprintf(stderr, "Invalid environment pool settings\n");
+    return NULL;
+  }
+
+  Chip8EnvPool *pool = calloc(1, sizeof(Chip8EnvPool));
+  if (!pool) {
+    perror("Failed to allocate environment pool");
+    return NULL;
+  }
+  pool->envs = envs;
+  pool->frames_per_step = frames_per_step;
+  pool->cycles_per_frame = clock_speed / FRAMES_PER_SECOND;
+  pool->observation = observation;
+  for (int bits = 0; bits < 256; bits++) {
+    uint8_t pixels[8];
+    for (int x = 0; x < 8; x++) {
+      pixels[x] = bits >> (7 - x) & 1;
+    }
+    memcpy(&pool->pixels[bits], pixels, sizeof(pixels));
+  }
+
+  pool->reset_state = malloc(sizeof(Chip8));
+  pool->held = calloc(envs, sizeof(uint16_t));
+  pool->observations = observations;
+  if (!observations) {
+    pool->observations = calloc(envs, env_observation_size(observation));
+    pool->owns_observations = true;
+  }
+  if (!pool->reset_state || !pool->held || !pool->observations) {
+    perror("Failed to allocate environment pool");
+    goto fail;
+  }
+
+  chip8_init(pool->reset_state, clock_speed, false, quirks);
+  if (chip8_load_rom(pool->reset_state, rom_path)) {
+    goto fail;
+  }
+  pool->lockstep = chip8_lockstep_create(pool->reset_state, envs);
+  if (!pool->lockstep) {
+    perror("Failed to allocate environment pool");
+    goto fail;
+  }
+
+  for (uint32_t env = 0; env < envs; env++) {
+    observe(pool, env);
+  }
+  return pool;
+
+fail:
+  chip8_env_pool_destroy(pool);
+  return NULL;
+}
+
+void chip8_env_pool_destroy(Chip8EnvPool *pool) {
+  if (!pool) {
+    return;
+  }
+  chip8_lockstep_destroy(pool->lockstep);
+  if (pool->owns_observations) {
+    free(pool->observations);
+  }
+  free(pool->held);
+  free(pool->reset_state);
+  free(pool);
+}
+
+uint32_t chip8_env_pool_size(const Chip8EnvPool *pool) { return pool->envs; }
+
+/**
+ * the observation buffer (the one passed to chip8_env_pool_create, if
+ * any); it holds the displays as of the last step or reset
+ */
+void *chip8_env_pool_observations(const Chip8EnvPool *pool) {
+  return pool->observations;
+}
+
+/**
+ * bytes of the observation buffer per environment
+ */
+uint64_t chip8_env_pool_observation_size(const Chip8EnvPool *pool) {
+  return env_observation_size(pool->observation);
+}
+
+/**
+ * hold the keys of each environment's action for the whole step, then
+ * run every environment for frames_per_step frames and write their
+ * displays into the observation buffer
+ *
+ * actions holds KEYPAD_SIZE bytes per environment, nonzero for keys held
+ * down; keys that change from the previous action generate key events
+ * (see chip8_key_event) before the first frame. NULL keeps the previous
+ * actions
+ */
+void chip8_env_pool_step(Chip8EnvPool *pool, const uint8_t *actions) {
+  for (uint32_t env = 0; actions && env < pool->envs; env++) {
+    const uint8_t *action = &actions[(size_t)env * KEYPAD_SIZE];
+    uint16_t keys = 0;
+    for (int key = 0; key < KEYPAD_SIZE; key++) {
+      keys |= (action[key] != 0) << key;
+    }
+    uint16_t changed = keys ^ pool->held[env];
+    for (int key = 0; changed; key++, changed >>= 1) {
+      if (changed & 1) {
+        chip8_lockstep_key_event(pool->lockstep, env, key,
+                                 keys >> key & 1 ? CHIP8_KEY_DOWN
+                                                 : CHIP8_KEY_UP);
+      }
+    }
+    pool->held[env] = keys;
+  }
+
+  // same timing as chip8-headless: a frame every (clock / 60) cycles,
+  // with the fraction carried over
+  for (uint32_t frame = 0; frame < pool->frames_per_step; frame++) {
+    pool->cycle_accumulator += pool->cycles_per_frame;
+    uint32_t batch = (uint32_t)pool->cycle_accumulator;
+    pool->cycle_accumulator -= batch;
+    chip8_lockstep_run_cycles(pool->lockstep, batch);
+    chip8_lockstep_frame_tick(pool->lockstep);
+  }
+
+  for (uint32_t env = 0; env < pool->envs; env++) {
+    observe(pool, env);
+  }
+}
+
+/**
+ * reset environments to the reset state (see chip8_env_pool_snapshot)
+ * and write their observations
+ *
+ * envs holds one byte per environment, nonzero for those to reset, or
+ * is NULL to reset all of them; seeds, if not NULL, holds one random
+ * number generator seed per environment, applied to each one reset
+ * (otherwise they continue with the reset state's generator)
+ */
+void chip8_env_pool_reset(Chip8EnvPool *pool, const uint8_t *envs,
+                          const uint64_t *seeds) {
+  uint16_t held = keypad_bits(pool->reset_state);
+  for (uint32_t env = 0; env < pool->envs; env++) {
+    if (envs && !envs[env]) {
+      continue;
+    }
+    chip8_lockstep_write_lane(pool->lockstep, env, pool->reset_state);
+    if (seeds) {
+      chip8_lockstep_seed(pool->lockstep, env, seeds[env]);
+    }
+    pool->held[env] = held;
+    observe(pool, env);
+  }
+}
+
+/**
+ * make the current state of an environment the one environments are
+ * reset to, e.g. to start every episode past a title screen
+ */
+void chip8_env_pool_snapshot(Chip8EnvPool *pool, uint32_t env) {
+  chip8_lockstep_read_lane(pool->lockstep, env, pool->reset_state);
+}
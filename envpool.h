@@ -0,0 +1,43 @@
+#ifndef ENVPOOL_H
+#define ENVPOOL_H
+
+#include <stdint.h>
+
+/**
+ * how chip8_env_pool_step writes each environment's display into the
+ * observation buffer
+ */
+typedef enum Chip8Observation {
+  // one byte per pixel, 0 or 1, row by row: envs x 32 x 64 bytes
+  CHIP8_OBSERVATION_PIXELS,
+  // one 64-bit word per row, leftmost pixel in the most significant
+  // bit (the layout of Chip8.display): envs x 32 words
+  CHIP8_OBSERVATION_PACKED,
+} Chip8Observation;
+
+/**
+ * a pool of environments running one rom (see envpool.c)
+ */
+typedef struct Chip8EnvPool Chip8EnvPool;
+
+Chip8EnvPool *chip8_env_pool_create(const char *rom_path, const char *profile,
+                                    uint32_t envs, uint32_t frames_per_step,
+                                    double clock_speed, int observation,
+                                    void *observations);
+
+void chip8_env_pool_destroy(Chip8EnvPool *pool);
+
+uint32_t chip8_env_pool_size(const Chip8EnvPool *pool);
+
+void *chip8_env_pool_observations(const Chip8EnvPool *pool);
+
+uint64_t chip8_env_pool_observation_size(const Chip8EnvPool *pool);
+
+void chip8_env_pool_step(Chip8EnvPool *pool, const uint8_t *actions);
+
+void chip8_env_pool_reset(Chip8EnvPool *pool, const uint8_t *envs,
+                          const uint64_t *seeds);
+
+void chip8_env_pool_snapshot(Chip8EnvPool *pool, uint32_t env);
+
+#endif
@@ -0,0 +1,455 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "forks.h"
+
+/**
+ * FORKED INSTANCES
+ *
+ * a Chip8 carries its whole memory and decode cache (over 36 KB), and
+ * even a Chip8State holds all of memory, although most of it is the rom
+ * and font image that no instance ever changes. searches that fork one
+ * position into very many instances instead park them here: each
+ * instance keeps its registers and display plus a table of memory
+ * pages, which initially all point at the shared, immutable pages of
+ * the rom image
+ *
+ * instances do not run while parked; one of a few live Chip8 structs
+ * loads an instance, runs it and stores it back. pages the program
+ * wrote to meanwhile (FX33 / FX55, tracked by the written-code bitmap)
+ * then get a private copy, unless the instance is their only owner;
+ * forking an instance only shares its pages, so resident memory grows
+ * with the pages each instance actually modified
+ *
+ * instances and pages are allocated in chunks and recycled through
+ * free lists, so adding, forking and removing instances rarely calls
+ * malloc. not thread safe: each thread needs its own Chip8Forks
+ */
+
+#define FORK_PAGES (MEMORY_SIZE / FORK_PAGE_SIZE)
+// written-code bitmap words covering one page
+#define WORDS_PER_PAGE (FORK_PAGE_SIZE / 128)
+// instances or pages allocated at once
+#define CHUNK_SIZE 1024
+// end of a free list
+#define NONE UINT32_MAX
+
+typedef struct Page {
+  uint8_t bytes[FORK_PAGE_SIZE];
+} Page;
+
+typedef struct PageChunk {
+  Page page[CHUNK_SIZE];
+  // instances using each page; free pages hold the next free page
+  uint32_t refs[CHUNK_SIZE];
+} PageChunk;
+
+/**
+ * a parked instance: the state of a Chip8State, with memory replaced by
+ * page numbers
+ */
+typedef struct Instance {
+  uint64_t rng_state;
+  uint8_t V[NUM_REGISTERS];
+  uint16_t stack[STACK_SIZE];
+  uint16_t I;
+  uint16_t PC;
+  uint8_t SP;
+  uint8_t delay_timer;
+  uint8_t sound_timer;
+  uint8_t keypad[KEYPAD_SIZE];
+  bool FX0A_waiting;
+  uint8_t FX0A_key;
+  uint8_t FX0A_reg;
+  bool draw_permitted;
+  // next free instance while removed
+  uint32_t next_free;
+  uint32_t page[FORK_PAGES];
+  uint64_t display[DISPLAY_HEIGHT];
+  uint64_t code_written[MEMORY_SIZE / 128];
+} Instance;
+
+typedef struct InstanceChunk {
+  Instance instance[CHUNK_SIZE];
+} InstanceChunk;
+
+struct Chip8Forks {
+  uint64_t rom_hash;
+  // pages 0 to FORK_PAGES - 1 are the rom image, owned by no instance
+  PageChunk **page_chunk;
+  uint32_t page_chunks;
+  uint32_t free_page;
+  uint64_t pages_used;
+  InstanceChunk **instance_chunk;
+  uint32_t instance_chunks;
+  uint32_t free_instance;
+  uint32_t count;
+};
+
+/**
+ * HELPER FUNCTIONS
+ */
+
+static Page *page_at(const Chip8Forks *forks, uint32_t page) {
+  return &forks->page_chunk[page / CHUNK_SIZE]->page[page % CHUNK_SIZE];
+}
+
+static uint32_t *page_refs(const Chip8Forks *forks, uint32_t page) {
+  return &forks->page_chunk[page / CHUNK_SIZE]->refs[page % CHUNK_SIZE];
+}
+
+static Instance *instance_at(const Chip8Forks *forks, uint32_t id) {
+  return &forks->instance_chunk[id / CHUNK_SIZE]->instance[id % CHUNK_SIZE];
+}
+
+/**
+ * make room for one more chunk pointer in a chunk table of the given
+ * number of entries; returns NULL if memory runs out
+ */
+static void *grow_table(void *table, uint32_t chunks) {
+  return realloc(table, (chunks + 1) * sizeof(void *));
+}
+
+/**
+ * take a page off the free list (with one reference), adding a chunk of
+ * pages when it is empty; returns NONE if memory runs out
+ */
+static uint32_t alloc_page(Chip8Forks *forks) {
+  if (forks->free_page == NONE) {
+    PageChunk **table = grow_table(forks->page_chunk, forks->page_chunks);
+    if (!table) {
+      return NONE;
+    }
+    forks->page_chunk = table;
+    PageChunk *chunk = malloc(sizeof(PageChunk));
+    if (!chunk) {
+      return NONE;
+    }
+    table[forks->page_chunks++] = chunk;
+    uint32_t first = (forks->page_chunks - 1) * CHUNK_SIZE;
+    for (uint32_t i = 0; i < CHUNK_SIZE; i++) {
+      chunk->refs[i] = i + 1 < CHUNK_SIZE ? first + i + 1 : NONE;
+    }
+    forks->free_page = first;
+  }
+  uint32_t page = forks->free_page;
+  forks->free_page = *page_refs(forks, page);
+  *page_refs(forks, page) = 1;
+  forks->pages_used++;
+  return page;
+}
+
+static void release_page(Chip8Forks *forks, uint32_t page) {
+  // the rom image outlives every instance
+  if (page < FORK_PAGES) {
+    return;
+  }
+  uint32_t *refs = page_refs(forks, page);
+  if (--*refs == 0) {
+    *refs = forks->free_page;
+    forks->free_page = page;
+    forks->pages_used--;
+  }
+}
+
+/**
+ * take an instance off the free list, adding a chunk of instances when
+ * it is empty; returns NONE if memory runs out
+ */
+static uint32_t alloc_instance(Chip8Forks *forks) {
+  if (forks->free_instance == NONE) {
+    InstanceChunk **table =
+        grow_table(forks->instance_chunk, forks->instance_chunks);
+    if (!table) {
+      return NONE;
+    }
+    forks->instance_chunk = table;
+    InstanceChunk *chunk = malloc(sizeof(InstanceChunk));
+    if (!chunk) {
+      return NONE;
+    }
+    table[forks->instance_chunks++] = chunk;
+    uint32_t first = (forks->instance_chunks - 1) * CHUNK_SIZE;
+    for (uint32_t i = 0; i < CHUNK_SIZE; i++) {
+      chunk->instance[i].next_free = i + 1 < CHUNK_SIZE ? first + i + 1 : NONE;
+    }
+    forks->free_instance = first;
+  }
+  uint32_t id = forks->free_instance;
+  Instance *in = instance_at(forks, id);
+  forks->free_instance = in->next_free;
+  forks->count++;
+  return id;
+}
+
+static bool page_written(const uint64_t *code_written, int page) {
+  for (int w = page * WORDS_PER_PAGE; w < (page + 1) * WORDS_PER_PAGE; w++) {
+    if (code_written[w]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * create an empty set of instances of the rom loaded into origin, which
+ * must not have run yet (its memory is taken as the rom image)
+ *
+ * returns NULL if origin already wrote to memory or memory runs out
+ */
+Chip8Forks *chip8_forks_create(const Chip8 *origin) {
+  for (int page = 0; page < FORK_PAGES; page++) {
+    if (page_written(origin->code_written, page)) {
+      fprintf(stderr, "Fork origin has already modified its memory\n");
+      return NULL;
+    }
+  }
+
+  Chip8Forks *forks = calloc(1, sizeof(Chip8Forks));
+  if (!forks) {
+    perror("Failed to allocate forks");
+    return NULL;
+  }
+  forks->rom_hash = origin->rom_hash;
+  forks->free_page = NONE;
+  forks->free_instance = NONE;
+  for (int page = 0; page < FORK_PAGES; page++) {
+    if (alloc_page(forks) == NONE) {
+      perror("Failed to allocate forks");
+      chip8_forks_destroy(forks);
+      return NULL;
+    }
+    memcpy(page_at(forks, page)->bytes, &origin->memory[page * FORK_PAGE_SIZE],
+           FORK_PAGE_SIZE);
+  }
+  // the image pages are not counted as private
+  forks->pages_used = 0;
+  return forks;
+}
+
+void chip8_forks_destroy(Chip8Forks *forks) {
+  if (!forks) {
+    return;
+  }
+  for (uint32_t i = 0; i < forks->page_chunks; i++) {
+    free(forks->page_chunk[i]);
+  }
+  for (uint32_t i = 0; i < forks->instance_chunks; i++) {
+    free(forks->instance_chunk[i]);
+  }
+  free(forks->page_chunk);
+  free(forks->instance_chunk);
+  free(forks);
+}
+
+/**
+ * park a copy of a live instance of the rom (see chip8_forks_store);
+ * its number is written to id
+ *
+ * returns nonzero if the chip runs another rom or memory runs out
+ */
+int chip8_forks_add(Chip8Forks *forks, const Chip8 *chip, uint32_t *id) {
+  uint32_t added = alloc_instance(forks);
+  if (added == NONE) {
+    perror("Failed to allocate fork");
+    return 1;
+  }
+  Instance *in = instance_at(forks, added);
+  for (int page = 0; page < FORK_PAGES; page++) {
+    in->page[page] = page;
+  }
+  if (chip8_forks_store(forks, added, chip)) {
+    chip8_forks_remove(forks, added);
+    return 1;
+  }
+  *id = added;
+  return 0;
+}
+
+/**
+ * park a copy of a parked instance, sharing all of its pages; its
+ * number is written to id
+ *
+ * returns nonzero if memory runs out
+ */
+int chip8_forks_fork(Chip8Forks *forks, uint32_t parent, uint32_t *id) {
+  uint32_t child = alloc_instance(forks);
+  if (child == NONE) {
+    perror("Failed to allocate fork");
+    return 1;
+  }
+  Instance *in = instance_at(forks, child);
+  uint32_t next_free = in->next_free;
+  *in = *instance_at(forks, parent);
+  in->next_free = next_free;
+  for (int page = 0; page < FORK_PAGES; page++) {
+    if (in->page[page] >= FORK_PAGES) {
+      (*page_refs(forks, in->page[page]))++;
+    }
+  }
+  *id = child;
+  return 0;
+}
+
+/**
+ * drop a parked instance; its number is reused by later instances
+ */
+void chip8_forks_remove(Chip8Forks *forks, uint32_t id) {
+  Instance *in = instance_at(forks, id);
+  for (int page = 0; page < FORK_PAGES; page++) {
+    release_page(forks, in->page[page]);
+  }
+  in->next_free = forks->free_instance;
+  forks->free_instance = id;
+  forks->count--;
+}
+
+/**
+ * put a live chip into the state of a parked instance, like
+ * chip8_restore; quirks, engine and clock speed stay as they are
+ *
+ * if the chip already runs the rom, only bytes either side wrote to are
+ * copied and only their cached decodings dropped
+ */
+void chip8_forks_load(const Chip8Forks *forks, uint32_t id, Chip8 *chip) {
+  const Instance *in = instance_at(forks, id);
+  chip->rng_state = in->rng_state;
+  memcpy(chip->V, in->V, sizeof(chip->V));
+  memcpy(chip->stack, in->stack, sizeof(chip->stack));
+  chip->I = in->I;
+  chip->PC = in->PC;
+  chip->SP = in->SP;
+  chip->delay_timer = in->delay_timer;
+  chip->sound_timer = in->sound_timer;
+  memcpy(chip->keypad, in->keypad, sizeof(chip->keypad));
+  chip->FX0A_waiting = in->FX0A_waiting;
+  chip->FX0A_key = in->FX0A_key;
+  chip->FX0A_reg = in->FX0A_reg;
+  chip->draw_permitted = in->draw_permitted;
+
+  for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+    if (chip->display[y] != in->display[y]) {
+      chip->display[y] = in->display[y];
+      chip->draw_flag = true;
+    }
+  }
+
+  bool same_rom = chip->rom_hash == forks->rom_hash;
+  for (int page = 0; page < FORK_PAGES; page++) {
+    const uint8_t *bytes = page_at(forks, in->page[page])->bytes;
+    uint8_t *memory = &chip->memory[page * FORK_PAGE_SIZE];
+    if (!same_rom) {
+      memcpy(memory, bytes, FORK_PAGE_SIZE);
+      continue;
+    }
+    for (int w = page * WORDS_PER_PAGE; w < (page + 1) * WORDS_PER_PAGE;
+         w++) {
+      uint64_t bits = chip->code_written[w] | in->code_written[w];
+      while (bits) {
+        uint16_t addr = (w * 64 + __builtin_ctzll(bits)) * 2;
+        uint16_t offset = addr % FORK_PAGE_SIZE;
+        bits &= bits - 1;
+        if (memcmp(&memory[offset], &bytes[offset], 2) != 0) {
+          memcpy(&memory[offset], &bytes[offset], 2);
+          chip8_invalidate_code(chip, addr, 2);
+        }
+      }
+    }
+  }
+  if (!same_rom) {
+    chip8_invalidate_code(chip, 0, MEMORY_SIZE);
+    chip->rom_hash = forks->rom_hash;
+  }
+  memcpy(chip->code_written, in->code_written, sizeof(chip->code_written));
+}
+
+/**
+ * replace the state of a parked instance with that of a live chip
+ * running the rom (e.g. one it was loaded into and then ran); pages the
+ * chip changed get private copies unless the instance already owns them
+ * alone, pages it left as in the rom go back to the shared image
+ *
+ * returns nonzero, leaving the instance as it was, if the chip runs
+ * another rom or memory runs out
+ */
+int chip8_forks_store(Chip8Forks *forks, uint32_t id, const Chip8 *chip) {
+  if (chip->rom_hash != forks->rom_hash) {
+    fprintf(stderr, "Cannot store an instance of another rom\n");
+    return 1;
+  }
+  Instance *in = instance_at(forks, id);
+
+  // find the new page table first, so running out of memory changes
+  // nothing
+  uint32_t pages[FORK_PAGES];
+  bool changed[FORK_PAGES] = {false};
+  bool fresh[FORK_PAGES] = {false};
+  for (int page = 0; page < FORK_PAGES; page++) {
+    uint32_t current = in->page[page];
+    pages[page] = current;
+    if (!page_written(chip->code_written, page)) {
+      pages[page] = page;
+      continue;
+    }
+    changed[page] = memcmp(page_at(forks, current)->bytes,
+                           &chip->memory[page * FORK_PAGE_SIZE],
+                           FORK_PAGE_SIZE) != 0;
+    if (changed[page] &&
+        (current < FORK_PAGES || *page_refs(forks, current) > 1)) {
+      pages[page] = alloc_page(forks);
+      if (pages[page] == NONE) {
+        perror("Failed to allocate fork page");
+        for (int undo = 0; undo < page; undo++) {
+          if (fresh[undo]) {
+            release_page(forks, pages[undo]);
+          }
+        }
+        return 1;
+      }
+      fresh[page] = true;
+    }
+  }
+
+  for (int page = 0; page < FORK_PAGES; page++) {
+    if (changed[page]) {
+      memcpy(page_at(forks, pages[page])->bytes,
+             &chip->memory[page * FORK_PAGE_SIZE], FORK_PAGE_SIZE);
+    }
+    if (pages[page] != in->page[page]) {
+      release_page(forks, in->page[page]);
+      in->page[page] = pages[page];
+    }
+  }
+
+  in->rng_state = chip->rng_state;
+  memcpy(in->V, chip->V, sizeof(in->V));
+  memcpy(in->stack, chip->stack, sizeof(in->stack));
+  in->I = chip->I;
+  in->PC = chip->PC;
+  in->SP = chip->SP;
+  in->delay_timer = chip->delay_timer;
+  in->sound_timer = chip->sound_timer;
+  memcpy(in->keypad, chip->keypad, sizeof(in->keypad));
+  in->FX0A_waiting = chip->FX0A_waiting;
+  in->FX0A_key = chip->FX0A_key;
+  in->FX0A_reg = chip->FX0A_reg;
+  in->draw_permitted = chip->draw_permitted;
+  memcpy(in->display, chip->display, sizeof(in->display));
+  memcpy(in->code_written, chip->code_written, sizeof(in->code_written));
+  return 0;
+}
+
+uint32_t chip8_forks_count(const Chip8Forks *forks) { return forks->count; }
+
+/**
+ * pages copied because instances wrote to them, each FORK_PAGE_SIZE
+ * bytes (the shared rom image is not included)
+ */
+uint64_t chip8_forks_private_pages(const Chip8Forks *forks) {
+  return forks->pages_used;
+}
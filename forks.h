@@ -0,0 +1,35 @@
+#ifndef FORKS_H
+#define FORKS_H
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+// memory is shared and copied in pages of this many bytes
+#define FORK_PAGE_SIZE 256
+
+/**
+ * any number of parked instances of one rom whose memory pages are
+ * shared until written (see forks.c)
+ */
+typedef struct Chip8Forks Chip8Forks;
+
+Chip8Forks *chip8_forks_create(const Chip8 *origin);
+
+void chip8_forks_destroy(Chip8Forks *forks);
+
+int chip8_forks_add(Chip8Forks *forks, const Chip8 *chip, uint32_t *id);
+
+int chip8_forks_fork(Chip8Forks *forks, uint32_t parent, uint32_t *id);
+
+void chip8_forks_remove(Chip8Forks *forks, uint32_t id);
+
+void chip8_forks_load(const Chip8Forks *forks, uint32_t id, Chip8 *chip);
+
+int chip8_forks_store(Chip8Forks *forks, uint32_t id, const Chip8 *chip);
+
+uint32_t chip8_forks_count(const Chip8Forks *forks);
+
+uint64_t chip8_forks_private_pages(const Chip8Forks *forks);
+
+#endif
@@ -0,0 +1,124 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "handoff.h"
+
+/**
+ * HANDOFF BETWEEN THREADS
+ *
+ * lets a frontend run the emulator on one thread and present frames and
+ * read input on another without any locks: frames go one way through a
+ * triple buffer, key events the other way through a ring buffer
+ */
+
+// set in Chip8TripleBuffer.middle while the frame there has not been
+// taken by the consumer
+#define TRIPLE_BUFFER_FRESH 0x4u
+
+/**
+ * TRIPLE BUFFER
+ *
+ * each side owns one of the three buffers and the third sits in the
+ * middle; publishing and taking both atomically swap the owned buffer
+ * with the middle one, so a slow consumer only causes intermediate
+ * frames to be overwritten, never a stall in the producer
+ */
+
+void chip8_triple_buffer_init(Chip8TripleBuffer *buffer) {
+  memset(buffer->frames, 0, sizeof(buffer->frames));
+  buffer->back = 0;
+  atomic_init(&buffer->middle, 1);
+  buffer->front = 2;
+  buffer->published = 0;
+}
+
+/**
+ * copy the display into the back buffer and make it the newest frame
+ * (producer only)
+ */
+void chip8_triple_buffer_publish(Chip8TripleBuffer *buffer,
+                                 const Chip8 *chip) {
+  Chip8Frame *frame = &buffer->frames[buffer->back];
+  memcpy(frame->display, chip->display, sizeof(frame->display));
+  frame->hash = chip8_display_hash(chip);
+  frame->number = buffer->published++;
+
+  // release: the frame contents are visible before its index
+  uint32_t fresh = buffer->back | TRIPLE_BUFFER_FRESH;
+  uint32_t old = atomic_exchange_explicit(&buffer->middle, fresh,
+                                          memory_order_acq_rel);
+  buffer->back = old & ~TRIPLE_BUFFER_FRESH;
+}
+
+/**
+ * take the newest published frame (consumer only); returns NULL if none
+ * was published since the last call
+ *
+ * the frame stays valid until the next call
+ */
+const Chip8Frame *chip8_triple_buffer_take(Chip8TripleBuffer *buffer) {
+  if (!(atomic_load_explicit(&buffer->middle, memory_order_relaxed) &
+        TRIPLE_BUFFER_FRESH)) {
+    return NULL;
+  }
+  // acquire: pairs with the release in chip8_triple_buffer_publish
+  uint32_t old = atomic_exchange_explicit(&buffer->middle, buffer->front,
+                                          memory_order_acq_rel);
+  buffer->front = old & ~TRIPLE_BUFFER_FRESH;
+  return &buffer->frames[buffer->front];
+}
+
+/**
+ * true if the pixel at (x, y) of a published frame is lit
+ */
+bool chip8_frame_pixel(const Chip8Frame *frame, int x, int y) {
+  return frame->display[y] >> (DISPLAY_WIDTH - 1 - x) & 1;
+}
+
+/**
+ * KEY EVENT QUEUE
+ *
+ * head and tail only ever increase (wrapping at 2^32); the slot of an
+ * index is index % KEY_QUEUE_SIZE, which stays consistent across the
+ * wrap because the size is a power of two
+ */
+
+void chip8_key_queue_init(Chip8KeyQueue *queue) {
+  atomic_init(&queue->head, 0);
+  atomic_init(&queue->tail, 0);
+}
+
+/**
+ * queue a key event (producer only); returns false and drops the event
+ * if the queue is full
+ */
+bool chip8_key_queue_push(Chip8KeyQueue *queue, uint8_t key,
+                          Chip8EventType type) {
+  uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+  if (tail - head == KEY_QUEUE_SIZE) {
+    return false;
+  }
+  queue->events[tail % KEY_QUEUE_SIZE] =
+      (Chip8KeyEvent){.key = key, .type = type};
+  atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+/**
+ * dequeue the oldest key event (consumer only); returns false if the
+ * queue is empty
+ */
+bool chip8_key_queue_pop(Chip8KeyQueue *queue, Chip8KeyEvent *event) {
+  uint32_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+  if (head == tail) {
+    return false;
+  }
+  *event = queue->events[head % KEY_QUEUE_SIZE];
+  atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+  return true;
+}
@@ -0,0 +1,73 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+/**
+ * a completed frame as published by the emulation thread
+ */
+typedef struct Chip8Frame {
+  // same packed layout as Chip8.display (see chip8_frame_pixel)
+  uint64_t display[DISPLAY_HEIGHT];
+  // chip8_display_hash of the display
+  uint64_t hash;
+  // number of frames published before this one
+  uint64_t number;
+} Chip8Frame;
+
+/**
+ * lock-free triple buffer handing frames from one producer (emulation)
+ * to one consumer (presentation); the producer never waits for the
+ * consumer and the consumer always gets the newest published frame
+ */
+typedef struct Chip8TripleBuffer {
+  Chip8Frame frames[3];
+  // buffer owned by the producer
+  uint32_t back;
+  // buffer last published, or-ed with TRIPLE_BUFFER_FRESH until taken
+  _Atomic uint32_t middle;
+  // buffer owned by the consumer
+  uint32_t front;
+  // frames published so far (producer only)
+  uint64_t published;
+} Chip8TripleBuffer;
+
+#define KEY_QUEUE_SIZE 64
+
+typedef struct Chip8KeyEvent {
+  uint8_t key;
+  Chip8EventType type;
+} Chip8KeyEvent;
+
+/**
+ * lock-free single producer, single consumer ring of key events
+ */
+typedef struct Chip8KeyQueue {
+  Chip8KeyEvent events[KEY_QUEUE_SIZE];
+  // next event to pop (written by the consumer only)
+  _Atomic uint32_t head;
+  // next free slot (written by the producer only)
+  _Atomic uint32_t tail;
+} Chip8KeyQueue;
+
+void chip8_triple_buffer_init(Chip8TripleBuffer *buffer);
+
+void chip8_triple_buffer_publish(Chip8TripleBuffer *buffer,
+                                 const Chip8 *chip);
+
+const Chip8Frame *chip8_triple_buffer_take(Chip8TripleBuffer *buffer);
+
+bool chip8_frame_pixel(const Chip8Frame *frame, int x, int y);
+
+void chip8_key_queue_init(Chip8KeyQueue *queue);
+
+bool chip8_key_queue_push(Chip8KeyQueue *queue, uint8_t key,
+                          Chip8EventType type);
+
+bool chip8_key_queue_pop(Chip8KeyQueue *queue, Chip8KeyEvent *event);
+
+#endif
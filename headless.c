@@ -0,0 +1,317 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "profile.h"
+#include "replay.h"
+#include "trace.h"
+#ifdef CHIP8_AOT
+#include "aot.h"
+#endif
+
+/**
+ * headless runner
+ *
+ * executes a ROM for a fixed number of cycles or frames as fast as the
+ * host allows (no window, no SDL, no sleeping) and then dumps the final
+ * machine state and display to stdout
+ *
+ * with --replay it instead replays a recording of an interactive run
+ * (see replay.c), checking every frame against the recorded state hash
+ *
+ * --trace writes every executed instruction to a binary trace (see
+ * trace.c, decoded by chip8-tracedump); --debug traces into
+ * CHIP8_TRACE_DEFAULT_PATH
+ *
+ * when built with CHIP8_AOT defined and linked with a program generated
+ * by chip8-aot, the embedded rom is run through its recompiled code
+ * instead and the rom argument is dropped
+ */
+
+#define FRAMES_PER_SECOND 60.0
+
+/**
+ * run the selected engine, or the recompiled rom
+ */
+static uint64_t run_cycles(Chip8 *chip, uint64_t cycles) {
+#ifdef CHIP8_AOT
+  // counted like chip8_run_cycles does, for recordings
+  uint64_t executed = chip8_aot_run(chip, cycles);
+  chip->cycles += executed;
+  return executed;
+#else
+  return chip8_run_cycles(chip, cycles);
+#endif
+}
+
+/**
+ * print registers, timers and the display as ascii art
+ */
+void dump_state(Chip8 *chip, uint64_t cycles, uint64_t frames) {
+  printf("cycles=%" PRIu64 " frames=%" PRIu64 "\n", cycles, frames);
+  printf("PC=%03X I=%03X SP=%X DT=%02X ST=%02X\n", chip->PC, chip->I,
+         chip->SP, chip->delay_timer, chip->sound_timer);
+  for (int i = 0; i < NUM_REGISTERS; i++) {
+    printf("V%X=%02X%c", i, chip->V[i], i == NUM_REGISTERS - 1 ? '\n' : ' ');
+  }
+
+  for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+    char row[DISPLAY_WIDTH + 1];
+    for (int x = 0; x < DISPLAY_WIDTH; x++) {
+      row[x] = chip8_pixel(chip, x, y) ? '#' : '.';
+    }
+    row[DISPLAY_WIDTH] = '\0';
+    puts(row);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const char *rom_path = NULL;
+  bool debug = false;
+  double clock_speed = 6000.0;
+  uint64_t max_cycles = 0;
+  uint64_t max_frames = 0;
+  uint64_t seed = 0;
+  bool seeded = false;
+  Chip8Engine engine = CHIP8_ENGINE_TABLE;
+  const Chip8Quirks *quirks = &chip8_quirks_vip;
+  const char *record_path = NULL;
+  const char *replay_path = NULL;
+  const char *hotspots_path = NULL;
+  const char *trace_path = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--debug") == 0) {
+      debug = true;
+    } else if (strcmp(argv[i], "--clock-speed") == 0) {
+      if (i + 1 < argc) {
+        clock_speed = atof(argv[++i]);
+      } else {
+        fprintf(stderr, "Missing value for --clock-speed\n");
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--cycles") == 0) {
+      if (i + 1 < argc) {
+        max_cycles = strtoull(argv[++i], NULL, 10);
+      } else {
+        fprintf(stderr, "Missing value for --cycles\n");
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--seed") == 0) {
+      if (i + 1 < argc) {
+        seed = strtoull(argv[++i], NULL, 0);
+        seeded = true;
+      } else {
+        fprintf(stderr, "Missing value for --seed\n");
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--profile") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "Missing value for --profile\n");
+        return 1;
+      }
+      if (chip8_parse_profile(argv[++i], &quirks)) {
+        fprintf(stderr, "Unknown profile: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--engine") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "Missing value for --engine\n");
+        return 1;
+      }
+      if (chip8_parse_engine(argv[++i], &engine)) {
+        fprintf(stderr, "Unknown engine: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--record") == 0) {
+      if (i + 1 < argc) {
+        record_path = argv[++i];
+      } else {
+        fprintf(stderr, "Missing value for --record\n");
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--replay") == 0) {
+      if (i + 1 < argc) {
+        replay_path = argv[++i];
+      } else {
+        fprintf(stderr, "Missing value for --replay\n");
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--hotspots") == 0) {
+      if (i + 1 < argc) {
+        hotspots_path = argv[++i];
+      } else {
+        fprintf(stderr, "Missing value for --hotspots\n");
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--trace") == 0) {
+      if (i + 1 < argc) {
+        trace_path = argv[++i];
+      } else {
+        fprintf(stderr, "Missing value for --trace\n");
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--frames") == 0) {
+      if (i + 1 < argc) {
+        max_frames = strtoull(argv[++i], NULL, 10);
+      } else {
+        fprintf(stderr, "Missing value for --frames\n");
+        return 1;
+      }
+    } else {
+      if (rom_path == NULL) {
+        rom_path = argv[i];
+      } else {
+        fprintf(stderr, "Unknown extra argument: %s\n", argv[i]);
+        return 1;
+      }
+    }
+  }
+
+#ifdef CHIP8_AOT
+  if (rom_path) {
+    fprintf(stderr, "Unknown extra argument: %s\n", rom_path);
+    return 1;
+  }
+  rom_path = "(embedded)";
+  // the quirks were fixed when the rom was recompiled
+  quirks = &chip8_aot_quirks;
+#endif
+
+  if (!rom_path || (max_cycles == 0 && max_frames == 0 && !replay_path) ||
+      clock_speed <= 0 || (record_path && replay_path)) {
+    fprintf(stderr,
+            "Usage: %s <rom_file> (--cycles N | --frames N | --replay FILE) "
+            "[--debug] [--clock-speed Hz] [--seed N] "
+            "[--engine table|block|jit|threaded] "
+            "[--profile vip|schip|xo-chip] [--record FILE] "
+            "[--hotspots FILE] [--trace FILE]\n",
+            argv[0]);
+    return 1;
+  }
+  if (debug && !trace_path) {
+    trace_path = CHIP8_TRACE_DEFAULT_PATH;
+  }
+
+  Chip8 *chip = malloc(sizeof(Chip8));
+  if (!chip) {
+    perror("Failed to allocate emulator");
+    return 1;
+  }
+
+  chip8_init(chip, clock_speed, debug, quirks);
+  if (seeded) {
+    chip8_seed(chip, seed);
+  }
+  if (chip8_set_engine(chip, engine)) {
+    fprintf(stderr, "Engine not available on this host, using table\n");
+  }
+
+#ifdef CHIP8_AOT
+  int load_err = chip8_load_rom_data(chip, chip8_aot_rom, chip8_aot_rom_size);
+#else
+  int load_err = chip8_load_rom(chip, rom_path);
+#endif
+  if (load_err) {
+    chip8_destroy(chip);
+    free(chip);
+    return load_err;
+  }
+
+  Chip8Profile *profile = NULL;
+  if (hotspots_path) {
+    profile = chip8_profile_create();
+    if (!profile || chip8_profile_attach(chip, profile)) {
+      chip8_profile_destroy(profile);
+      chip8_destroy(chip);
+      free(chip);
+      return 1;
+    }
+  }
+
+  Chip8Trace *trace = NULL;
+  if (trace_path) {
+    trace = chip8_trace_create(trace_path, CHIP8_TRACE_DEFAULT_RECORDS, true);
+    if (!trace || chip8_trace_attach(chip, trace)) {
+      chip8_trace_destroy(trace);
+      chip8_profile_destroy(profile);
+      chip8_destroy(chip);
+      free(chip);
+      return 1;
+    }
+  }
+
+  if (replay_path) {
+    Chip8ReplayResult result;
+    int replay_err = chip8_replay(chip, replay_path, &result);
+    if (!replay_err) {
+      dump_state(chip, result.cycles, result.frames);
+      if (result.diverged) {
+        fprintf(stderr, "Replay diverged at frame %" PRIu64 "\n",
+                result.frames);
+        replay_err = 1;
+      }
+    }
+    if (profile) {
+      replay_err |= chip8_profile_write(profile, hotspots_path);
+      chip8_profile_destroy(profile);
+    }
+    chip8_trace_destroy(trace);
+    chip8_destroy(chip);
+    free(chip);
+    return replay_err;
+  }
+
+  Chip8Recorder *recorder = NULL;
+  if (record_path) {
+    recorder = chip8_recorder_create(record_path, chip);
+    if (!recorder) {
+      chip8_trace_destroy(trace);
+      chip8_profile_destroy(profile);
+      chip8_destroy(chip);
+      free(chip);
+      return 1;
+    }
+  }
+
+  // emulated time is derived from the cycle count alone, so a frame is
+  // ticked every (clock_speed / 60) cycles; the fractional part is
+  // carried over so that the long-run rate matches the clock speed
+  const double cycles_per_frame = clock_speed / FRAMES_PER_SECOND;
+  double cycle_accumulator = 0.0;
+  uint64_t cycles = 0;
+  uint64_t frames = 0;
+
+  while ((max_cycles == 0 || cycles < max_cycles) &&
+         (max_frames == 0 || frames < max_frames)) {
+    cycle_accumulator += cycles_per_frame;
+    uint64_t batch = (uint64_t)cycle_accumulator;
+    cycle_accumulator -= batch;
+
+    if (max_cycles && batch > max_cycles - cycles) {
+      // final partial frame: stop at the cycle budget
+      cycles += run_cycles(chip, max_cycles - cycles);
+      break;
+    }
+
+    cycles += run_cycles(chip, batch);
+    chip8_frame_tick(chip);
+    frames++;
+  }
+
+  dump_state(chip, cycles, frames);
+
+  int record_err = chip8_recorder_close(recorder);
+  if (profile) {
+    record_err |= chip8_profile_write(profile, hotspots_path);
+    chip8_profile_destroy(profile);
+  }
+  chip8_trace_destroy(trace);
+  chip8_destroy(chip);
+  free(chip);
+  return record_err;
+}
@@ -0,0 +1,729 @@
+#define _DEFAULT_SOURCE
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "jit.h"
+#include "opcodes.h"
+
+/**
+ * X86-64 DYNAMIC RECOMPILER
+ *
+ * basic blocks of CHIP-8 code are translated into native x86-64 code in
+ * an executable arena the first time they are reached; simple register
+ * instructions are emitted inline, everything else (drawing, key waits,
+ * memory stores, ...) calls the handler from opcodes.c
+ *
+ * translated blocks jump straight into each other: a block exit whose
+ * target has not been translated yet returns to chip8_jit_run, which
+ * translates the target and then patches the exit into a direct jump
+ *
+ * any write to a byte covered by a translation throws away the whole
+ * arena (ROMs rarely modify their own code, so this is cheap overall)
+ *
+ * native register use while executing translated code:
+ *   rbx  the Chip8 being executed
+ *   r12d remaining cycle budget (checked on entry to every block and
+ *        before every further instruction of a block, so that a run
+ *        stops exactly at its budget)
+ *   r13d cycles executed so far (returned in eax)
+ */
+
+#if defined(__x86_64__)
+
+#include <sys/mman.h>
+
+#define ARENA_SIZE (1 << 20)
+// longest block in instructions, and an upper bound on its code size
+#define MAX_BLOCK_LENGTH 64
+#define MAX_BLOCK_BYTES (MAX_BLOCK_LENGTH * 96 + 256)
+
+typedef uint32_t (*JitEnter)(Chip8 *chip, int32_t budget, void *entry);
+
+struct Chip8Jit {
+  uint8_t *arena;
+  uint8_t *cursor;
+  // start of the space for blocks (after the entry and exit stubs)
+  uint8_t *blocks_start;
+  JitEnter enter;
+  uint8_t *exit;
+  // native entry point of the block starting at each even address
+  uint8_t *entry[MEMORY_SIZE / 2];
+  // which even addresses are covered by some translation
+  bool covered[MEMORY_SIZE / 2];
+  bool flush_pending;
+  // written by a block exit that should be patched into a direct jump
+  // to chain_target once that has been translated
+  uint8_t *chain_site;
+  uint16_t chain_target;
+};
+
+// x86 register numbers
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RSI 6
+
+#define FIELD(name) ((int32_t)offsetof(Chip8, name))
+#define V_FIELD(x) (FIELD(V) + (x))
+
+/**
+ * EMITTER HELPERS
+ */
+
+static void emit8(Chip8Jit *jit, uint8_t byte) { *jit->cursor++ = byte; }
+
+static void emit16(Chip8Jit *jit, uint16_t value) {
+  memcpy(jit->cursor, &value, 2);
+  jit->cursor += 2;
+}
+
+static void emit32(Chip8Jit *jit, uint32_t value) {
+  memcpy(jit->cursor, &value, 4);
+  jit->cursor += 4;
+}
+
+static void emit64(Chip8Jit *jit, uint64_t value) {
+  memcpy(jit->cursor, &value, 8);
+  jit->cursor += 8;
+}
+
+/**
+ * ModRM byte plus displacement addressing [rbx + disp]
+ */
+static void emit_rbx_operand(Chip8Jit *jit, uint8_t reg, int32_t disp) {
+  emit8(jit, 0x80 | reg << 3 | 3);
+  emit32(jit, disp);
+}
+
+// mov byte [rbx + disp], imm8
+static void emit_store8_imm(Chip8Jit *jit, int32_t disp, uint8_t imm) {
+  emit8(jit, 0xC6);
+  emit_rbx_operand(jit, 0, disp);
+  emit8(jit, imm);
+}
+
+// add byte [rbx + disp], imm8
+static void emit_add8_imm(Chip8Jit *jit, int32_t disp, uint8_t imm) {
+  emit8(jit, 0x80);
+  emit_rbx_operand(jit, 0, disp);
+  emit8(jit, imm);
+}
+
+// cmp byte [rbx + disp], imm8
+static void emit_cmp8_imm(Chip8Jit *jit, int32_t disp, uint8_t imm) {
+  emit8(jit, 0x80);
+  emit_rbx_operand(jit, 7, disp);
+  emit8(jit, imm);
+}
+
+// movzx reg32, byte [rbx + disp]
+static void emit_load8(Chip8Jit *jit, uint8_t reg, int32_t disp) {
+  emit8(jit, 0x0F);
+  emit8(jit, 0xB6);
+  emit_rbx_operand(jit, reg, disp);
+}
+
+// movzx reg32, word [rbx + disp]
+static void emit_load16(Chip8Jit *jit, uint8_t reg, int32_t disp) {
+  emit8(jit, 0x0F);
+  emit8(jit, 0xB7);
+  emit_rbx_operand(jit, reg, disp);
+}
+
+// mov byte [rbx + disp], reg8 (al, cl or dl)
+static void emit_store8(Chip8Jit *jit, int32_t disp, uint8_t reg) {
+  emit8(jit, 0x88);
+  emit_rbx_operand(jit, reg, disp);
+}
+
+// mov word [rbx + disp], reg16
+static void emit_store16(Chip8Jit *jit, int32_t disp, uint8_t reg) {
+  emit8(jit, 0x66);
+  emit8(jit, 0x89);
+  emit_rbx_operand(jit, reg, disp);
+}
+
+// mov word [rbx + disp], imm16
+static void emit_store16_imm(Chip8Jit *jit, int32_t disp, uint16_t imm) {
+  emit8(jit, 0x66);
+  emit8(jit, 0xC7);
+  emit_rbx_operand(jit, 0, disp);
+  emit16(jit, imm);
+}
+
+// cmp reg8, byte [rbx + disp]
+static void emit_cmp8(Chip8Jit *jit, uint8_t reg, int32_t disp) {
+  emit8(jit, 0x3A);
+  emit_rbx_operand(jit, reg, disp);
+}
+
+// two-byte register to register op (e.g. 0x09 0xC8 = or eax, ecx)
+static void emit_op(Chip8Jit *jit, uint8_t opcode, uint8_t modrm) {
+  emit8(jit, opcode);
+  emit8(jit, modrm);
+}
+
+// jmp rel32 to target
+static void emit_jmp(Chip8Jit *jit, uint8_t *target) {
+  emit8(jit, 0xE9);
+  emit32(jit, (uint32_t)(target - (jit->cursor + 4)));
+}
+
+// jcc rel32 with placeholder target; returns address of the rel32
+static uint8_t *emit_jcc(Chip8Jit *jit, uint8_t condition) {
+  emit8(jit, 0x0F);
+  emit8(jit, 0x80 | condition);
+  uint8_t *rel = jit->cursor;
+  emit32(jit, 0);
+  return rel;
+}
+
+// point a rel32 emitted earlier at the current position
+static void patch_here(Chip8Jit *jit, uint8_t *rel) {
+  uint32_t offset = (uint32_t)(jit->cursor - (rel + 4));
+  memcpy(rel, &offset, 4);
+}
+
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_G 0xF
+
+/**
+ * count retired instructions: add r13d, n; sub r12d, n
+ */
+static void emit_retire(Chip8Jit *jit, uint32_t count) {
+  emit8(jit, 0x41);
+  emit8(jit, 0x81);
+  emit8(jit, 0xC5);
+  emit32(jit, count);
+  emit8(jit, 0x41);
+  emit8(jit, 0x81);
+  emit8(jit, 0xEC);
+  emit32(jit, count);
+}
+
+/**
+ * leave translated code with PC already set
+ */
+static void emit_exit(Chip8Jit *jit, uint32_t retired) {
+  emit_retire(jit, retired);
+  emit_jmp(jit, jit->exit);
+}
+
+/**
+ * leave translated code before the instruction at addr if the budget
+ * does not cover it, given that the block has executed `retired`
+ * instructions so far: cmp r12d, retired; jg over; exit
+ */
+static void emit_budget_check(Chip8Jit *jit, uint16_t addr,
+                              uint32_t retired) {
+  emit8(jit, 0x41);
+  emit8(jit, 0x83);
+  emit8(jit, 0xFC);
+  emit8(jit, retired);
+  emit8(jit, 0x70 | CC_G);
+  uint8_t *over = jit->cursor;
+  emit8(jit, 0);
+  emit_store16_imm(jit, FIELD(PC), addr);
+  emit_exit(jit, retired);
+  *over = (uint8_t)(jit->cursor - (over + 1));
+}
+
+/**
+ * continue at target: jump directly into its translation if there is
+ * one, otherwise exit through a stub that chip8_jit_run patches into a
+ * direct jump once the target has been translated
+ */
+static void emit_continue(Chip8Jit *jit, uint16_t target, uint32_t retired) {
+  emit_retire(jit, retired);
+
+  bool chainable = !(target & 1) && target < MEMORY_SIZE;
+  if (chainable && jit->entry[target >> 1]) {
+    emit_jmp(jit, jit->entry[target >> 1]);
+    return;
+  }
+
+  uint8_t *site = jit->cursor;
+  if (chainable) {
+    // jmp to the next instruction until patched
+    emit_jmp(jit, jit->cursor + 5);
+  }
+  emit_store16_imm(jit, FIELD(PC), target);
+  if (chainable) {
+    // mov rax, &jit->chain_site; mov rcx, site; mov [rax], rcx
+    emit8(jit, 0x48);
+    emit8(jit, 0xB8);
+    emit64(jit, (uint64_t)(uintptr_t)&jit->chain_site);
+    emit8(jit, 0x48);
+    emit8(jit, 0xB9);
+    emit64(jit, (uint64_t)(uintptr_t)site);
+    emit8(jit, 0x48);
+    emit8(jit, 0x89);
+    emit8(jit, 0x08);
+    // mov word [rax + offset of chain_target], target
+    emit8(jit, 0x66);
+    emit8(jit, 0xC7);
+    emit8(jit, 0x40);
+    emit8(jit, (uint8_t)(offsetof(Chip8Jit, chain_target) -
+                         offsetof(Chip8Jit, chain_site)));
+    emit16(jit, target);
+  }
+  emit_jmp(jit, jit->exit);
+}
+
+/**
+ * call the opcodes.c handler for the instruction at addr, whose decoded
+ * form is kept in the chip's decode cache
+ */
+static void emit_call_handler(Chip8Jit *jit, uint16_t addr,
+                              OpcodeHandler handler) {
+  emit_store16_imm(jit, FIELD(PC), addr);
+  // mov rdi, rbx
+  emit8(jit, 0x48);
+  emit8(jit, 0x89);
+  emit8(jit, 0xDF);
+  // lea rsi, [rbx + offset of decode cache entry]
+  emit8(jit, 0x48);
+  emit8(jit, 0x8D);
+  emit_rbx_operand(jit, RSI,
+                   FIELD(decode_cache) +
+                       (int32_t)((addr >> 1) * sizeof(Chip8Instruction)));
+  // mov rax, handler; call rax
+  emit8(jit, 0x48);
+  emit8(jit, 0xB8);
+  emit64(jit, (uint64_t)(uintptr_t)handler);
+  emit8(jit, 0xFF);
+  emit8(jit, 0xD0);
+}
+
+/**
+ * ARENA MANAGEMENT
+ */
+
+/**
+ * emit the entry trampoline and the shared exit sequence at the start
+ * of the arena
+ */
+static void emit_stubs(Chip8Jit *jit) {
+  jit->cursor = jit->arena;
+
+  jit->enter = (JitEnter)(uintptr_t)jit->cursor;
+  // push rbx; push r12; push r13 (leaves the stack 16-byte aligned)
+  emit8(jit, 0x53);
+  emit8(jit, 0x41);
+  emit8(jit, 0x54);
+  emit8(jit, 0x41);
+  emit8(jit, 0x55);
+  // mov rbx, rdi; mov r12d, esi; xor r13d, r13d; jmp rdx
+  emit8(jit, 0x48);
+  emit8(jit, 0x89);
+  emit8(jit, 0xFB);
+  emit8(jit, 0x41);
+  emit8(jit, 0x89);
+  emit8(jit, 0xF4);
+  emit8(jit, 0x45);
+  emit8(jit, 0x31);
+  emit8(jit, 0xED);
+  emit8(jit, 0xFF);
+  emit8(jit, 0xE2);
+
+  jit->exit = jit->cursor;
+  // mov eax, r13d; pop r13; pop r12; pop rbx; ret
+  emit8(jit, 0x44);
+  emit8(jit, 0x89);
+  emit8(jit, 0xE8);
+  emit8(jit, 0x41);
+  emit8(jit, 0x5D);
+  emit8(jit, 0x41);
+  emit8(jit, 0x5C);
+  emit8(jit, 0x5B);
+  emit8(jit, 0xC3);
+
+  jit->blocks_start = jit->cursor;
+}
+
+/**
+ * throw away all translations
+ */
+static void flush(Chip8Jit *jit) {
+  jit->cursor = jit->blocks_start;
+  memset(jit->entry, 0, sizeof(jit->entry));
+  memset(jit->covered, 0, sizeof(jit->covered));
+  jit->flush_pending = false;
+  jit->chain_site = NULL;
+}
+
+/**
+ * create a JIT with an empty arena, or return NULL if executable
+ * memory cannot be mapped
+ */
+Chip8Jit *chip8_jit_create(void) {
+  Chip8Jit *jit = calloc(1, sizeof(Chip8Jit));
+  if (!jit) {
+    return NULL;
+  }
+  jit->arena = mmap(NULL, ARENA_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                    MAP_PRIVATE | MAP_ANON, -1, 0);
+  if (jit->arena == MAP_FAILED) {
+    free(jit);
+    return NULL;
+  }
+  emit_stubs(jit);
+  flush(jit);
+  return jit;
+}
+
+void chip8_jit_destroy(Chip8Jit *jit) {
+  if (!jit) {
+    return;
+  }
+  munmap(jit->arena, ARENA_SIZE);
+  free(jit);
+}
+
+/**
+ * called for every memory write; translations covering the written
+ * bytes are thrown away before translated code runs again
+ */
+void chip8_jit_invalidate(Chip8Jit *jit, uint16_t addr, uint16_t len) {
+  for (uint32_t a = addr; a < (uint32_t)addr + len && a < MEMORY_SIZE; a++) {
+    if (jit->covered[a >> 1]) {
+      jit->flush_pending = true;
+      return;
+    }
+  }
+}
+
+/**
+ * TRANSLATION
+ */
+
+/**
+ * emit the inline translation of a simple register instruction;
+ * returns false if the instruction needs its handler instead
+ */
+static bool emit_inline(Chip8Jit *jit, const Chip8Instruction *ins) {
+  uint8_t x = ins->x;
+  uint8_t y = ins->y;
+
+  switch (ins->op) {
+  case OP_6XNN:
+    emit_store8_imm(jit, V_FIELD(x), ins->nn);
+    return true;
+
+  case OP_7XNN:
+    emit_add8_imm(jit, V_FIELD(x), ins->nn);
+    return true;
+
+  case OP_8XY0:
+    emit_load8(jit, RAX, V_FIELD(y));
+    emit_store8(jit, V_FIELD(x), RAX);
+    return true;
+
+  case OP_8XY1:
+  case OP_8XY2:
+  case OP_8XY3:
+  case OP_8XY1_RESET_VF:
+  case OP_8XY2_RESET_VF:
+  case OP_8XY3_RESET_VF: {
+    bool reset_vf = ins->op >= OP_8XY1_RESET_VF;
+    uint8_t op = reset_vf ? ins->op - OP_8XY1_RESET_VF + OP_8XY1 : ins->op;
+    emit_load8(jit, RAX, V_FIELD(x));
+    emit_load8(jit, RCX, V_FIELD(y));
+    // or / and / xor eax, ecx
+    emit_op(jit, op == OP_8XY1 ? 0x09 : op == OP_8XY2 ? 0x21 : 0x31, 0xC8);
+    emit_store8(jit, V_FIELD(x), RAX);
+    if (reset_vf) {
+      emit_store8_imm(jit, V_FIELD(0xF), 0);
+    }
+    return true;
+  }
+
+  case OP_8XY4:
+    emit_load8(jit, RAX, V_FIELD(x));
+    emit_load8(jit, RCX, V_FIELD(y));
+    emit_op(jit, 0x01, 0xC8); // add eax, ecx
+    emit_store8(jit, V_FIELD(x), RAX);
+    emit8(jit, 0xC1); // shr eax, 8
+    emit8(jit, 0xE8);
+    emit8(jit, 8);
+    emit_store8(jit, V_FIELD(0xF), RAX);
+    return true;
+
+  case OP_8XY5:
+  case OP_8XY7:
+    // VX := VX - VY or VY - VX; VF := 1 unless there was a borrow
+    emit_load8(jit, RAX, V_FIELD(ins->op == OP_8XY5 ? x : y));
+    emit_load8(jit, RCX, V_FIELD(ins->op == OP_8XY5 ? y : x));
+    emit_op(jit, 0x29, 0xC8); // sub eax, ecx
+    emit8(jit, 0x0F);         // setnc dl
+    emit8(jit, 0x93);
+    emit8(jit, 0xC2);
+    emit_store8(jit, V_FIELD(x), RAX);
+    emit_store8(jit, V_FIELD(0xF), RDX);
+    return true;
+
+  case OP_8XY6:
+  case OP_8XY6_VX:
+    emit_load8(jit, RAX, V_FIELD(ins->op == OP_8XY6 ? y : x));
+    emit_op(jit, 0x89, 0xC1); // mov ecx, eax
+    emit8(jit, 0x83);         // and ecx, 1
+    emit8(jit, 0xE1);
+    emit8(jit, 1);
+    emit_op(jit, 0xD1, 0xE8); // shr eax, 1
+    emit_store8(jit, V_FIELD(x), RAX);
+    emit_store8(jit, V_FIELD(0xF), RCX);
+    return true;
+
+  case OP_8XYE:
+  case OP_8XYE_VX:
+    emit_load8(jit, RAX, V_FIELD(ins->op == OP_8XYE ? y : x));
+    emit_op(jit, 0x89, 0xC1); // mov ecx, eax
+    emit8(jit, 0xC1);         // shr ecx, 7
+    emit8(jit, 0xE9);
+    emit8(jit, 7);
+    emit_op(jit, 0xD1, 0xE0); // shl eax, 1
+    emit_store8(jit, V_FIELD(x), RAX);
+    emit_store8(jit, V_FIELD(0xF), RCX);
+    return true;
+
+  case OP_ANNN:
+    emit_store16_imm(jit, FIELD(I), ins->nnn);
+    return true;
+
+  case OP_FX07:
+    emit_load8(jit, RAX, FIELD(delay_timer));
+    emit_store8(jit, V_FIELD(x), RAX);
+    return true;
+
+  case OP_FX15:
+  case OP_FX18:
+    emit_load8(jit, RAX, V_FIELD(x));
+    emit_store8(
+        jit, ins->op == OP_FX15 ? FIELD(delay_timer) : FIELD(sound_timer),
+        RAX);
+    return true;
+
+  case OP_FX1E:
+    emit_load16(jit, RAX, FIELD(I));
+    emit_load8(jit, RCX, V_FIELD(x));
+    emit_op(jit, 0x01, 0xC8); // add eax, ecx
+    emit_store16(jit, FIELD(I), RAX);
+    return true;
+
+  case OP_FX29:
+    emit_load8(jit, RAX, V_FIELD(x));
+    emit8(jit, 0x83); // and eax, 0xF
+    emit8(jit, 0xE0);
+    emit8(jit, 0x0F);
+    emit8(jit, 0x8D); // lea eax, [rax + rax * 4]
+    emit8(jit, 0x04);
+    emit8(jit, 0x80);
+    emit8(jit, 0x05); // add eax, FONT_START
+    emit32(jit, FONT_START);
+    emit_store16(jit, FIELD(I), RAX);
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+/**
+ * true if the jump at addr closes a loop that can wait idle (a jump to
+ * itself or a delay timer poll, see chip8_skip_idle); such jumps are
+ * not chained so that the wait is skipped instead of spun through
+ */
+static bool closes_idle_loop(const Chip8 *chip, uint16_t addr,
+                             uint16_t target) {
+  if (target == addr) {
+    return true;
+  }
+  if (target + 4 != addr) {
+    return false;
+  }
+  const uint8_t *mem = &chip->memory[target];
+  return (mem[0] & 0xF0) == 0xF0 && mem[1] == 0x07 &&
+         ((mem[2] & 0xF0) == 0x30 || (mem[2] & 0xF0) == 0x40) &&
+         (mem[2] & 0x0F) == (mem[0] & 0x0F);
+}
+
+/**
+ * translate the basic block starting at pc (which must be even)
+ */
+static uint8_t *translate(Chip8 *chip, Chip8Jit *jit, uint16_t pc) {
+  if (jit->cursor + MAX_BLOCK_BYTES > jit->arena + ARENA_SIZE) {
+    flush(jit);
+  }
+
+  uint8_t *entry = jit->cursor;
+
+  // check the cycle budget: test r12d, r12d; jg body
+  emit8(jit, 0x45);
+  emit8(jit, 0x85);
+  emit8(jit, 0xE4);
+  uint8_t *body = emit_jcc(jit, CC_G);
+  emit_store16_imm(jit, FIELD(PC), pc);
+  emit_jmp(jit, jit->exit);
+  patch_here(jit, body);
+
+  // register the entry now so that a block jumping to itself chains
+  jit->entry[pc >> 1] = entry;
+
+  uint32_t count = 0;
+  uint16_t addr = pc;
+  for (;;) {
+    if (count == MAX_BLOCK_LENGTH || addr >= MEMORY_SIZE) {
+      emit_continue(jit, addr, count);
+      break;
+    }
+
+    if (count) {
+      emit_budget_check(jit, addr, count);
+    }
+    Chip8Instruction *ins = &chip->decode_cache[addr >> 1];
+    uint16_t opcode = chip->memory[addr] << 8 | chip->memory[addr + 1];
+    chip8_decode(chip->quirks, opcode, ins);
+    jit->covered[addr >> 1] = true;
+    count++;
+
+    if (emit_inline(jit, ins)) {
+      addr += 2;
+      continue;
+    }
+
+    uint8_t *skip;
+    switch (ins->op) {
+    case OP_1NNN:
+      if (closes_idle_loop(chip, addr, ins->nnn)) {
+        // return to chip8_jit_run, which skips through the wait
+        emit_store16_imm(jit, FIELD(PC), ins->nnn);
+        emit_exit(jit, count);
+      } else {
+        emit_continue(jit, ins->nnn, count);
+      }
+      return entry;
+
+    case OP_3XNN:
+    case OP_4XNN:
+      emit_cmp8_imm(jit, V_FIELD(ins->x), ins->nn);
+      skip = emit_jcc(jit, ins->op == OP_3XNN ? CC_E : CC_NE);
+      emit_continue(jit, addr + 2, count);
+      patch_here(jit, skip);
+      emit_continue(jit, addr + 4, count);
+      return entry;
+
+    case OP_5XY0:
+    case OP_9XY0:
+      emit_load8(jit, RAX, V_FIELD(ins->x));
+      emit_cmp8(jit, RAX, V_FIELD(ins->y));
+      skip = emit_jcc(jit, ins->op == OP_5XY0 ? CC_E : CC_NE);
+      emit_continue(jit, addr + 2, count);
+      patch_here(jit, skip);
+      emit_continue(jit, addr + 4, count);
+      return entry;
+
+    case OP_00E0:
+    case OP_CXNN:
+    case OP_FX65:
+    case OP_FX65_INC_I:
+      // handler always falls through to the next instruction
+      emit_call_handler(jit, addr, ins->handler);
+      addr += 2;
+      continue;
+
+    case OP_2NNN:
+      emit_call_handler(jit, addr, ins->handler);
+      emit_continue(jit, ins->nnn, count);
+      return entry;
+
+    default:
+      // control flow, draws that may be throttled, key waits and
+      // memory stores (which may invalidate this very block): the
+      // handler sets PC and the block ends
+      emit_call_handler(jit, addr, ins->handler);
+      emit_exit(jit, count);
+      return entry;
+    }
+  }
+  return entry;
+}
+
+/**
+ * execute the given number of cycles through translated code; returns
+ * the number of cycles executed, which is exactly the number asked for
+ * unless the chip waits for a key (FX0A), when all of them pass idle
+ */
+uint64_t chip8_jit_run(Chip8 *chip, uint64_t cycles) {
+  Chip8Jit *jit = chip->jit;
+  uint64_t executed = 0;
+
+  while (executed < cycles) {
+    if (chip->FX0A_waiting) {
+      // nothing can happen until a key event; the cycles pass idle
+      return cycles;
+    }
+    if (jit->flush_pending) {
+      flush(jit);
+    }
+
+    uint16_t pc = chip->PC;
+    if ((pc & 1) || pc >= MEMORY_SIZE) {
+      chip8_decode_execute(chip, chip8_fetch(chip));
+      executed++;
+      continue;
+    }
+
+    uint8_t *entry = jit->entry[pc >> 1];
+    if (!entry) {
+      entry = translate(chip, jit, pc);
+    }
+
+    if (jit->chain_site) {
+      if (jit->chain_target == pc) {
+        uint8_t *site = jit->chain_site;
+        uint32_t offset = (uint32_t)(entry - (site + 5));
+        memcpy(site + 1, &offset, 4);
+      }
+      jit->chain_site = NULL;
+    }
+
+    executed += chip8_skip_idle(chip, cycles - executed);
+    if (executed >= cycles) {
+      break;
+    }
+
+    uint64_t budget = cycles - executed;
+    if (budget > INT32_MAX) {
+      budget = INT32_MAX;
+    }
+    executed += jit->enter(chip, (int32_t)budget, entry);
+  }
+  return executed;
+}
+
+#else
+
+/**
+ * the recompiler only targets x86-64; elsewhere the JIT engine is not
+ * available and chip8_set_engine falls back to table dispatch
+ */
+
+Chip8Jit *chip8_jit_create(void) { return NULL; }
+
+void chip8_jit_destroy(__attribute__((unused)) Chip8Jit *jit) {}
+
+void chip8_jit_invalidate(__attribute__((unused)) Chip8Jit *jit,
+                          __attribute__((unused)) uint16_t addr,
+                          __attribute__((unused)) uint16_t len) {}
+
+uint64_t chip8_jit_run(__attribute__((unused)) Chip8 *chip, uint64_t cycles) {
+  return cycles;
+}
+
+#endif
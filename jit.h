@@ -0,0 +1,17 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "chip8.h"
+#include <stdint.h>
+
+typedef struct Chip8Jit Chip8Jit;
+
+Chip8Jit *chip8_jit_create(void);
+
+void chip8_jit_destroy(Chip8Jit *jit);
+
+uint64_t chip8_jit_run(Chip8 *chip, uint64_t cycles);
+
+void chip8_jit_invalidate(Chip8Jit *jit, uint16_t addr, uint16_t len);
+
+#endif
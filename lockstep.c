@@ -0,0 +1,887 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "jit.h"
+#include "lockstep.h"
+#include "opcodes.h"
+
+/**
+ * LOCKSTEP EXECUTION
+ *
+ * runs many instances (lanes) of the same rom that differ only in their
+ * state, e.g. inputs or random seeds, much faster than the same number
+ * of independent Chip8 structs
+ *
+ * lanes are stored in groups of LOCKSTEP_WIDTH as a structure of
+ * arrays: each register of the group is one vector holding that
+ * register for every lane, so an instruction executed by all lanes at
+ * once is a handful of vector operations (GCC/Clang vector extensions,
+ * compiled to SSE2, AVX2 or NEON depending on the target flags)
+ *
+ * each step picks the lowest PC among the lanes of a group that still
+ * have cycles left and executes the instruction there for every lane at
+ * that PC; lanes elsewhere wait, which lets lanes that split at a branch
+ * meet again where the paths join. lanes that stay together below all
+ * others keep running on a fast path without searching again and with
+ * one cycle count for all of them; once lanes have diverged completely
+ * that is a single lane running on its own, i.e. scalar execution
+ *
+ * every lane runs exactly the requested number of cycles per call and
+ * ends up in the same state as a Chip8 run with chip8_run_cycles (table
+ * engine); as there, idle waits are skipped instead of spun through
+ *
+ * code is decoded once for all lanes from the memory image they were
+ * created with; addresses any lane has written to since are decoded per
+ * lane from that lane's own memory
+ */
+
+typedef uint8_t LaneBytes __attribute__((vector_size(LOCKSTEP_WIDTH)));
+typedef uint16_t LaneWords __attribute__((vector_size(LOCKSTEP_WIDTH * 2)));
+typedef uint32_t LaneCounts __attribute__((vector_size(LOCKSTEP_WIDTH * 4)));
+typedef uint64_t LaneStates __attribute__((vector_size(LOCKSTEP_WIDTH * 8)));
+
+// vector comparisons yield signed elements with all bits set where true
+typedef int8_t ByteMask __attribute__((vector_size(LOCKSTEP_WIDTH)));
+typedef int16_t WordMask __attribute__((vector_size(LOCKSTEP_WIDTH * 2)));
+typedef int32_t CountMask __attribute__((vector_size(LOCKSTEP_WIDTH * 4)));
+typedef int64_t StateMask __attribute__((vector_size(LOCKSTEP_WIDTH * 8)));
+
+#define LANE_HELPER static inline __attribute__((always_inline))
+
+/**
+ * one group of lanes; flags are all ones in the lanes where they are set
+ */
+typedef struct Group {
+  LaneBytes V[NUM_REGISTERS];
+  LaneWords I;
+  LaneWords PC;
+  LaneBytes delay_timer;
+  LaneBytes sound_timer;
+  // one bit per key
+  LaneWords keypad;
+  LaneBytes SP;
+  LaneWords stack[STACK_SIZE];
+  LaneBytes draw_permitted;
+  LaneBytes FX0A_waiting;
+  LaneBytes FX0A_key;
+  LaneBytes FX0A_reg;
+  LaneStates rng_state;
+  // lanes of the group that are in use (the last group may be partial)
+  LaneWords live;
+  uint64_t display[LOCKSTEP_WIDTH][DISPLAY_HEIGHT];
+  uint8_t memory[LOCKSTEP_WIDTH][MEMORY_SIZE];
+} Group;
+
+struct Chip8Lockstep {
+  uint32_t lanes;
+  uint32_t groups;
+  Group *group;
+  const Chip8Quirks *quirks;
+  // memory every lane was created with, from which shared code is
+  // decoded
+  uint8_t image[MEMORY_SIZE];
+  uint64_t rom_hash;
+  Chip8Instruction decode_cache[MEMORY_SIZE / 2];
+  // one bit per even address written by any lane (see mark_written)
+  uint64_t code_written[MEMORY_SIZE / 128];
+};
+
+/**
+ * HELPER FUNCTIONS
+ */
+
+LANE_HELPER LaneBytes byte_mask(LaneWords mask) {
+  return (LaneBytes)__builtin_convertvector((WordMask)mask, ByteMask);
+}
+
+LANE_HELPER LaneWords word_mask(ByteMask mask) {
+  return (LaneWords)__builtin_convertvector(mask, WordMask);
+}
+
+LANE_HELPER LaneWords count_to_word_mask(CountMask mask) {
+  return (LaneWords)__builtin_convertvector(mask, WordMask);
+}
+
+LANE_HELPER LaneCounts count_mask(LaneWords mask) {
+  return (LaneCounts)__builtin_convertvector((WordMask)mask, CountMask);
+}
+
+LANE_HELPER LaneStates state_mask(LaneWords mask) {
+  return (LaneStates)__builtin_convertvector((WordMask)mask, StateMask);
+}
+
+LANE_HELPER LaneWords widen(LaneBytes value) {
+  return __builtin_convertvector(value, LaneWords);
+}
+
+LANE_HELPER bool any_lane(LaneWords mask) {
+  uint64_t words[sizeof(mask) / sizeof(uint64_t)];
+  memcpy(words, &mask, sizeof(mask));
+  uint64_t any = 0;
+  for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+    any |= words[i];
+  }
+  return any != 0;
+}
+
+/**
+ * VX := value and VF := flag in the lanes of mask (VF written last, as
+ * the 8XYN instructions do)
+ */
+LANE_HELPER void set_with_flag(Group *g, LaneBytes lanes, uint8_t x,
+                               LaneBytes value, LaneBytes flag) {
+  g->V[x] = (value & lanes) | (g->V[x] & ~lanes);
+  g->V[0xF] = (flag & lanes) | (g->V[0xF] & ~lanes);
+}
+
+static Group *lane_group(const Chip8Lockstep *lockstep, uint32_t lane,
+                         int *slot) {
+  *slot = lane % LOCKSTEP_WIDTH;
+  return &lockstep->group[lane / LOCKSTEP_WIDTH];
+}
+
+static bool written(const Chip8Lockstep *lockstep, uint16_t addr) {
+  uint32_t e = (addr & (MEMORY_SIZE - 1)) >> 1;
+  return lockstep->code_written[e >> 6] & (1ULL << (e & 63));
+}
+
+/**
+ * record that a lane wrote the len bytes starting at addr (wrapping at
+ * the end of memory), so shared decodings of them are no longer used
+ */
+static void mark_written(Chip8Lockstep *lockstep, uint16_t addr,
+                         uint16_t len) {
+  for (uint16_t i = 0; i < len; i++) {
+    uint32_t e = ((addr + i) & (MEMORY_SIZE - 1)) >> 1;
+    lockstep->code_written[e >> 6] |= 1ULL << (e & 63);
+  }
+}
+
+static uint16_t image_opcode(const Chip8Lockstep *lockstep, uint16_t addr) {
+  return lockstep->image[addr] << 8 | lockstep->image[addr + 1];
+}
+
+/**
+ * if pc is the FX07 of an unmodified delay timer poll (see IDLE
+ * DETECTION in chip8.c), store the opcode of its test and return true
+ */
+static bool delay_poll(const Chip8Lockstep *lockstep, uint16_t pc,
+                       uint16_t *test) {
+  if (pc + 6 > MEMORY_SIZE || written(lockstep, pc + 2) ||
+      written(lockstep, pc + 4)) {
+    return false;
+  }
+  uint16_t load = image_opcode(lockstep, pc);
+  *test = image_opcode(lockstep, pc + 2);
+  return ((*test & 0xF000) == 0x3000 || (*test & 0xF000) == 0x4000) &&
+         (*test & 0x0F00) == (load & 0x0F00) &&
+         image_opcode(lockstep, pc + 4) == (0x1000 | pc);
+}
+
+/**
+ * same scrambling as chip8_seed, so a lane matches an instance seeded
+ * with the same value
+ */
+static uint64_t scramble_seed(uint64_t seed) {
+  uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  z ^= z >> 31;
+  return z ? z : 0x9E3779B97F4A7C15ULL;
+}
+
+/**
+ * the next byte of every lane's xorshift64* generator (the same one as
+ * chip8_random), advancing only the lanes in mask
+ */
+LANE_HELPER LaneBytes random_bytes(Group *g, LaneWords mask) {
+  LaneStates x = g->rng_state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  LaneStates lanes = state_mask(mask);
+  g->rng_state = (x & lanes) | (g->rng_state & ~lanes);
+  return __builtin_convertvector((x * 0x2545F4914F6CDD1DULL) >> 56,
+                                 LaneBytes);
+}
+
+/**
+ * draw opcode for one lane (see draw in opcodes.c); returns false if the
+ * lane is stalled until the vertical blank
+ */
+static bool draw_lane(Group *g, int lane, const Chip8Instruction *ins,
+                      bool waits_for_vblank, bool clip) {
+  if (waits_for_vblank) {
+    if (!g->draw_permitted[lane]) {
+      return false;
+    }
+    g->draw_permitted[lane] = 0;
+  }
+
+  uint8_t x = g->V[ins->x][lane] % DISPLAY_WIDTH;
+  uint8_t y = g->V[ins->y][lane] % DISPLAY_HEIGHT;
+  uint16_t addr = g->I[lane];
+  uint64_t *display = g->display[lane];
+  uint64_t collision = 0;
+
+  for (uint8_t i = 0; i < ins->n; i++) {
+    uint8_t py = y + i;
+    if (clip && py >= DISPLAY_HEIGHT) {
+      break;
+    }
+    py %= DISPLAY_HEIGHT;
+
+    uint64_t sprite =
+        (uint64_t)g->memory[lane][(addr + i) & (MEMORY_SIZE - 1)] << 56;
+    uint64_t bits = sprite >> x;
+    if (!clip && x > 0) {
+      bits |= sprite << (DISPLAY_WIDTH - x);
+    }
+    collision |= display[py] & bits;
+    display[py] ^= bits;
+  }
+  g->V[0xF][lane] = collision != 0;
+  return true;
+}
+
+/**
+ * EXECUTION
+ */
+
+/**
+ * the PC shared by all lanes of mask, or -1 if they differ
+ */
+static int uniform_pc(const Group *g, LaneWords mask) {
+  int pc = -1;
+  for (int lane = 0; lane < LOCKSTEP_WIDTH; lane++) {
+    if (!mask[lane]) {
+      continue;
+    }
+    if (pc >= 0 && g->PC[lane] != pc) {
+      return -1;
+    }
+    pc = g->PC[lane];
+  }
+  return pc;
+}
+
+/**
+ * execute a decoded instruction for the lanes in mask, which are all at
+ * its address pc; lanes that now wait for the next frame tick or a key
+ * are added to idle
+ *
+ * returns the address at which all lanes of mask that are not idle
+ * continue, or -1 if it differs between them
+ */
+static int execute(Chip8Lockstep *lockstep, Group *g, uint16_t pc,
+                   const Chip8Instruction *ins, LaneWords mask,
+                   LaneWords *idle) {
+  LaneBytes lanes = byte_mask(mask);
+  uint8_t x = ins->x;
+  uint8_t y = ins->y;
+  uint16_t next = pc + 2;
+  // lanes that skip the following instruction, if the instruction is a
+  // conditional skip
+  bool skips = false;
+  LaneWords skip = {0};
+  LaneBytes src = g->V[y];
+
+  switch (ins->op) {
+  case OP_00E0:
+    for (int lane = 0; lane < LOCKSTEP_WIDTH; lane++) {
+      if (mask[lane]) {
+        memset(g->display[lane], 0, sizeof(g->display[lane]));
+      }
+    }
+    break;
+  case OP_00EE:
+    for (int lane = 0; lane < LOCKSTEP_WIDTH; lane++) {
+      if (mask[lane]) {
+        g->PC[lane] = g->stack[g->SP[lane] & (STACK_SIZE - 1)][lane];
+        g->SP[lane]--;
+      }
+    }
+    return uniform_pc(g, mask);
+  case OP_1NNN:
+    next = ins->nnn;
+    if (next == pc) {
+      *idle |= mask;
+    }
+    break;
+  case OP_2NNN:
+    g->SP += lanes & 1;
+    for (int lane = 0; lane < LOCKSTEP_WIDTH; lane++) {
+      if (mask[lane]) {
+        g->stack[g->SP[lane] & (STACK_SIZE - 1)][lane] = next;
+      }
+    }
+    next = ins->nnn;
+    break;
+  case OP_3XNN:
+    skip = word_mask(g->V[x] == ins->nn);
+    skips = true;
+    break;
+  case OP_4XNN:
+    skip = word_mask(g->V[x] != ins->nn);
+    skips = true;
+    break;
+  case OP_5XY0:
+    skip = word_mask(g->V[x] == g->V[y]);
+    skips = true;
+    break;
+  case OP_9XY0:
+    skip = word_mask(g->V[x] != g->V[y]);
+    skips = true;
+    break;
+  case OP_6XNN:
+    g->V[x] = (lanes & ins->nn) | (g->V[x] & ~lanes);
+    break;
+  case OP_7XNN:
+    g->V[x] += lanes & ins->nn;
+    break;
+  case OP_8XY0:
+    g->V[x] = (g->V[y] & lanes) | (g->V[x] & ~lanes);
+    break;
+  case OP_8XY1:
+  case OP_8XY1_RESET_VF:
+    g->V[x] |= g->V[y] & lanes;
+    break;
+  case OP_8XY2:
+  case OP_8XY2_RESET_VF:
+    g->V[x] &= g->V[y] | ~lanes;
+    break;
+  case OP_8XY3:
+  case OP_8XY3_RESET_VF:
+    g->V[x] ^= g->V[y] & lanes;
+    break;
+  case OP_8XY4: {
+    LaneBytes sum = g->V[x] + g->V[y];
+    set_with_flag(g, lanes, x, sum, (LaneBytes)(sum < g->V[x]) & 1);
+    break;
+  }
+  case OP_8XY5:
+    set_with_flag(g, lanes, x, g->V[x] - g->V[y],
+                  (LaneBytes)(g->V[x] >= g->V[y]) & 1);
+    break;
+  case OP_8XY7:
+    set_with_flag(g, lanes, x, g->V[y] - g->V[x],
+                  (LaneBytes)(g->V[y] >= g->V[x]) & 1);
+    break;
+  case OP_8XY6_VX:
+    src = g->V[x];
+    // fall through
+  case OP_8XY6:
+    set_with_flag(g, lanes, x, src >> 1, src & 1);
+    break;
+  case OP_8XYE_VX:
+    src = g->V[x];
+    // fall through
+  case OP_8XYE:
+    set_with_flag(g, lanes, x, src << 1, src >> 7);
+    break;
+  case OP_ANNN:
+    g->I = (mask & ins->nnn) | (g->I & ~mask);
+    break;
+  case OP_BNNN:
+  case OP_BXNN: {
+    LaneWords target = ins->nnn + widen(g->V[ins->op == OP_BNNN ? 0 : x]);
+    g->PC = (target & mask) | (g->PC & ~mask);
+    return uniform_pc(g, mask);
+  }
+  case OP_CXNN:
+    g->V[x] = (random_bytes(g, mask) & lanes & ins->nn) | (g->V[x] & ~lanes);
+    break;
+  case OP_DXYN:
+  case OP_DXYN_CLIP:
+  case OP_DXYN_VBLANK:
+  case OP_DXYN_VBLANK_CLIP: {
+    bool vblank = ins->op == OP_DXYN_VBLANK || ins->op == OP_DXYN_VBLANK_CLIP;
+    bool clip = ins->op == OP_DXYN_CLIP || ins->op == OP_DXYN_VBLANK_CLIP;
+    for (int lane = 0; lane < LOCKSTEP_WIDTH; lane++) {
+      if (mask[lane] && !draw_lane(g, lane, ins, vblank, clip)) {
+        // stalled: PC stays on the draw until the next frame tick
+        (*idle)[lane] = UINT16_MAX;
+        mask[lane] = 0;
+      }
+    }
+    break;
+  }
+  case OP_EX9E:
+  case OP_EXA1: {
+    // only the low nibble of VX selects a key, as on the VIP
+    LaneWords key = widen(g->V[x] & 0xF);
+    LaneWords pressed = (LaneWords)(((g->keypad >> key) & 1) != 0);
+    skip = ins->op == OP_EX9E ? pressed : ~pressed;
+    skips = true;
+    break;
+  }
+  case OP_FX07:
+    g->V[x] = (g->delay_timer & lanes) | (g->V[x] & ~lanes);
+    break;
+  case OP_FX0A:
+    // PC stays on the FX0A until the key is released (see
+    // chip8_lockstep_key_event)
+    g->FX0A_reg = (lanes & x) | (g->FX0A_reg & ~lanes);
+    g->FX0A_waiting |= lanes;
+    *idle |= mask;
+    return pc;
+  case OP_FX15:
+    g->delay_timer = (g->V[x] & lanes) | (g->delay_timer & ~lanes);
+    break;
+  case OP_FX18:
+    g->sound_timer = (g->V[x] & lanes) | (g->sound_timer & ~lanes);
+    break;
+  case OP_FX1E:
+    g->I += widen(g->V[x]) & mask;
+    break;
+  case OP_FX29: {
+    LaneWords font = FONT_START + FONT_SIZE_BYTES * widen(g->V[x] & 0x0F);
+    g->I = (font & mask) | (g->I & ~mask);
+    break;
+  }
+  case OP_FX33:
+    for (int lane = 0; lane < LOCKSTEP_WIDTH; lane++) {
+      if (mask[lane]) {
+        uint8_t *memory = g->memory[lane];
+        uint16_t addr = g->I[lane];
+        uint8_t val = g->V[x][lane];
+        memory[addr & (MEMORY_SIZE - 1)] = val / 100;
+        memory[(addr + 1) & (MEMORY_SIZE - 1)] = val % 100 / 10;
+        memory[(addr + 2) & (MEMORY_SIZE - 1)] = val % 10;
+        mark_written(lockstep, addr, 3);
+      }
+    }
+    break;
+  case OP_FX55:
+  case OP_FX55_INC_I:
+    for (int lane = 0; lane < LOCKSTEP_WIDTH; lane++) {
+      if (mask[lane]) {
+        uint16_t addr = g->I[lane];
+        for (int i = 0; i <= x; i++) {
+          g->memory[lane][(addr + i) & (MEMORY_SIZE - 1)] = g->V[i][lane];
+        }
+        mark_written(lockstep, addr, x + 1);
+      }
+    }
+    if (ins->op == OP_FX55_INC_I) {
+      g->I += mask & (uint16_t)(x + 1);
+    }
+    break;
+  case OP_FX65:
+  case OP_FX65_INC_I:
+    for (int lane = 0; lane < LOCKSTEP_WIDTH; lane++) {
+      if (mask[lane]) {
+        uint16_t addr = g->I[lane];
+        for (int i = 0; i <= x; i++) {
+          g->V[i][lane] = g->memory[lane][(addr + i) & (MEMORY_SIZE - 1)];
+        }
+      }
+    }
+    if (ins->op == OP_FX65_INC_I) {
+      g->I += mask & (uint16_t)(x + 1);
+    }
+    break;
+  default:
+    // not part of the instruction set: PC stays put
+    return pc;
+  }
+
+  switch (ins->op) {
+  case OP_8XY1_RESET_VF:
+  case OP_8XY2_RESET_VF:
+  case OP_8XY3_RESET_VF:
+    g->V[0xF] &= ~lanes;
+    break;
+  default:
+    break;
+  }
+
+  if (!skips) {
+    g->PC = (next & mask) | (g->PC & ~mask);
+    return next;
+  }
+  skip &= mask;
+  g->PC = ((next + (skip & 2)) & mask) | (g->PC & ~mask);
+  if (!any_lane(skip)) {
+    return next;
+  }
+  return any_lane(mask & ~skip) ? -1 : next + 2;
+}
+
+/**
+ * execute the instruction at pc for the lanes in *mask (all at pc),
+ * charging each of them for the cycles it took, then drop the lanes that
+ * ran out of cycles or went idle from *mask
+ *
+ * returns the address at which all lanes left in *mask continue, or -1
+ * if it differs between them
+ */
+static int step(Chip8Lockstep *lockstep, Group *g, uint16_t pc,
+                LaneWords *mask, LaneCounts *remaining) {
+  LaneWords idle = {0};
+  int next = -1;
+
+  if ((pc & 1) || pc >= MEMORY_SIZE - 1 || written(lockstep, pc)) {
+    // the code may differ between lanes: read it from each one's memory
+    // and execute each distinct opcode for the lanes that have it
+    uint16_t opcodes[LOCKSTEP_WIDTH];
+    for (int lane = 0; lane < LOCKSTEP_WIDTH; lane++) {
+      const uint8_t *memory = g->memory[lane];
+      opcodes[lane] = memory[pc & (MEMORY_SIZE - 1)] << 8 |
+                      memory[(pc + 1) & (MEMORY_SIZE - 1)];
+    }
+    LaneWords pending = *mask;
+    for (int lane = 0; lane < LOCKSTEP_WIDTH; lane++) {
+      if (!pending[lane]) {
+        continue;
+      }
+      LaneWords same = {0};
+      for (int other = lane; other < LOCKSTEP_WIDTH; other++) {
+        if (pending[other] && opcodes[other] == opcodes[lane]) {
+          same[other] = UINT16_MAX;
+        }
+      }
+      pending &= ~same;
+      Chip8Instruction ins;
+      chip8_decode(lockstep->quirks, opcodes[lane], &ins);
+      execute(lockstep, g, pc, &ins, same, &idle);
+    }
+  } else {
+    Chip8Instruction *ins = &lockstep->decode_cache[pc >> 1];
+    if (!ins->length) {
+      chip8_decode(lockstep->quirks, image_opcode(lockstep, pc), ins);
+    }
+
+    uint16_t test;
+    if (ins->op == OP_FX07 && delay_poll(lockstep, pc, &test)) {
+      // lanes whose timer will not end the poll before the next frame
+      // tick skip whole iterations of it, three instructions each
+      LaneBytes timer = g->delay_timer;
+      uint8_t nn = test & 0xFF;
+      LaneWords polling =
+          word_mask((test & 0xF000) == 0x3000 ? timer != nn : timer == nn);
+      LaneCounts skipped = *remaining - *remaining % 3;
+      skipped &= count_mask(polling & *mask);
+      // every iteration reloads VX
+      LaneBytes reloaded = byte_mask(count_to_word_mask(skipped != 0));
+      g->V[ins->x] = (timer & reloaded) | (g->V[ins->x] & ~reloaded);
+      *remaining -= skipped;
+      *mask &= count_to_word_mask(*remaining != 0);
+    }
+    next = execute(lockstep, g, pc, ins, *mask, &idle);
+  }
+
+  // all ones in a lane subtract one
+  *remaining += count_mask(*mask);
+  *remaining &= ~count_mask(idle);
+  *mask &= count_to_word_mask(*remaining != 0);
+  return next;
+}
+
+/**
+ * the lowest PC among the active lanes; *above is set to the next higher
+ * one, or one past the largest PC if they are all at the same address
+ */
+static uint16_t lowest_pc(const Group *g, LaneWords active, int *above) {
+  int lowest = UINT16_MAX + 1;
+  *above = UINT16_MAX + 1;
+  for (int lane = 0; lane < LOCKSTEP_WIDTH; lane++) {
+    int pc = g->PC[lane];
+    if (!active[lane] || pc == lowest) {
+      continue;
+    }
+    if (pc < lowest) {
+      *above = lowest;
+      lowest = pc;
+    } else if (pc < *above) {
+      *above = pc;
+    }
+  }
+  return lowest;
+}
+
+/**
+ * fast path for a step whose lanes all have the same number of cycles
+ * left: the count is kept once for all of them instead of per lane, and
+ * the lanes keep running for as long as they stay together below every
+ * other lane (so the next step would pick them again anyway)
+ *
+ * stops early at code that needs the general step; returns the cycles
+ * left, and leaves *pc and *mask at the lanes that still have them
+ */
+static uint32_t run_together(Chip8Lockstep *lockstep, Group *g, int *pc,
+                             int below, LaneWords *mask, uint32_t cycles) {
+  while (cycles && *pc >= 0 && *pc < below) {
+    uint16_t addr = *pc;
+    if ((addr & 1) || addr >= MEMORY_SIZE - 1 || written(lockstep, addr)) {
+      break;
+    }
+    Chip8Instruction *ins = &lockstep->decode_cache[addr >> 1];
+    if (!ins->length) {
+      chip8_decode(lockstep->quirks, image_opcode(lockstep, addr), ins);
+    }
+    if (ins->op == OP_FX07) {
+      // may be a delay timer poll (see step)
+      break;
+    }
+
+    LaneWords idle = {0};
+    *pc = execute(lockstep, g, addr, ins, *mask, &idle);
+    cycles--;
+    if (ins->op == OP_1NNN || ins->op == OP_FX0A || opcode_is_draw(ins->op)) {
+      *mask &= ~idle;
+      if (!any_lane(*mask)) {
+        return 0;
+      }
+    }
+  }
+  return cycles;
+}
+
+static void run_group(Chip8Lockstep *lockstep, Group *g, uint32_t cycles) {
+  // lanes waiting for a key consume all of their cycles
+  LaneCounts remaining =
+      count_mask(g->live & ~word_mask((ByteMask)g->FX0A_waiting)) & cycles;
+  LaneWords mask = {0};
+  int pc = -1;
+  int above = 0;
+
+  for (;;) {
+    if (pc < 0 || !any_lane(mask)) {
+      LaneWords active = count_to_word_mask(remaining != 0);
+      if (!any_lane(active)) {
+        return;
+      }
+      pc = lowest_pc(g, active, &above);
+      mask = active & (LaneWords)(g->PC == (uint16_t)pc);
+    }
+
+    int first = 0;
+    while (!mask[first]) {
+      first++;
+    }
+    uint32_t left = remaining[first];
+    if (!any_lane(count_to_word_mask(remaining != left) & mask)) {
+      LaneCounts stepped = count_mask(mask);
+      left = run_together(lockstep, g, &pc, above, &mask, left);
+      remaining = (remaining & ~stepped) | (count_mask(mask) & left);
+      if (pc < 0 || pc >= above || !left) {
+        pc = -1;
+        continue;
+      }
+    }
+
+    int next = step(lockstep, g, pc, &mask, &remaining);
+    // once past (or at) the next lowest lanes, the step after this one
+    // is for whichever lanes are lowest then
+    pc = next < above ? next : -1;
+  }
+}
+
+/**
+ * LOCKSTEP API
+ */
+
+/**
+ * create the given number of lanes, each a copy of the prototype (which
+ * normally has just been initialized and had its rom loaded); the
+ * quirks of the prototype apply to all lanes
+ *
+ * returns NULL if out of memory
+ */
+Chip8Lockstep *chip8_lockstep_create(const Chip8 *prototype, uint32_t lanes) {
+  Chip8Lockstep *lockstep = calloc(1, sizeof(Chip8Lockstep));
+  if (!lockstep) {
+    return NULL;
+  }
+  lockstep->lanes = lanes;
+  lockstep->groups = (lanes + LOCKSTEP_WIDTH - 1) / LOCKSTEP_WIDTH;
+  lockstep->quirks = prototype->quirks;
+  memcpy(lockstep->image, prototype->memory, MEMORY_SIZE);
+  lockstep->rom_hash = prototype->rom_hash;
+
+  size_t size = lockstep->groups * sizeof(Group);
+  lockstep->group = aligned_alloc(_Alignof(Group), size ? size : sizeof(Group));
+  if (!lockstep->group) {
+    free(lockstep);
+    return NULL;
+  }
+  memset(lockstep->group, 0, size);
+
+  for (uint32_t lane = 0; lane < lanes; lane++) {
+    int slot;
+    Group *g = lane_group(lockstep, lane, &slot);
+    g->live[slot] = UINT16_MAX;
+    chip8_lockstep_write_lane(lockstep, lane, prototype);
+  }
+  return lockstep;
+}
+
+void chip8_lockstep_destroy(Chip8Lockstep *lockstep) {
+  if (lockstep) {
+    free(lockstep->group);
+    free(lockstep);
+  }
+}
+
+uint32_t chip8_lockstep_lanes(const Chip8Lockstep *lockstep) {
+  return lockstep->lanes;
+}
+
+/**
+ * seed a lane's random number generator (see chip8_seed)
+ */
+void chip8_lockstep_seed(Chip8Lockstep *lockstep, uint32_t lane,
+                         uint64_t seed) {
+  int slot;
+  Group *g = lane_group(lockstep, lane, &slot);
+  g->rng_state[slot] = scramble_seed(seed);
+}
+
+/**
+ * handle a key event for one lane (see chip8_key_event)
+ */
+void chip8_lockstep_key_event(Chip8Lockstep *lockstep, uint32_t lane,
+                              uint8_t key, Chip8EventType type) {
+  int slot;
+  Group *g = lane_group(lockstep, lane, &slot);
+  if (type == CHIP8_KEY_DOWN) {
+    g->keypad[slot] |= 1u << key;
+    if (g->FX0A_waiting[slot]) {
+      g->FX0A_key[slot] = key;
+    }
+  } else {
+    g->keypad[slot] &= ~(1u << key);
+    if (g->FX0A_key[slot] == key) {
+      g->V[g->FX0A_reg[slot]][slot] = key;
+      g->FX0A_key[slot] = UINT8_MAX;
+      g->FX0A_waiting[slot] = 0;
+      g->PC[slot] += 2;
+    }
+  }
+}
+
+/**
+ * execute exactly the given number of cycles in every lane, without any
+ * timing (see chip8_run_cycles)
+ */
+void chip8_lockstep_run_cycles(Chip8Lockstep *lockstep, uint32_t cycles) {
+  for (uint32_t i = 0; i < lockstep->groups; i++) {
+    run_group(lockstep, &lockstep->group[i], cycles);
+  }
+}
+
+/**
+ * end the current frame in every lane (see chip8_frame_tick)
+ */
+void chip8_lockstep_frame_tick(Chip8Lockstep *lockstep) {
+  for (uint32_t i = 0; i < lockstep->groups; i++) {
+    Group *g = &lockstep->group[i];
+    // adding all ones subtracts one
+    g->delay_timer += (LaneBytes)(g->delay_timer != 0);
+    g->sound_timer += (LaneBytes)(g->sound_timer != 0);
+    g->draw_permitted = ~(LaneBytes){0};
+  }
+}
+
+/**
+ * copy the state of a lane into an initialized chip, e.g. to inspect it
+ * or to continue running it on its own; the chip's decode cache (and
+ * translations, with the JIT engine) are flushed
+ */
+void chip8_lockstep_read_lane(const Chip8Lockstep *lockstep, uint32_t lane,
+                              Chip8 *chip) {
+  int slot;
+  const Group *g = lane_group(lockstep, lane, &slot);
+  for (int i = 0; i < NUM_REGISTERS; i++) {
+    chip->V[i] = g->V[i][slot];
+  }
+  chip->I = g->I[slot];
+  chip->PC = g->PC[slot];
+  chip->delay_timer = g->delay_timer[slot];
+  chip->sound_timer = g->sound_timer[slot];
+  for (int key = 0; key < KEYPAD_SIZE; key++) {
+    chip->keypad[key] = g->keypad[slot] >> key & 1;
+  }
+  chip->SP = g->SP[slot];
+  for (int i = 0; i < STACK_SIZE; i++) {
+    chip->stack[i] = g->stack[i][slot];
+  }
+  chip->draw_permitted = g->draw_permitted[slot];
+  chip->FX0A_waiting = g->FX0A_waiting[slot];
+  chip->FX0A_key = g->FX0A_key[slot];
+  chip->FX0A_reg = g->FX0A_reg[slot];
+  chip->rng_state = g->rng_state[slot];
+  chip->quirks = lockstep->quirks;
+  memcpy(chip->display, g->display[slot], sizeof(chip->display));
+  chip->draw_flag = true;
+
+  memcpy(chip->memory, g->memory[slot], MEMORY_SIZE);
+  memset(chip->decode_cache, 0, sizeof(chip->decode_cache));
+  memcpy(chip->code_written, lockstep->code_written,
+         sizeof(chip->code_written));
+  chip->rom_hash = lockstep->rom_hash;
+  if (chip->jit) {
+    chip8_jit_invalidate(chip->jit, 0, MEMORY_SIZE);
+  }
+}
+
+/**
+ * replace the state of a lane with that of a chip running the same rom
+ * (quirks and settings of the chip are ignored)
+ */
+void chip8_lockstep_write_lane(Chip8Lockstep *lockstep, uint32_t lane,
+                               const Chip8 *chip) {
+  int slot;
+  Group *g = lane_group(lockstep, lane, &slot);
+  for (int i = 0; i < NUM_REGISTERS; i++) {
+    g->V[i][slot] = chip->V[i];
+  }
+  g->I[slot] = chip->I;
+  g->PC[slot] = chip->PC;
+  g->delay_timer[slot] = chip->delay_timer;
+  g->sound_timer[slot] = chip->sound_timer;
+  g->keypad[slot] = 0;
+  for (int key = 0; key < KEYPAD_SIZE; key++) {
+    g->keypad[slot] |= (chip->keypad[key] != 0) << key;
+  }
+  g->SP[slot] = chip->SP;
+  for (int i = 0; i < STACK_SIZE; i++) {
+    g->stack[i][slot] = chip->stack[i];
+  }
+  g->draw_permitted[slot] = chip->draw_permitted ? UINT8_MAX : 0;
+  g->FX0A_waiting[slot] = chip->FX0A_waiting ? UINT8_MAX : 0;
+  g->FX0A_key[slot] = chip->FX0A_key;
+  g->FX0A_reg[slot] = chip->FX0A_reg;
+  g->rng_state[slot] = chip->rng_state;
+  memcpy(g->display[slot], chip->display, sizeof(g->display[slot]));
+
+  memcpy(g->memory[slot], chip->memory, MEMORY_SIZE);
+  for (uint16_t addr = 0; addr < MEMORY_SIZE; addr++) {
+    if (chip->memory[addr] != lockstep->image[addr]) {
+      mark_written(lockstep, addr, 1);
+    }
+  }
+}
+
+/**
+ * a lane's display, in the packed layout of Chip8.display
+ */
+const uint64_t *chip8_lockstep_display(const Chip8Lockstep *lockstep,
+                                       uint32_t lane) {
+  int slot;
+  const Group *g = lane_group(lockstep, lane, &slot);
+  return g->display[slot];
+}
+
+bool chip8_lockstep_pixel(const Chip8Lockstep *lockstep, uint32_t lane, int x,
+                          int y) {
+  return chip8_lockstep_display(lockstep, lane)[y] >>
+             (DISPLAY_WIDTH - 1 - x) &
+         1;
+}
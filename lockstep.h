@@ -0,0 +1,46 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+// instances executed together by one vector instruction
+#define LOCKSTEP_WIDTH 32
+
+/**
+ * any number of instances (lanes) of one rom, run in lockstep (see
+ * lockstep.c)
+ */
+typedef struct Chip8Lockstep Chip8Lockstep;
+
+Chip8Lockstep *chip8_lockstep_create(const Chip8 *prototype, uint32_t lanes);
+
+void chip8_lockstep_destroy(Chip8Lockstep *lockstep);
+
+uint32_t chip8_lockstep_lanes(const Chip8Lockstep *lockstep);
+
+void chip8_lockstep_seed(Chip8Lockstep *lockstep, uint32_t lane,
+                         uint64_t seed);
+
+void chip8_lockstep_key_event(Chip8Lockstep *lockstep, uint32_t lane,
+                              uint8_t key, Chip8EventType type);
+
+void chip8_lockstep_run_cycles(Chip8Lockstep *lockstep, uint32_t cycles);
+
+void chip8_lockstep_frame_tick(Chip8Lockstep *lockstep);
+
+void chip8_lockstep_read_lane(const Chip8Lockstep *lockstep, uint32_t lane,
+                              Chip8 *chip);
+
+void chip8_lockstep_write_lane(Chip8Lockstep *lockstep, uint32_t lane,
+                               const Chip8 *chip);
+
+const uint64_t *chip8_lockstep_display(const Chip8Lockstep *lockstep,
+                                       uint32_t lane);
+
+bool chip8_lockstep_pixel(const Chip8Lockstep *lockstep, uint32_t lane, int x,
+                          int y);
+
+#endif
@@ -0,0 +1,371 @@
+#define _DEFAULT_SOURCE
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "chip8.h"
+#include "netplay.h"
+
+/**
+ * netplay loopback harness
+ *
+ * runs a rom as a two player netplay session (see netplay.c) between two
+ * child processes talking UDP over localhost, each through the latency
+ * and loss shim, with scripted input: every frame each player toggles
+ * one of its keys (0 - 7 for the first, 8 - F for the second) with the
+ * given probability
+ *
+ * both players run in real time at 60 frames per second; once both
+ * reach the frame budget their final states are compared with each
+ * other and with a reference run of the same input without netplay, and
+ * the rollback statistics of both are printed
+ *
+ * a session over an ideal network (no latency, jitter or loss, where
+ * the other peer's input usually arrives ahead of the frame it is for)
+ * is played first, then one under the given conditions on the next two
+ * ports
+ *
+ * exits with status 0 only if all states match and no desync was
+ * detected along the way
+ */
+
+#define FRAMES_PER_SECOND 60.0
+#define NS_PER_SECOND 1000000000ull
+#define CONNECT_TIMEOUT_MS 5000
+#define SYNC_TIMEOUT_MS 5000
+// longest a player waits for the other without running a frame
+#define STALL_TIMEOUT_NS (5 * NS_PER_SECOND)
+
+typedef struct Options {
+  const char *rom_path;
+  const Chip8Quirks *quirks;
+  double clock_speed;
+  uint64_t seed;
+  uint32_t frames;
+  double key_rate;
+  uint16_t port;
+  Chip8NetplayConfig config;
+} Options;
+
+/**
+ * what a player reports back to the harness
+ */
+typedef struct Result {
+  int err;
+  uint64_t hash;
+  Chip8NetplayStats stats;
+} Result;
+
+/**
+ * keys held by a player in each frame
+ */
+static uint16_t *make_script(const Options *options, int player) {
+  uint16_t *script = malloc(options->frames * sizeof(uint16_t));
+  if (!script) {
+    perror("Failed to allocate input script");
+    return NULL;
+  }
+  uint64_t rng = 0x9E3779B97F4A7C15ULL * (player + 1);
+  uint16_t keys = 0;
+  for (uint32_t frame = 0; frame < options->frames; frame++) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    if ((rng >> 11) * 0x1.0p-53 < options->key_rate) {
+      keys ^= 1u << (player * 8 + (rng & 7));
+    }
+    script[frame] = keys;
+  }
+  return script;
+}
+
+static int init_chip(Chip8 *chip, const Options *options) {
+  chip8_init(chip, options->clock_speed, false, options->quirks);
+  chip8_seed(chip, options->seed);
+  if (chip8_load_rom(chip, options->rom_path)) {
+    chip8_destroy(chip);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * body of a player process
+ */
+static Result play(const Options *options, int player) {
+  Result result = {.err = 1};
+  uint16_t *script = make_script(options, player);
+  if (!script) {
+    return result;
+  }
+  Chip8 chip;
+  if (init_chip(&chip, options)) {
+    free(script);
+    return result;
+  }
+
+  Chip8NetplayConfig config = options->config;
+  config.local_port = options->port + player;
+  config.remote_port = options->port + 1 - player;
+  Chip8Netplay *netplay = chip8_netplay_create(&chip, &config);
+  if (!netplay || chip8_netplay_connect(netplay, CONNECT_TIMEOUT_MS)) {
+    chip8_netplay_destroy(netplay);
+    chip8_destroy(&chip);
+    free(script);
+    return result;
+  }
+
+  uint64_t start = chip8_time_ns();
+  uint64_t progress = start;
+  result.err = 0;
+  for (uint64_t tick = 1; chip8_netplay_frame(netplay) < options->frames;
+       tick++) {
+    uint64_t frame = chip8_netplay_frame(netplay);
+    if (chip8_netplay_advance(netplay, script[frame]) == 0) {
+      progress = chip8_time_ns();
+    } else if (chip8_time_ns() - progress > STALL_TIMEOUT_NS) {
+      fprintf(stderr, "Player %d: the other player stopped\n", player);
+      result.err = 1;
+      break;
+    }
+    chip8_netplay_poll(netplay,
+                       start + tick * NS_PER_SECOND / FRAMES_PER_SECOND);
+  }
+  if (!result.err) {
+    result.err = chip8_netplay_sync(netplay, SYNC_TIMEOUT_MS);
+  }
+
+  result.hash = chip8_state_hash(&chip);
+  result.stats = *chip8_netplay_stats(netplay);
+  chip8_netplay_destroy(netplay);
+  chip8_destroy(&chip);
+  free(script);
+  return result;
+}
+
+/**
+ * run both players' input without netplay, the way netplay applies it
+ * (local input input_delay frames late, keys pressed and released in
+ * key order, instruction count derived from the frame number)
+ */
+static int reference(const Options *options, uint64_t *hash) {
+  uint16_t *scripts[2] = {make_script(options, 0), make_script(options, 1)};
+  Chip8 chip;
+  if (!scripts[0] || !scripts[1] || init_chip(&chip, options)) {
+    free(scripts[0]);
+    free(scripts[1]);
+    return 1;
+  }
+
+  uint32_t delay = options->config.input_delay;
+  for (uint32_t frame = 0; frame < options->frames; frame++) {
+    uint16_t keys = 0;
+    if (frame >= delay) {
+      keys = scripts[0][frame - delay] | scripts[1][frame - delay];
+    }
+    for (uint8_t key = 0; key < KEYPAD_SIZE; key++) {
+      bool down = keys >> key & 1;
+      if (chip.keypad[key] != down) {
+        chip8_key_event(&chip, key, down ? CHIP8_KEY_DOWN : CHIP8_KEY_UP);
+      }
+    }
+    uint64_t end = (uint64_t)((frame + 1.0) * options->clock_speed /
+                              FRAMES_PER_SECOND);
+    if (end > chip.cycles) {
+      chip8_run_cycles(&chip, end - chip.cycles);
+    }
+    chip8_frame_tick(&chip);
+  }
+
+  *hash = chip8_state_hash(&chip);
+  chip8_destroy(&chip);
+  free(scripts[0]);
+  free(scripts[1]);
+  return 0;
+}
+
+static void print_result(int player, const Result *result) {
+  const Chip8NetplayStats *stats = &result->stats;
+  printf("player %d: frames=%" PRIu64 " stalls=%" PRIu64
+         " time_syncs=%" PRIu64 " rollbacks=%" PRIu64
+         " resimulated=%" PRIu64 " max_rollback=%" PRIu32
+         " desyncs=%" PRIu64 "\n",
+         player, stats->frames, stats->stalls, stats->time_syncs,
+         stats->rollbacks, stats->frames_resimulated, stats->max_rollback,
+         stats->desyncs);
+  printf("  packets sent=%" PRIu64 " lost=%" PRIu64 " received=%" PRIu64
+         " hash=%016" PRIx64 "\n",
+         stats->packets_sent, stats->packets_lost, stats->packets_received,
+         result->hash);
+  if (stats->frames_resimulated) {
+    double ns = (double)stats->resimulate_ns / stats->frames_resimulated;
+    printf("  resimulation: %.0f frames/s, %.2f us per frame, longest "
+           "rollback %.1f us of a %.0f us frame\n",
+           1e9 / ns, ns / 1e3, stats->max_resimulate_ns / 1e3,
+           1e6 / FRAMES_PER_SECOND);
+  }
+}
+
+static int parse_options(int argc, char *argv[], Options *options) {
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (arg[0] != '-') {
+      if (options->rom_path) {
+        fprintf(stderr, "Unknown extra argument: %s\n", arg);
+        return 1;
+      }
+      options->rom_path = arg;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      fprintf(stderr, "Missing value for %s\n", arg);
+      return 1;
+    }
+    const char *value = argv[++i];
+    if (strcmp(arg, "--frames") == 0) {
+      options->frames = strtoul(value, NULL, 10);
+    } else if (strcmp(arg, "--latency") == 0) {
+      options->config.latency_ms = atof(value);
+    } else if (strcmp(arg, "--jitter") == 0) {
+      options->config.jitter_ms = atof(value);
+    } else if (strcmp(arg, "--loss") == 0) {
+      options->config.loss = atof(value);
+    } else if (strcmp(arg, "--input-delay") == 0) {
+      options->config.input_delay = strtoul(value, NULL, 10);
+    } else if (strcmp(arg, "--max-rollback") == 0) {
+      options->config.max_rollback = strtoul(value, NULL, 10);
+    } else if (strcmp(arg, "--key-rate") == 0) {
+      options->key_rate = atof(value);
+    } else if (strcmp(arg, "--port") == 0) {
+      options->port = strtoul(value, NULL, 10);
+    } else if (strcmp(arg, "--clock-speed") == 0) {
+      options->clock_speed = atof(value);
+    } else if (strcmp(arg, "--seed") == 0) {
+      options->seed = strtoull(value, NULL, 0);
+    } else if (strcmp(arg, "--profile") == 0) {
+      if (chip8_parse_profile(value, &options->quirks)) {
+        fprintf(stderr, "Unknown profile: %s\n", value);
+        return 1;
+      }
+    } else {
+      fprintf(stderr, "Unknown option: %s\n", arg);
+      return 1;
+    }
+  }
+  if (!options->rom_path || !options->frames || options->port == 0 ||
+      options->port > UINT16_MAX - 3) {
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * play a session between two player processes and compare their final
+ * states with the expected one; returns nonzero on any difference
+ */
+static int run_session(const Options *options, uint64_t expected) {
+  const Chip8NetplayConfig *config = &options->config;
+  printf("network: latency %.1f ms, jitter %.1f ms, loss %.1f%%\n",
+         config->latency_ms, config->jitter_ms, config->loss * 100.0);
+
+  // both players write their result into one pipe; each write is far
+  // below PIPE_BUF, so they do not interleave
+  int results[2];
+  if (pipe(results)) {
+    perror("Failed to create pipe");
+    return 1;
+  }
+  fflush(stdout);
+  pid_t players[2];
+  for (int player = 0; player < 2; player++) {
+    players[player] = fork();
+    if (players[player] < 0) {
+      perror("Failed to start player");
+      return 1;
+    }
+    if (players[player] == 0) {
+      close(results[0]);
+      struct {
+        int player;
+        Result result;
+      } message = {player, play(options, player)};
+      ssize_t written = write(results[1], &message, sizeof(message));
+      _exit(written != sizeof(message));
+    }
+  }
+  close(results[1]);
+
+  Result player_results[2] = {{.err = 1}, {.err = 1}};
+  struct {
+    int player;
+    Result result;
+  } message;
+  while (read(results[0], &message, sizeof(message)) == sizeof(message)) {
+    player_results[message.player & 1] = message.result;
+  }
+  close(results[0]);
+  for (int player = 0; player < 2; player++) {
+    waitpid(players[player], NULL, 0);
+  }
+
+  int err = 0;
+  for (int player = 0; player < 2; player++) {
+    const Result *result = &player_results[player];
+    if (result->err) {
+      fprintf(stderr, "Player %d failed\n", player);
+      err = 1;
+      continue;
+    }
+    print_result(player, result);
+    if (result->hash != expected || result->stats.desyncs) {
+      err = 1;
+    }
+  }
+  printf("reference hash=%016" PRIx64 ": %s\n", expected,
+         err ? "MISMATCH" : "match");
+  return err;
+}
+
+int main(int argc, char *argv[]) {
+  Options options = {
+      .quirks = &chip8_quirks_vip,
+      .clock_speed = 6000.0,
+      .seed = 1,
+      .frames = 600,
+      .key_rate = 0.1,
+      .port = 7700,
+  };
+  chip8_netplay_config_init(&options.config);
+  options.config.latency_ms = 40.0;
+  options.config.jitter_ms = 20.0;
+  options.config.loss = 0.05;
+  if (parse_options(argc, argv, &options)) {
+    fprintf(stderr,
+            "Usage: %s <rom_file> [--frames N] [--latency ms] [--jitter ms] "
+            "[--loss fraction] [--input-delay frames] "
+            "[--max-rollback frames] [--key-rate probability] [--port P] "
+            "[--clock-speed Hz] [--seed N] [--profile vip|schip|xo-chip]\n",
+            argv[0]);
+    return 1;
+  }
+
+  uint64_t expected;
+  if (reference(&options, &expected)) {
+    return 1;
+  }
+
+  Options ideal = options;
+  ideal.config.latency_ms = 0.0;
+  ideal.config.jitter_ms = 0.0;
+  ideal.config.loss = 0.0;
+  int err = run_session(&ideal, expected);
+  options.port += 2;
+  err |= run_session(&options, expected);
+  return err;
+}
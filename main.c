@@ -3,29 +3,78 @@
 #include <SDL.h>
 
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "chip8.h"
+#include "handoff.h"
+#include "netplay.h"
+#include "profile.h"
+#include "replay.h"
+#include "rewind.h"
+#include "trace.h"
 
 #define SCALE 10
 #define SCREEN_WIDTH (DISPLAY_WIDTH * SCALE)
 #define SCREEN_HEIGHT (DISPLAY_HEIGHT * SCALE)
 
+#define PIXEL_ON 0xFFFFFFFF
+#define PIXEL_OFF 0xFF000000
+
+// speed multiplier range reachable with the speed hotkeys; doubling
+// past the maximum switches to unlimited
+#define MIN_SPEED 0.25
+#define MAX_SPEED 64.0
+
+// longest the main thread blocks waiting for input before checking for
+// a new frame
+#define EVENT_WAIT_MS 2
+
+#define FRAMES_PER_SECOND 60
+#define NS_PER_SECOND 1000000000ull
+#define NETPLAY_CONNECT_TIMEOUT_MS 30000
+
 /**
- * the emulator instance
+ * presentation state, owned by the main thread
  */
-Chip8 chip;
+typedef struct Frontend {
+  SDL_Renderer *renderer;
+  // display sized streaming texture, scaled to the window when copied
+  SDL_Texture *texture;
+  // display contents last uploaded into the texture
+  uint64_t presented_display[DISPLAY_HEIGHT];
+  uint64_t presented_hash;
+  bool presented;
+} Frontend;
 
 /**
- * original chip8 quirks flags
+ * state shared between the emulation thread and the main thread; after
+ * the emulation thread starts, the chip is only touched by it and
+ * everything else goes through the lock-free handoffs
  */
-Chip8Quirks quirks = {.logic_resets_vf = true,
-                      .load_store_increment_i = true,
-                      .draw_waits_for_vblank = true,
-                      .clip_sprites = true,
-                      .shift_uses_vx = false,
-                      .jump_uses_vx = false};
+typedef struct Shared {
+  Chip8 *chip;
+  Chip8RunOptions run_options;
+  // frames from the emulation thread to the main thread
+  Chip8TripleBuffer frames;
+  // key events from the main thread to the emulation thread, posted
+  // to wake it while it waits idle
+  Chip8KeyQueue keys;
+  SDL_sem *input;
+  atomic_bool quit;
+  // speed multiplier for virtual pacing, set by the main thread
+  _Atomic double speed;
+  // rewind direction while a rewind hotkey is held, set by the main
+  // thread (see Chip8RunOptions.rewind_direction)
+  atomic_int rewind_direction;
+  // set for a netplay session, which the emulation thread runs instead
+  // of the run loop
+  Chip8Netplay *netplay;
+} Shared;
 
 void renderer_init(SDL_Renderer *renderer) {
   SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
@@ -33,24 +82,64 @@ void renderer_init(SDL_Renderer *renderer) {
   SDL_RenderPresent(renderer);
 }
 
-void render_display(void *userdata) {
-  SDL_Renderer *renderer = (SDL_Renderer *)userdata;
-
-  // clear screen before redrawing
-  SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-  SDL_RenderClear(renderer);
-
-  SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+/**
+ * upload the rows that changed since the last presented frame into the
+ * texture and present it; the cost is one texture copy regardless of
+ * how many pixels are lit
+ *
+ * frames the main thread was too slow to take never reach it, so the
+ * changed rows are found by comparing against what was uploaded last
+ */
+void render_frame(Frontend *frontend, const Chip8Frame *frame) {
+  // draws that cancelled out leave the texture up to date
+  if (frontend->presented && frame->hash == frontend->presented_hash) {
+    return;
+  }
 
+  uint32_t dirty = 0;
   for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+    if (!frontend->presented ||
+        frame->display[y] != frontend->presented_display[y]) {
+      dirty |= 1u << y;
+    }
+  }
+  if (dirty == 0) {
+    return;
+  }
+
+  // lock the band of rows from the first to the last dirty one
+  int first = __builtin_ctz(dirty);
+  int last = 31 - __builtin_clz(dirty);
+  SDL_Rect band = {0, first, DISPLAY_WIDTH, last - first + 1};
+  void *pixels;
+  int pitch;
+  if (SDL_LockTexture(frontend->texture, &band, &pixels, &pitch) != 0) {
+    printf("Texture could not be locked! SDL_Error: %s\n", SDL_GetError());
+    return;
+  }
+  for (int y = first; y <= last; y++) {
+    uint32_t *row = (uint32_t *)((uint8_t *)pixels + (y - first) * pitch);
     for (int x = 0; x < DISPLAY_WIDTH; x++) {
-      if (chip.display[y * DISPLAY_WIDTH + x]) {
-        SDL_Rect rect = {x * SCALE, y * SCALE, SCALE, SCALE};
-        SDL_RenderFillRect(renderer, &rect);
-      }
+      row[x] = chip8_frame_pixel(frame, x, y) ? PIXEL_ON : PIXEL_OFF;
     }
   }
-  SDL_RenderPresent(renderer);
+  SDL_UnlockTexture(frontend->texture);
+
+  SDL_RenderCopy(frontend->renderer, frontend->texture, NULL, NULL);
+  SDL_RenderPresent(frontend->renderer);
+  memcpy(frontend->presented_display, frame->display,
+         sizeof(frontend->presented_display));
+  frontend->presented_hash = frame->hash;
+  frontend->presented = true;
+}
+
+/**
+ * draw callback of the emulation thread: hand the frame over without
+ * waiting for the main thread
+ */
+void publish_frame(void *userdata) {
+  Shared *shared = (Shared *)userdata;
+  chip8_triple_buffer_publish(&shared->frames, shared->chip);
 }
 
 /**
@@ -64,89 +153,246 @@ void render_display(void *userdata) {
  * scancodes are used instead of keycodes so that the mapping
  * will work the same under QWERTY, AZERTY, or other layouts
  */
-void handle_key_events(SDL_Event e, Chip8 *chip) {
+void handle_key_events(SDL_Event e, Chip8KeyQueue *keys) {
   Chip8EventType dir = e.type == SDL_KEYDOWN ? CHIP8_KEY_DOWN : CHIP8_KEY_UP;
   switch (e.key.keysym.scancode) {
   case SDL_SCANCODE_1:
-    chip8_key_event(chip, 0x1, dir);
+    chip8_key_queue_push(keys, 0x1, dir);
     break;
   case SDL_SCANCODE_2:
-    chip8_key_event(chip, 0x2, dir);
+    chip8_key_queue_push(keys, 0x2, dir);
     break;
   case SDL_SCANCODE_3:
-    chip8_key_event(chip, 0x3, dir);
+    chip8_key_queue_push(keys, 0x3, dir);
     break;
   case SDL_SCANCODE_4:
-    chip8_key_event(chip, 0xC, dir);
+    chip8_key_queue_push(keys, 0xC, dir);
     break;
 
   case SDL_SCANCODE_Q:
-    chip8_key_event(chip, 0x4, dir);
+    chip8_key_queue_push(keys, 0x4, dir);
     break;
   case SDL_SCANCODE_W:
-    chip8_key_event(chip, 0x5, dir);
+    chip8_key_queue_push(keys, 0x5, dir);
     break;
   case SDL_SCANCODE_E:
-    chip8_key_event(chip, 0x6, dir);
+    chip8_key_queue_push(keys, 0x6, dir);
     break;
   case SDL_SCANCODE_R:
-    chip8_key_event(chip, 0xD, dir);
+    chip8_key_queue_push(keys, 0xD, dir);
     break;
 
   case SDL_SCANCODE_A:
-    chip8_key_event(chip, 0x7, dir);
+    chip8_key_queue_push(keys, 0x7, dir);
     break;
   case SDL_SCANCODE_S:
-    chip8_key_event(chip, 0x8, dir);
+    chip8_key_queue_push(keys, 0x8, dir);
     break;
   case SDL_SCANCODE_D:
-    chip8_key_event(chip, 0x9, dir);
+    chip8_key_queue_push(keys, 0x9, dir);
     break;
   case SDL_SCANCODE_F:
-    chip8_key_event(chip, 0xE, dir);
+    chip8_key_queue_push(keys, 0xE, dir);
     break;
 
   case SDL_SCANCODE_Z:
-    chip8_key_event(chip, 0xA, dir);
+    chip8_key_queue_push(keys, 0xA, dir);
     break;
   case SDL_SCANCODE_X:
-    chip8_key_event(chip, 0x0, dir);
+    chip8_key_queue_push(keys, 0x0, dir);
     break;
   case SDL_SCANCODE_C:
-    chip8_key_event(chip, 0xB, dir);
+    chip8_key_queue_push(keys, 0xB, dir);
     break;
   case SDL_SCANCODE_V:
-    chip8_key_event(chip, 0xF, dir);
+    chip8_key_queue_push(keys, 0xF, dir);
     break;
 
   default:; // noop
   }
 }
 
-bool handle_sdl_events(Chip8 *chip) {
+/**
+ * event callback of the emulation thread: apply the key events queued
+ * by the main thread
+ */
+bool apply_key_events(Chip8 *chip, void *userdata) {
+  Shared *shared = (Shared *)userdata;
+  Chip8KeyEvent event;
+  while (chip8_key_queue_pop(&shared->keys, &event)) {
+    chip8_key_event(chip, event.key, event.type);
+  }
+  shared->run_options.speed =
+      atomic_load_explicit(&shared->speed, memory_order_relaxed);
+  shared->run_options.rewind_direction =
+      atomic_load_explicit(&shared->rewind_direction, memory_order_relaxed);
+  return !atomic_load_explicit(&shared->quit, memory_order_relaxed);
+}
+
+/**
+ * idle wait of the emulation thread: block until the main thread posts
+ * input (or quit) or the timeout passes
+ *
+ * every key event is posted but the emulation thread only waits here
+ * while idle, so the posts for events it has already handled are
+ * dropped first; the timeout is rounded up to whole milliseconds so a
+ * short wait still blocks instead of polling
+ */
+bool wait_for_input(void *userdata, uint64_t timeout_ns) {
+  Shared *shared = (Shared *)userdata;
+  while (SDL_SemTryWait(shared->input) == 0) {
+  }
+  return SDL_SemWaitTimeout(shared->input,
+                            (timeout_ns + 999999) / 1000000) == 0;
+}
+
+/**
+ * speed hotkeys for virtual pacing: = doubles the speed, - halves it and
+ * tab toggles between unlimited and real time
+ */
+void handle_speed_keys(SDL_Event e, Shared *shared) {
+  double speed = atomic_load_explicit(&shared->speed, memory_order_relaxed);
+  switch (e.key.keysym.scancode) {
+  case SDL_SCANCODE_EQUALS:
+    if (speed > 0.0) {
+      speed *= 2.0;
+    }
+    break;
+  case SDL_SCANCODE_MINUS:
+    speed = speed > 0.0 ? speed / 2.0 : MAX_SPEED;
+    break;
+  case SDL_SCANCODE_TAB:
+    speed = speed > 0.0 ? 0.0 : 1.0;
+    break;
+  default:
+    return;
+  }
+  if (speed > MAX_SPEED) {
+    speed = 0.0;
+  } else if (speed > 0.0 && speed < MIN_SPEED) {
+    speed = MIN_SPEED;
+  }
+  atomic_store_explicit(&shared->speed, speed, memory_order_relaxed);
+  if (speed > 0.0) {
+    printf("Speed: %gx\n", speed);
+  } else {
+    printf("Speed: unlimited\n");
+  }
+}
+
+/**
+ * rewind hotkeys: while [ is held the game runs backwards through the
+ * recorded frames, while ] is held it replays them forwards; playing on
+ * from an earlier frame discards the frames after it
+ */
+void handle_rewind_keys(SDL_Event e, Shared *shared) {
+  int direction;
+  switch (e.key.keysym.scancode) {
+  case SDL_SCANCODE_LEFTBRACKET:
+    direction = -1;
+    break;
+  case SDL_SCANCODE_RIGHTBRACKET:
+    direction = 1;
+    break;
+  default:
+    return;
+  }
+  atomic_store_explicit(&shared->rewind_direction,
+                        e.type == SDL_KEYDOWN ? direction : 0,
+                        memory_order_relaxed);
+}
+
+/**
+ * poll SDL events on the main thread, forwarding keys to the emulation
+ * thread; returns false once the window is closed
+ */
+bool handle_sdl_events(Shared *shared, int timeout_ms) {
   SDL_Event e;
-  while (SDL_PollEvent(&e)) {
+  // block briefly for the first event so an idle main thread does not
+  // spin, then drain whatever else is pending
+  if (!SDL_WaitEventTimeout(&e, timeout_ms)) {
+    return true;
+  }
+  do {
     if (e.type == SDL_QUIT) {
       return false;
     }
     if (e.type == SDL_KEYUP || e.type == SDL_KEYDOWN) {
-      handle_key_events(e, chip);
+      handle_key_events(e, &shared->keys);
+      SDL_SemPost(shared->input);
+      if (e.type == SDL_KEYDOWN) {
+        handle_speed_keys(e, shared);
+      }
+      handle_rewind_keys(e, shared);
     }
-  }
+  } while (SDL_PollEvent(&e));
   return true;
 }
 
-void handle_sigint(int sig) {
-  printf("\nInterrupt signal %i detected. Exiting...\n", sig);
-  exit(0);
+/**
+ * emulation thread of a netplay session: one frame every 1/60 s with the
+ * keys held locally, serving the network in between
+ */
+void emulate_netplay(Shared *shared) {
+  uint16_t keys = 0;
+  uint64_t deadline = chip8_time_ns();
+  while (!atomic_load_explicit(&shared->quit, memory_order_relaxed)) {
+    Chip8KeyEvent event;
+    while (chip8_key_queue_pop(&shared->keys, &event)) {
+      if (event.type == CHIP8_KEY_DOWN) {
+        keys |= 1u << event.key;
+      } else {
+        keys &= ~(1u << event.key);
+      }
+    }
+    chip8_netplay_advance(shared->netplay, keys);
+    // a rollback may have changed the display as well
+    if (shared->chip->draw_flag) {
+      publish_frame(shared);
+      shared->chip->draw_flag = false;
+    }
+    deadline += NS_PER_SECOND / FRAMES_PER_SECOND;
+    chip8_netplay_poll(shared->netplay, deadline);
+  }
+}
+
+/**
+ * body of the emulation thread
+ */
+int emulate(void *data) {
+  Shared *shared = (Shared *)data;
+  if (shared->netplay) {
+    emulate_netplay(shared);
+    return 0;
+  }
+  chip8_run_with_options(shared->chip, &shared->run_options, publish_frame,
+                         apply_key_events, shared);
+  return 0;
 }
 
-int main(int argc, char *argv[]) {
-  signal(SIGINT, handle_sigint);
+// set on SIGINT; the main loop then shuts down the usual way, so that
+// the profile, trace and recording are complete
+atomic_bool interrupted;
 
+void handle_sigint(__attribute__((unused)) int sig) {
+  atomic_store_explicit(&interrupted, true, memory_order_relaxed);
+}
+
+int main(int argc, char *argv[]) {
   const char *rom_path = NULL;
   bool debug = false;
   double clock_speed = 6000.0;
+  Chip8Engine engine = CHIP8_ENGINE_TABLE;
+  const Chip8Quirks *quirks = &chip8_quirks_vip;
+  Chip8Pacing pacing = CHIP8_PACING_PRECISE;
+  double speed = 0.0;
+  double rewind_mb = 0.0;
+  const char *record_path = NULL;
+  Chip8NetplayConfig netplay_config;
+  chip8_netplay_config_init(&netplay_config);
+  bool netplay = false;
+  const char *trace_path = NULL;
+  const char *hotspots_path = NULL;
 
   for (int i = 1; i < argc; i++) {
     if (strcmp(argv[i], "--debug") == 0) {
@@ -158,6 +404,88 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Missing value for --clock-speed\n");
         return 1;
       }
+    } else if (strcmp(argv[i], "--profile") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "Missing value for --profile\n");
+        return 1;
+      }
+      if (chip8_parse_profile(argv[++i], &quirks)) {
+        fprintf(stderr, "Unknown profile: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--speed") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "Missing value for --speed\n");
+        return 1;
+      }
+      speed = atof(argv[++i]);
+      if (speed < 0.0) {
+        fprintf(stderr, "Invalid speed: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--rewind") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "Missing value for --rewind\n");
+        return 1;
+      }
+      rewind_mb = atof(argv[++i]);
+      if (rewind_mb < 0.0) {
+        fprintf(stderr, "Invalid rewind buffer size: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--record") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "Missing value for --record\n");
+        return 1;
+      }
+      record_path = argv[++i];
+    } else if (strcmp(argv[i], "--hotspots") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "Missing value for --hotspots\n");
+        return 1;
+      }
+      hotspots_path = argv[++i];
+    } else if (strcmp(argv[i], "--trace") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "Missing value for --trace\n");
+        return 1;
+      }
+      trace_path = argv[++i];
+    } else if (strcmp(argv[i], "--netplay") == 0) {
+      if (i + 2 >= argc) {
+        fprintf(stderr, "Missing values for --netplay\n");
+        return 1;
+      }
+      netplay_config.local_port = atoi(argv[++i]);
+      if (chip8_netplay_parse_peer(argv[++i], &netplay_config)) {
+        fprintf(stderr, "Invalid peer address: %s\n", argv[i]);
+        return 1;
+      }
+      netplay = true;
+    } else if (strcmp(argv[i], "--input-delay") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "Missing value for --input-delay\n");
+        return 1;
+      }
+      netplay_config.input_delay = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--pacing") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "Missing value for --pacing\n");
+        return 1;
+      }
+      if (chip8_parse_pacing(argv[++i], &pacing)) {
+        fprintf(stderr, "Unknown pacing: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--engine") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "Missing value for --engine\n");
+        return 1;
+      }
+      if (chip8_parse_engine(argv[++i], &engine)) {
+        fprintf(stderr, "Unknown engine: %s\n", argv[i]);
+        return 1;
+      }
     } else {
       if (rom_path == NULL) {
         rom_path = argv[i];
@@ -169,13 +497,37 @@ int main(int argc, char *argv[]) {
   }
 
   if (!rom_path) {
-    fprintf(stderr, "Usage: %s <rom_file> [--debug] [--clock-speed Hz]\n",
+    fprintf(stderr,
+            "Usage: %s <rom_file> [--debug] [--clock-speed Hz] "
+            "[--engine table|block|jit|threaded] "
+            "[--profile vip|schip|xo-chip] "
+            "[--pacing coarse|precise|virtual] [--speed multiplier] "
+            "[--rewind MB] [--record FILE] "
+            "[--netplay PORT HOST:PORT] [--input-delay frames] "
+            "[--hotspots FILE] [--trace FILE]\n",
             argv[0]);
     return 1;
   }
+  if (debug && !trace_path) {
+    trace_path = CHIP8_TRACE_DEFAULT_PATH;
+  }
+  if (record_path && rewind_mb > 0.0) {
+    // a recording has to be one continuous run
+    fprintf(stderr, "--record cannot be combined with --rewind\n");
+    return 1;
+  }
+  if (netplay && (record_path || rewind_mb > 0.0)) {
+    // both peers have to run the same history
+    fprintf(stderr, "--netplay cannot be combined with --record or "
+                    "--rewind\n");
+    return 1;
+  }
 
   printf("ROM: %s\n", rom_path);
   printf("Debug mode: %s\n", debug ? "ON" : "OFF");
+  if (trace_path) {
+    printf("Trace: %s\n", trace_path);
+  }
   printf("Clock speed: %.1f Hz\n", clock_speed);
 
   if (SDL_Init(SDL_INIT_VIDEO) != 0) {
@@ -202,16 +554,156 @@ int main(int argc, char *argv[]) {
 
   renderer_init(renderer);
 
-  chip8_init(&chip, clock_speed, debug, &quirks);
+  SDL_Texture *texture =
+      SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                        SDL_TEXTUREACCESS_STREAMING, DISPLAY_WIDTH,
+                        DISPLAY_HEIGHT);
+
+  if (!texture) {
+    printf("Texture could not be created! SDL_Error: %s\n", SDL_GetError());
+    return 1;
+  }
+
+  Chip8 chip;
+  chip8_init(&chip, clock_speed, debug, quirks);
+  if (!netplay) {
+    // netplay peers must start alike, so they keep the default seed
+    chip8_seed(&chip, (uint64_t)time(NULL));
+  }
+  if (chip8_set_engine(&chip, engine)) {
+    fprintf(stderr, "Engine not available on this host, using table\n");
+  }
 
   int load_err = chip8_load_rom(&chip, rom_path);
   if (load_err) {
+    chip8_destroy(&chip);
     return load_err;
   }
 
-  chip8_run(&chip, render_display, handle_sdl_events, SDL_GetTicks64, SDL_Delay,
-            renderer);
+  Chip8Recorder *recorder = NULL;
+  if (record_path) {
+    recorder = chip8_recorder_create(record_path, &chip);
+    if (!recorder) {
+      chip8_destroy(&chip);
+      return 1;
+    }
+  }
+
+  Chip8Netplay *session = NULL;
+  if (netplay) {
+    session = chip8_netplay_create(&chip, &netplay_config);
+    printf("Waiting for the other player...\n");
+    if (!session ||
+        chip8_netplay_connect(session, NETPLAY_CONNECT_TIMEOUT_MS)) {
+      chip8_netplay_destroy(session);
+      chip8_destroy(&chip);
+      return 1;
+    }
+  }
+
+  // after netplay, which picks its own engine
+  Chip8Profile *profile = NULL;
+  if (hotspots_path) {
+    profile = chip8_profile_create();
+    if (!profile || chip8_profile_attach(&chip, profile)) {
+      chip8_profile_destroy(profile);
+      chip8_netplay_destroy(session);
+      chip8_recorder_close(recorder);
+      chip8_destroy(&chip);
+      return 1;
+    }
+  }
+  Chip8Trace *trace = NULL;
+  if (trace_path) {
+    trace = chip8_trace_create(trace_path, CHIP8_TRACE_DEFAULT_RECORDS, true);
+    if (!trace || chip8_trace_attach(&chip, trace)) {
+      chip8_trace_destroy(trace);
+      chip8_netplay_destroy(session);
+      chip8_recorder_close(recorder);
+      chip8_destroy(&chip);
+      return 1;
+    }
+  }
+
+  Frontend frontend = {.renderer = renderer, .texture = texture};
+
+  static Shared shared;
+  shared.chip = &chip;
+  shared.netplay = session;
+  chip8_run_options_init(&shared.run_options);
+  shared.run_options.pacing = pacing;
+  shared.run_options.speed = speed;
+  atomic_init(&shared.speed, speed);
+  shared.run_options.current_time = SDL_GetTicks64;
+  shared.run_options.sleep = SDL_Delay;
+  shared.run_options.wait_for_input = wait_for_input;
+  atomic_init(&shared.rewind_direction, 0);
+  if (rewind_mb > 0.0) {
+    shared.run_options.rewind =
+        chip8_rewind_create((size_t)(rewind_mb * 1024 * 1024));
+    if (!shared.run_options.rewind) {
+      chip8_recorder_close(recorder);
+      chip8_destroy(&chip);
+      return 1;
+    }
+  }
+  chip8_triple_buffer_init(&shared.frames);
+  chip8_key_queue_init(&shared.keys);
+  atomic_init(&shared.quit, false);
+  shared.input = SDL_CreateSemaphore(0);
+  if (!shared.input) {
+    printf("Semaphore could not be created! SDL_Error: %s\n", SDL_GetError());
+    chip8_recorder_close(recorder);
+    chip8_rewind_destroy(shared.run_options.rewind);
+    chip8_netplay_destroy(session);
+    chip8_destroy(&chip);
+    return 1;
+  }
+
+  // until now an interrupt has nothing to finish and simply terminates
+  signal(SIGINT, handle_sigint);
+
+  // emulation runs on its own thread so its timing does not depend on
+  // how long presenting takes; SDL rendering and event handling stay on
+  // the main thread, where some platforms require them
+  SDL_Thread *thread = SDL_CreateThread(emulate, "chip8", &shared);
+  if (!thread) {
+    printf("Thread could not be created! SDL_Error: %s\n", SDL_GetError());
+    chip8_recorder_close(recorder);
+    chip8_rewind_destroy(shared.run_options.rewind);
+    chip8_netplay_destroy(session);
+    chip8_destroy(&chip);
+    return 1;
+  }
+
+  while (!atomic_load_explicit(&interrupted, memory_order_relaxed) &&
+         handle_sdl_events(&shared, EVENT_WAIT_MS)) {
+    const Chip8Frame *frame = chip8_triple_buffer_take(&shared.frames);
+    if (frame) {
+      render_frame(&frontend, frame);
+    }
+  }
+
+  atomic_store_explicit(&shared.quit, true, memory_order_relaxed);
+  SDL_SemPost(shared.input);
+  SDL_WaitThread(thread, NULL);
+  SDL_DestroySemaphore(shared.input);
+  if (atomic_load_explicit(&interrupted, memory_order_relaxed)) {
+    printf("\nInterrupted. Exiting...\n");
+  }
+
+  if (profile) {
+    chip8_profile_write(profile, hotspots_path);
+    chip8_profile_destroy(profile);
+  }
+
+  chip8_recorder_close(recorder);
+  chip8_rewind_destroy(shared.run_options.rewind);
+  chip8_netplay_destroy(session);
+  chip8_trace_destroy(trace);
+  chip8_destroy(&chip);
 
+  SDL_DestroyTexture(texture);
   SDL_DestroyRenderer(renderer);
   SDL_DestroyWindow(window);
   SDL_Quit();
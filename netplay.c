@@ -0,0 +1,814 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "chip8.h"
+#include "netplay.h"
+
+/**
+ * ROLLBACK NETPLAY
+ *
+ * both peers run the same rom from the same state, and every frame runs
+ * a fixed number of instructions (see frame_end) with the keys held by
+ * either player; given the same inputs they compute the same states, so
+ * only inputs are exchanged
+ *
+ * a peer does not wait for the other's input of a frame: it predicts
+ * that the other player still holds the keys last received and runs on,
+ * keeping the state at the start of every predicted frame. when the real
+ * input turns out to differ, the chip is restored to the first
+ * mispredicted frame and every frame since is run again with what is
+ * now known, before the next frame is shown
+ *
+ * re-simulating is the cost of a rollback, so it is kept to running the
+ * instructions: frames run with the threaded engine (or table where that
+ * is not available), which executes exactly the instructions asked for
+ * and needs no recompiling after a restore; restoring copies only memory
+ * written since the rom loaded (see chip8_restore); and states are only
+ * kept for frames that are still predicted
+ *
+ * packets (integers little endian) start with "C8NP" and a type byte:
+ *   HELLO  whether the sender has heard from the receiver, and the
+ *          sender's state hash, quirks hash and clock speed, which must
+ *          match
+ *   INPUT  the sender's frame and frame advantage (see time_sync), how
+ *          many of the receiver's inputs it has, the low 32 bits of the
+ *          state hash of its newest checked frame, and every input the
+ *          receiver has not acknowledged
+ * packets may be dropped or reordered; as every INPUT packet repeats all
+ * unacknowledged input, any one arriving is enough
+ */
+
+#define FRAMES_PER_SECOND 60.0
+#define NS_PER_MS 1000000ull
+
+// inputs kept per player; more than can be in flight (see stalled)
+#define INPUT_RING 256
+#define MAX_INPUT_DELAY 16
+#define HEADER_SIZE 5
+#define HELLO_SIZE (HEADER_SIZE + 1 + 3 * 8)
+#define INPUT_HEADER_SIZE (HEADER_SIZE + 6 * 4 + 2)
+#define MAX_PACKET (INPUT_HEADER_SIZE + INPUT_RING * 2)
+#define PACKET_HELLO 1
+#define PACKET_INPUT 2
+
+// every this many frames the state hashes of both peers are compared
+#define HASH_INTERVAL 16
+#define HASH_HISTORY 8
+// frames between holding back a frame to let the other peer catch up
+#define TIME_SYNC_INTERVAL 8
+
+#define SHIM_QUEUE 256
+#define HELLO_INTERVAL_NS (100 * NS_PER_MS)
+#define RESEND_INTERVAL_NS (5 * NS_PER_MS)
+// how long a finished peer keeps answering so the other can finish too
+#define LINGER_NS (200 * NS_PER_MS)
+
+typedef struct Frame {
+  // state at the start of the frame, kept while the frame is predicted
+  Chip8State state;
+  uint64_t cycles;
+  // input of the other player the frame ran with
+  uint16_t remote;
+  // low 32 bits of the state hash after checked frames
+  uint32_t hash;
+} Frame;
+
+/**
+ * a packet held back by the latency shim
+ */
+typedef struct Delayed {
+  uint64_t due;
+  size_t size;
+  uint8_t data[MAX_PACKET];
+} Delayed;
+
+/**
+ * hash of a checked frame, numbered from 1 so that 0 is none
+ */
+typedef struct Check {
+  uint32_t frame;
+  uint32_t hash;
+} Check;
+
+struct Chip8Netplay {
+  Chip8 *chip;
+  Chip8NetplayConfig config;
+  int socket;
+  uint64_t quirks_hash;
+  uint64_t start_hash;
+  uint64_t start_cycles;
+
+  bool heard;
+  bool connected;
+  bool mismatch;
+
+  // frames run, inputs known (the local ones run input_delay frames
+  // ahead), and local inputs the other peer has
+  uint32_t frame;
+  uint32_t local_count;
+  uint32_t remote_count;
+  uint32_t remote_ack;
+  uint16_t local[INPUT_RING];
+  uint16_t remote[INPUT_RING];
+  // frames that ran with known input only
+  uint32_t confirmed;
+
+  // newest frame and frame advantage reported by the other peer
+  bool remote_reported;
+  uint32_t remote_frame;
+  int32_t remote_advantage;
+  uint32_t last_time_sync;
+
+  // hashes of the newest checked frames, and the newest one reported by
+  // the other peer that was not compared yet
+  Check checks[HASH_HISTORY];
+  Check remote_check;
+  uint32_t remote_checked;
+
+  uint64_t shim_rng;
+  size_t delayed_count;
+  Delayed *delayed;
+
+  Chip8NetplayStats stats;
+  Frame frames[CHIP8_NETPLAY_MAX_ROLLBACK];
+};
+
+/**
+ * HELPER FUNCTIONS
+ */
+
+static void put_u32(uint8_t *out, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    out[i] = value >> (8 * i);
+  }
+}
+
+static void put_u64(uint8_t *out, uint64_t value) {
+  for (int i = 0; i < 8; i++) {
+    out[i] = value >> (8 * i);
+  }
+}
+
+static uint32_t get_u32(const uint8_t *in) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; i++) {
+    value |= (uint32_t)in[i] << (8 * i);
+  }
+  return value;
+}
+
+static uint64_t get_u64(const uint8_t *in) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; i++) {
+    value |= (uint64_t)in[i] << (8 * i);
+  }
+  return value;
+}
+
+static uint64_t hash_bytes(const void *data, size_t size) {
+  const uint8_t *bytes = data;
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+/**
+ * uniform in [0, 1), for the shim
+ */
+static double shim_random(Chip8Netplay *netplay) {
+  uint64_t x = netplay->shim_rng;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  netplay->shim_rng = x;
+  return (x >> 11) * 0x1.0p-53;
+}
+
+/**
+ * NETWORK
+ */
+
+static void transmit(Chip8Netplay *netplay, const uint8_t *data,
+                     size_t size) {
+  // refused: the other peer is not listening (yet); it will be resent
+  if (send(netplay->socket, data, size, 0) < 0 && errno != ECONNREFUSED &&
+      errno != EAGAIN && errno != EWOULDBLOCK) {
+    perror("Failed to send packet");
+  }
+}
+
+/**
+ * send a packet through the shim, which drops it or holds it back as
+ * configured
+ */
+static void send_packet(Chip8Netplay *netplay, const uint8_t *data,
+                        size_t size) {
+  const Chip8NetplayConfig *config = &netplay->config;
+  netplay->stats.packets_sent++;
+  if (config->loss > 0.0 && shim_random(netplay) < config->loss) {
+    netplay->stats.packets_lost++;
+    return;
+  }
+  if (config->latency_ms <= 0.0 && config->jitter_ms <= 0.0) {
+    transmit(netplay, data, size);
+    return;
+  }
+  if (netplay->delayed_count == SHIM_QUEUE) {
+    netplay->stats.packets_lost++;
+    return;
+  }
+  double delay_ms =
+      config->latency_ms + config->jitter_ms * shim_random(netplay);
+  Delayed *delayed = &netplay->delayed[netplay->delayed_count++];
+  delayed->due = chip8_time_ns() + (uint64_t)(delay_ms * NS_PER_MS);
+  delayed->size = size;
+  memcpy(delayed->data, data, size);
+}
+
+/**
+ * transmit the packets held back by the shim that are due; returns when
+ * the next one is due (UINT64_MAX if none is held back)
+ */
+static uint64_t flush_delayed(Chip8Netplay *netplay) {
+  uint64_t now = chip8_time_ns();
+  uint64_t next = UINT64_MAX;
+  for (size_t i = 0; i < netplay->delayed_count;) {
+    Delayed *delayed = &netplay->delayed[i];
+    if (delayed->due > now) {
+      next = delayed->due < next ? delayed->due : next;
+      i++;
+      continue;
+    }
+    transmit(netplay, delayed->data, delayed->size);
+    *delayed = netplay->delayed[--netplay->delayed_count];
+  }
+  return next;
+}
+
+static void send_hello(Chip8Netplay *netplay) {
+  uint8_t packet[HELLO_SIZE];
+  uint64_t clock;
+  memcpy(&clock, &netplay->chip->cycles_per_second, sizeof(clock));
+  memcpy(packet, "C8NP", 4);
+  packet[4] = PACKET_HELLO;
+  packet[5] = netplay->heard;
+  put_u64(&packet[6], netplay->start_hash);
+  put_u64(&packet[14], netplay->quirks_hash);
+  put_u64(&packet[22], clock);
+  send_packet(netplay, packet, sizeof(packet));
+}
+
+static void send_input(Chip8Netplay *netplay) {
+  uint8_t packet[MAX_PACKET];
+  uint32_t first = netplay->remote_ack;
+  uint16_t count = netplay->local_count - first;
+  Check newest = netplay->checks[(netplay->confirmed / HASH_INTERVAL) %
+                                 HASH_HISTORY];
+  memcpy(packet, "C8NP", 4);
+  packet[4] = PACKET_INPUT;
+  put_u32(&packet[5], netplay->frame);
+  put_u32(&packet[9], netplay->frame - netplay->remote_frame);
+  put_u32(&packet[13], netplay->remote_count);
+  put_u32(&packet[17], newest.frame);
+  put_u32(&packet[21], newest.hash);
+  put_u32(&packet[25], first);
+  packet[29] = count & 0xFF;
+  packet[30] = count >> 8;
+  for (uint32_t i = 0; i < count; i++) {
+    uint16_t keys = netplay->local[(first + i) % INPUT_RING];
+    packet[INPUT_HEADER_SIZE + 2 * i] = keys & 0xFF;
+    packet[INPUT_HEADER_SIZE + 2 * i + 1] = keys >> 8;
+  }
+  send_packet(netplay, packet, INPUT_HEADER_SIZE + 2 * count);
+}
+
+/**
+ * SIMULATION
+ */
+
+/**
+ * instruction count at the end of a frame; derived from the frame number
+ * rather than accumulated, so a frame runs the same instructions however
+ * often it is re-simulated
+ */
+static uint64_t frame_end(const Chip8Netplay *netplay, uint32_t frame) {
+  return netplay->start_cycles +
+         (uint64_t)((frame + 1.0) * netplay->chip->cycles_per_second /
+                    FRAMES_PER_SECOND);
+}
+
+/**
+ * input of the other player for a frame: the real one if received,
+ * otherwise the newest received
+ */
+static uint16_t remote_input(const Chip8Netplay *netplay, uint32_t frame) {
+  if (frame < netplay->remote_count) {
+    return netplay->remote[frame % INPUT_RING];
+  }
+  if (netplay->remote_count == 0) {
+    return 0;
+  }
+  return netplay->remote[(netplay->remote_count - 1) % INPUT_RING];
+}
+
+static void set_keys(Chip8 *chip, uint16_t keys) {
+  for (uint8_t key = 0; key < KEYPAD_SIZE; key++) {
+    bool down = keys >> key & 1;
+    if (chip->keypad[key] != down) {
+      chip8_key_event(chip, key, down ? CHIP8_KEY_DOWN : CHIP8_KEY_UP);
+    }
+  }
+}
+
+/**
+ * run one frame with the keys of both players; save keeps the state at
+ * its start for rolling back to
+ */
+static void run_frame(Chip8Netplay *netplay, uint32_t frame, bool save) {
+  Chip8 *chip = netplay->chip;
+  Frame *slot = &netplay->frames[frame % CHIP8_NETPLAY_MAX_ROLLBACK];
+  if (save) {
+    chip8_snapshot(chip, &slot->state);
+    slot->cycles = chip->cycles;
+  }
+  slot->remote = remote_input(netplay, frame);
+  set_keys(chip, netplay->local[frame % INPUT_RING] | slot->remote);
+  uint64_t end = frame_end(netplay, frame);
+  if (end > chip->cycles) {
+    chip8_run_cycles(chip, end - chip->cycles);
+  }
+  chip8_frame_tick(chip);
+  if ((frame + 1) % HASH_INTERVAL == 0) {
+    slot->hash = (uint32_t)chip8_state_hash(chip);
+  }
+}
+
+/**
+ * compare the newest hash reported by the other peer once the same frame
+ * is confirmed here
+ */
+static void check_remote_hash(Chip8Netplay *netplay) {
+  Check *remote = &netplay->remote_check;
+  if (!remote->frame) {
+    return;
+  }
+  const Check *local =
+      &netplay->checks[(remote->frame / HASH_INTERVAL) % HASH_HISTORY];
+  if (local->frame == remote->frame) {
+    if (local->hash != remote->hash) {
+      netplay->stats.desyncs++;
+    }
+  } else if (local->frame < remote->frame) {
+    return;
+  }
+  // compared, or too old to compare
+  netplay->remote_checked = remote->frame;
+  remote->frame = 0;
+}
+
+/**
+ * record the hashes of checked frames that are now confirmed
+ */
+static void confirm(Chip8Netplay *netplay) {
+  uint32_t confirmed = netplay->remote_count < netplay->frame
+                           ? netplay->remote_count
+                           : netplay->frame;
+  for (uint32_t frame = netplay->confirmed; frame < confirmed; frame++) {
+    if ((frame + 1) % HASH_INTERVAL == 0) {
+      netplay->checks[((frame + 1) / HASH_INTERVAL) % HASH_HISTORY] =
+          (Check){
+              .frame = frame + 1,
+              .hash =
+                  netplay->frames[frame % CHIP8_NETPLAY_MAX_ROLLBACK].hash,
+          };
+    }
+  }
+  netplay->confirmed = confirmed;
+  check_remote_hash(netplay);
+}
+
+/**
+ * restore the state at the start of a mispredicted frame and run every
+ * frame since again
+ */
+static void roll_back(Chip8Netplay *netplay, uint32_t first) {
+  uint64_t start = chip8_time_ns();
+  Chip8 *chip = netplay->chip;
+  const Frame *slot = &netplay->frames[first % CHIP8_NETPLAY_MAX_ROLLBACK];
+  chip8_restore(chip, &slot->state);
+  chip->cycles = slot->cycles;
+  for (uint32_t frame = first; frame < netplay->frame; frame++) {
+    run_frame(netplay, frame,
+              frame != first && frame >= netplay->remote_count);
+  }
+
+  uint64_t elapsed = chip8_time_ns() - start;
+  uint32_t frames = netplay->frame - first;
+  Chip8NetplayStats *stats = &netplay->stats;
+  stats->rollbacks++;
+  stats->frames_resimulated += frames;
+  stats->resimulate_ns += elapsed;
+  if (frames > stats->max_rollback) {
+    stats->max_rollback = frames;
+  }
+  if (elapsed > stats->max_resimulate_ns) {
+    stats->max_resimulate_ns = elapsed;
+  }
+}
+
+/**
+ * PACKETS
+ */
+
+static void receive_hello(Chip8Netplay *netplay, const uint8_t *packet,
+                          size_t size) {
+  uint64_t clock;
+  memcpy(&clock, &netplay->chip->cycles_per_second, sizeof(clock));
+  if (size != HELLO_SIZE) {
+    return;
+  }
+  if (get_u64(&packet[6]) != netplay->start_hash ||
+      get_u64(&packet[14]) != netplay->quirks_hash ||
+      get_u64(&packet[22]) != clock) {
+    netplay->mismatch = true;
+    return;
+  }
+  bool answer = !packet[5] || !netplay->heard;
+  netplay->heard = true;
+  if (packet[5]) {
+    netplay->connected = true;
+  }
+  if (answer) {
+    send_hello(netplay);
+  }
+}
+
+static void receive_input(Chip8Netplay *netplay, const uint8_t *packet,
+                          size_t size) {
+  if (size < INPUT_HEADER_SIZE || !netplay->heard) {
+    return;
+  }
+  uint32_t count = packet[29] | packet[30] << 8;
+  if (size != INPUT_HEADER_SIZE + 2 * count) {
+    return;
+  }
+  // the other peer only sends input once it heard back from this one
+  netplay->connected = true;
+
+  uint32_t frame = get_u32(&packet[5]);
+  if (!netplay->remote_reported || frame > netplay->remote_frame) {
+    netplay->remote_reported = true;
+    netplay->remote_frame = frame;
+    netplay->remote_advantage = (int32_t)get_u32(&packet[9]);
+  }
+  uint32_t ack = get_u32(&packet[13]);
+  if (ack > netplay->remote_ack && ack <= netplay->local_count) {
+    netplay->remote_ack = ack;
+  }
+  Check check = {.frame = get_u32(&packet[17]), .hash = get_u32(&packet[21])};
+  if (check.frame > netplay->remote_check.frame &&
+      check.frame > netplay->remote_checked) {
+    netplay->remote_check = check;
+  }
+
+  uint32_t received = netplay->remote_count;
+  uint32_t first = get_u32(&packet[25]);
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t input = first + i;
+    if (input < netplay->remote_count) {
+      continue;
+    }
+    // a gap (a newer packet overtook this one), or too far ahead to
+    // keep yet
+    if (input > netplay->remote_count ||
+        input >= netplay->frame + INPUT_RING / 2) {
+      break;
+    }
+    netplay->remote[input % INPUT_RING] =
+        packet[INPUT_HEADER_SIZE + 2 * i] |
+        packet[INPUT_HEADER_SIZE + 2 * i + 1] << 8;
+    netplay->remote_count++;
+  }
+
+  uint32_t known = netplay->remote_count < netplay->frame
+                       ? netplay->remote_count
+                       : netplay->frame;
+  for (uint32_t input = received; input < known; input++) {
+    const Frame *slot = &netplay->frames[input % CHIP8_NETPLAY_MAX_ROLLBACK];
+    if (slot->remote != netplay->remote[input % INPUT_RING]) {
+      roll_back(netplay, input);
+      break;
+    }
+  }
+  confirm(netplay);
+}
+
+static void receive(Chip8Netplay *netplay) {
+  uint8_t packet[MAX_PACKET];
+  for (;;) {
+    ssize_t size = recv(netplay->socket, packet, sizeof(packet), 0);
+    if (size < 0) {
+      if (errno == ECONNREFUSED || errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("Failed to receive packet");
+      }
+      return;
+    }
+    if (size < HEADER_SIZE || memcmp(packet, "C8NP", 4) != 0) {
+      continue;
+    }
+    netplay->stats.packets_received++;
+    if (packet[4] == PACKET_HELLO) {
+      receive_hello(netplay, packet, size);
+    } else if (packet[4] == PACKET_INPUT) {
+      receive_input(netplay, packet, size);
+    }
+  }
+}
+
+/**
+ * SESSION
+ */
+
+void chip8_netplay_config_init(Chip8NetplayConfig *config) {
+  *config = (Chip8NetplayConfig){
+      .remote_host = "127.0.0.1",
+      .input_delay = 1,
+      .max_rollback = 16,
+  };
+}
+
+/**
+ * parse the other peer's address as given on the command line
+ * ("host:port"); the string is split in place and config->remote_host
+ * points into it
+ */
+int chip8_netplay_parse_peer(char *address, Chip8NetplayConfig *config) {
+  char *colon = strrchr(address, ':');
+  if (!colon || colon == address) {
+    return 1;
+  }
+  char *end;
+  unsigned long port = strtoul(colon + 1, &end, 10);
+  if (*end || port == 0 || port > 65535) {
+    return 1;
+  }
+  *colon = '\0';
+  config->remote_host = address;
+  config->remote_port = port;
+  return 0;
+}
+
+/**
+ * open a session for a chip that has its rom loaded; the other peer must
+ * start from the same state, quirks and clock speed (checked by
+ * chip8_netplay_connect)
+ *
+ * the chip is switched to the threaded engine (see ROLLBACK NETPLAY) and
+ * must not be recording
+ *
+ * returns NULL if the socket cannot be set up or memory runs out
+ */
+Chip8Netplay *chip8_netplay_create(Chip8 *chip,
+                                   const Chip8NetplayConfig *config) {
+  if (config->input_delay > MAX_INPUT_DELAY || config->max_rollback == 0 ||
+      config->max_rollback > CHIP8_NETPLAY_MAX_ROLLBACK) {
+    fprintf(stderr, "Input delay must be at most %d frames and rollback "
+                    "between 1 and %d frames\n",
+            MAX_INPUT_DELAY, CHIP8_NETPLAY_MAX_ROLLBACK);
+    return NULL;
+  }
+
+  struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_DGRAM};
+  struct addrinfo *peer;
+  char port[8];
+  snprintf(port, sizeof(port), "%u", config->remote_port);
+  int err = getaddrinfo(config->remote_host, port, &hints, &peer);
+  if (err) {
+    fprintf(stderr, "Failed to resolve %s: %s\n", config->remote_host,
+            gai_strerror(err));
+    return NULL;
+  }
+
+  Chip8Netplay *netplay = calloc(1, sizeof(Chip8Netplay));
+  if (!netplay) {
+    perror("Failed to allocate netplay session");
+    freeaddrinfo(peer);
+    return NULL;
+  }
+  netplay->delayed = malloc(SHIM_QUEUE * sizeof(Delayed));
+  netplay->socket = socket(AF_INET, SOCK_DGRAM, 0);
+  if (!netplay->delayed || netplay->socket < 0) {
+    perror("Failed to set up netplay session");
+    freeaddrinfo(peer);
+    chip8_netplay_destroy(netplay);
+    return NULL;
+  }
+
+  struct sockaddr_in local = {
+      .sin_family = AF_INET,
+      .sin_port = htons(config->local_port),
+      .sin_addr.s_addr = htonl(INADDR_ANY),
+  };
+  if (bind(netplay->socket, (struct sockaddr *)&local, sizeof(local)) ||
+      connect(netplay->socket, peer->ai_addr, peer->ai_addrlen) ||
+      fcntl(netplay->socket, F_SETFL, O_NONBLOCK)) {
+    perror("Failed to set up netplay socket");
+    freeaddrinfo(peer);
+    chip8_netplay_destroy(netplay);
+    return NULL;
+  }
+  freeaddrinfo(peer);
+
+  netplay->chip = chip;
+  netplay->config = *config;
+  netplay->config.remote_host = NULL;
+  chip8_set_engine(chip, CHIP8_ENGINE_THREADED);
+  netplay->quirks_hash = hash_bytes(chip->quirks, sizeof(Chip8Quirks));
+  netplay->start_hash = chip8_state_hash(chip);
+  netplay->start_cycles = chip->cycles;
+  // the first input_delay frames run without local input
+  netplay->local_count = config->input_delay;
+  netplay->shim_rng = (chip8_time_ns() ^ config->local_port) | 1;
+  return netplay;
+}
+
+void chip8_netplay_destroy(Chip8Netplay *netplay) {
+  if (netplay) {
+    if (netplay->socket >= 0) {
+      close(netplay->socket);
+    }
+    free(netplay->delayed);
+    free(netplay);
+  }
+}
+
+/**
+ * serve the network (receive input, rolling back as needed, and send
+ * what the shim held back) until the given time (see chip8_time_ns);
+ * frontends call this between frames
+ */
+void chip8_netplay_poll(Chip8Netplay *netplay, uint64_t until_ns) {
+  struct pollfd fd = {.fd = netplay->socket, .events = POLLIN};
+  for (;;) {
+    uint64_t next = flush_delayed(netplay);
+    receive(netplay);
+    uint64_t now = chip8_time_ns();
+    if (now >= until_ns) {
+      return;
+    }
+    uint64_t wake = next < until_ns ? next : until_ns;
+    int timeout = wake > now ? (wake - now + NS_PER_MS - 1) / NS_PER_MS : 0;
+    poll(&fd, 1, timeout);
+  }
+}
+
+/**
+ * wait until the other peer answers and both run the same rom from the
+ * same state with the same settings
+ *
+ * returns nonzero if they differ or there is no answer in time
+ */
+int chip8_netplay_connect(Chip8Netplay *netplay, uint32_t timeout_ms) {
+  uint64_t start = chip8_time_ns();
+  uint64_t next_hello = start;
+  while (!netplay->connected) {
+    if (netplay->mismatch) {
+      fprintf(stderr, "Peers run different roms or settings\n");
+      return 1;
+    }
+    uint64_t now = chip8_time_ns();
+    if (now - start >= timeout_ms * NS_PER_MS) {
+      fprintf(stderr, "No answer from the other peer\n");
+      return 1;
+    }
+    if (now >= next_hello) {
+      send_hello(netplay);
+      next_hello = now + HELLO_INTERVAL_NS;
+    }
+    chip8_netplay_poll(netplay, now + NS_PER_MS);
+  }
+  return 0;
+}
+
+/**
+ * true if running another frame would predict further than allowed, or
+ * overwrite local input the other peer may still need
+ */
+static bool stalled(const Chip8Netplay *netplay) {
+  // the other peer's input runs ahead of its frames by input_delay, so
+  // it can be ahead of ours too
+  uint32_t predicted = netplay->remote_count >= netplay->frame
+                           ? 0
+                           : netplay->frame - netplay->remote_count;
+  return predicted >= netplay->config.max_rollback ||
+         netplay->local_count - netplay->remote_ack >= INPUT_RING;
+}
+
+/**
+ * true if this peer runs ahead of the other and should hold back a
+ * frame: each peer reports how far it is ahead of the last frame it
+ * heard of, which includes the network latency on both sides, so half
+ * the difference is how far this peer is really ahead
+ */
+static bool time_sync(Chip8Netplay *netplay) {
+  if (!netplay->remote_reported ||
+      netplay->frame - netplay->last_time_sync < TIME_SYNC_INTERVAL) {
+    return false;
+  }
+  int32_t advantage = netplay->frame - netplay->remote_frame;
+  if (advantage - netplay->remote_advantage < 2) {
+    return false;
+  }
+  netplay->last_time_sync = netplay->frame;
+  return true;
+}
+
+/**
+ * run the next frame with the keys held locally (bit k for key k),
+ * predicting the other player's where they have not arrived yet
+ *
+ * returns nonzero if the frame did not run: the other peer is too far
+ * behind and this one waits for it (call again next frame)
+ */
+int chip8_netplay_advance(Chip8Netplay *netplay, uint16_t keys) {
+  chip8_netplay_poll(netplay, 0);
+  if (stalled(netplay)) {
+    netplay->stats.stalls++;
+    send_input(netplay);
+    return 1;
+  }
+  if (time_sync(netplay)) {
+    netplay->stats.time_syncs++;
+    send_input(netplay);
+    return 1;
+  }
+
+  netplay->local[netplay->local_count++ % INPUT_RING] = keys;
+  run_frame(netplay, netplay->frame,
+            netplay->frame >= netplay->remote_count);
+  netplay->frame++;
+  netplay->stats.frames++;
+  confirm(netplay);
+  send_input(netplay);
+  return 0;
+}
+
+/**
+ * wait until both peers have all input up to the current frame, so the
+ * state of the chip is final and the same on both; the other peer must
+ * stop at the same frame
+ *
+ * returns nonzero if that does not happen in time
+ */
+int chip8_netplay_sync(Chip8Netplay *netplay, uint32_t timeout_ms) {
+  uint64_t start = chip8_time_ns();
+  while (netplay->remote_count < netplay->frame ||
+         netplay->remote_ack < netplay->frame) {
+    uint64_t now = chip8_time_ns();
+    if (now - start >= timeout_ms * NS_PER_MS) {
+      fprintf(stderr, "Timed out waiting for the other peer\n");
+      return 1;
+    }
+    send_input(netplay);
+    chip8_netplay_poll(netplay, now + RESEND_INTERVAL_NS);
+  }
+
+  // the other peer may not know yet that its input arrived
+  uint64_t linger =
+      LINGER_NS + (uint64_t)(2 * (netplay->config.latency_ms +
+                                  netplay->config.jitter_ms) *
+                             NS_PER_MS);
+  uint64_t end = chip8_time_ns() + linger;
+  for (uint64_t now = chip8_time_ns(); now < end; now = chip8_time_ns()) {
+    send_input(netplay);
+    chip8_netplay_poll(netplay, now + RESEND_INTERVAL_NS);
+  }
+  return 0;
+}
+
+/**
+ * frames run so far
+ */
+uint64_t chip8_netplay_frame(const Chip8Netplay *netplay) {
+  return netplay->frame;
+}
+
+const Chip8NetplayStats *chip8_netplay_stats(const Chip8Netplay *netplay) {
+  return &netplay->stats;
+}
@@ -0,0 +1,74 @@
+#ifndef NETPLAY_H
+#define NETPLAY_H
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+/**
+ * a two player session over UDP with rollback (see netplay.c)
+ */
+typedef struct Chip8Netplay Chip8Netplay;
+
+typedef struct Chip8NetplayConfig {
+  // UDP port to listen on, and where the other peer listens
+  uint16_t local_port;
+  const char *remote_host;
+  uint16_t remote_port;
+  // frames between sampling local input and applying it, which hides
+  // that much latency without rolling back
+  uint32_t input_delay;
+  // furthest the session runs ahead of the last input received from
+  // the other peer before it waits (at most CHIP8_NETPLAY_MAX_ROLLBACK)
+  uint32_t max_rollback;
+  // simulated network conditions applied to every packet sent: a delay
+  // plus up to jitter_ms more, and a probability of dropping it
+  double latency_ms;
+  double jitter_ms;
+  double loss;
+} Chip8NetplayConfig;
+
+// frames of history kept for rolling back
+#define CHIP8_NETPLAY_MAX_ROLLBACK 64
+
+typedef struct Chip8NetplayStats {
+  uint64_t frames;
+  // chip8_netplay_advance calls that waited for the other peer, and
+  // those that held back to let it catch up
+  uint64_t stalls;
+  uint64_t time_syncs;
+  uint64_t rollbacks;
+  uint64_t frames_resimulated;
+  uint64_t resimulate_ns;
+  // most frames re-simulated by one rollback, and the longest it took
+  uint32_t max_rollback;
+  uint64_t max_resimulate_ns;
+  // confirmed frames whose state differed between the peers
+  uint64_t desyncs;
+  uint64_t packets_sent;
+  uint64_t packets_lost;
+  uint64_t packets_received;
+} Chip8NetplayStats;
+
+void chip8_netplay_config_init(Chip8NetplayConfig *config);
+
+int chip8_netplay_parse_peer(char *address, Chip8NetplayConfig *config);
+
+Chip8Netplay *chip8_netplay_create(Chip8 *chip,
+                                   const Chip8NetplayConfig *config);
+
+void chip8_netplay_destroy(Chip8Netplay *netplay);
+
+int chip8_netplay_connect(Chip8Netplay *netplay, uint32_t timeout_ms);
+
+void chip8_netplay_poll(Chip8Netplay *netplay, uint64_t until_ns);
+
+int chip8_netplay_advance(Chip8Netplay *netplay, uint16_t keys);
+
+int chip8_netplay_sync(Chip8Netplay *netplay, uint32_t timeout_ms);
+
+uint64_t chip8_netplay_frame(const Chip8Netplay *netplay);
+
+const Chip8NetplayStats *chip8_netplay_stats(const Chip8Netplay *netplay);
+
+#endif
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "blocks.h"
 #include "chip8.h"
 #include "opcodes.h"
 
@@ -10,6 +11,11 @@
  * HELPER FUNCTIONS
  */
 
+// instructions whose behaviour depends on a quirk are written once as
+// an always inlined template taking the quirk setting as a parameter,
+// then instantiated once per setting (see opcode_specialize)
+#define QUIRK_TEMPLATE static inline __attribute__((always_inline))
+
 /**
  * increment program counter
  */
@@ -26,7 +32,8 @@ void _inc_pc(Chip8 *chip) { chip->PC += 2; }
 /**
  * clear the screen
  */
-void op_00E0(Chip8 *chip, __attribute__((unused)) uint16_t opcode) {
+void op_00E0(Chip8 *chip,
+             __attribute__((unused)) const Chip8Instruction *ins) {
   _inc_pc(chip);
   memset(chip->display, 0, sizeof(chip->display));
   chip->draw_flag = true;
@@ -35,7 +42,8 @@ void op_00E0(Chip8 *chip, __attribute__((unused)) uint16_t opcode) {
 /**
  * return from a subroutine
  */
-void op_00EE(Chip8 *chip, __attribute__((unused)) uint16_t opcode) {
+void op_00EE(Chip8 *chip,
+             __attribute__((unused)) const Chip8Instruction *ins) {
   chip->PC = chip->stack[chip->SP];
   chip->SP--;
 }
@@ -43,25 +51,25 @@ void op_00EE(Chip8 *chip, __attribute__((unused)) uint16_t opcode) {
 /**
  * jump to address NNN
  */
-void op_1NNN(Chip8 *chip, uint16_t opcode) { chip->PC = opcode & 0x0FFF; }
+void op_1NNN(Chip8 *chip, const Chip8Instruction *ins) { chip->PC = ins->nnn; }
 
 /**
  * execute subroutine starting at address NNN
  */
-void op_2NNN(Chip8 *chip, uint16_t opcode) {
+void op_2NNN(Chip8 *chip, const Chip8Instruction *ins) {
   _inc_pc(chip);
   chip->SP++;
   chip->stack[chip->SP] = chip->PC;
-  chip->PC = opcode & 0x0FFF;
+  chip->PC = ins->nnn;
 }
 
 /**
  * if VX != n then execute the following instruction, else skip
  */
-void op_3XNN(Chip8 *chip, uint16_t opcode) {
+void op_3XNN(Chip8 *chip, const Chip8Instruction *ins) {
   _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
-  uint8_t n = opcode & 0x00FF;
+  uint8_t x = ins->x;
+  uint8_t n = ins->nn;
   if (chip->V[x] == n) {
     _inc_pc(chip);
   }
@@ -70,10 +78,10 @@ void op_3XNN(Chip8 *chip, uint16_t opcode) {
 /**
  * if VX == n then execute the following instruction, else skip
  */
-void op_4XNN(Chip8 *chip, uint16_t opcode) {
+void op_4XNN(Chip8 *chip, const Chip8Instruction *ins) {
   _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
-  uint8_t n = opcode & 0x00FF;
+  uint8_t x = ins->x;
+  uint8_t n = ins->nn;
   if (chip->V[x] != n) {
     _inc_pc(chip);
   }
@@ -82,10 +90,10 @@ void op_4XNN(Chip8 *chip, uint16_t opcode) {
 /**
  * if VX != VY then execute the following instruction, else skip
  */
-void op_5XY0(Chip8 *chip, uint16_t opcode) {
+void op_5XY0(Chip8 *chip, const Chip8Instruction *ins) {
   _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
-  uint8_t y = (opcode & 0x00F0) >> 4;
+  uint8_t x = ins->x;
+  uint8_t y = ins->y;
   if (chip->V[x] == chip->V[y]) {
     _inc_pc(chip);
   }
@@ -94,79 +102,97 @@ void op_5XY0(Chip8 *chip, uint16_t opcode) {
 /**
  * VX := NN (store NN in register VX)
  */
-void op_6XNN(Chip8 *chip, uint16_t opcode) {
+void op_6XNN(Chip8 *chip, const Chip8Instruction *ins) {
   _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
-  uint8_t n = opcode & 0x00FF;
+  uint8_t x = ins->x;
+  uint8_t n = ins->nn;
   chip->V[x] = n;
 }
 
 /**
  * VX += NN (add value NN to register VX)
  */
-void op_7XNN(Chip8 *chip, uint16_t opcode) {
+void op_7XNN(Chip8 *chip, const Chip8Instruction *ins) {
   _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
-  uint8_t n = opcode & 0x00FF;
+  uint8_t x = ins->x;
+  uint8_t n = ins->nn;
   chip->V[x] += n;
 }
 
 /**
  * VX := VY (store value of VY in VX)
  */
-void op_8XY0(Chip8 *chip, uint16_t opcode) {
+void op_8XY0(Chip8 *chip, const Chip8Instruction *ins) {
   _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
-  uint8_t y = (opcode & 0x00F0) >> 4;
+  uint8_t x = ins->x;
+  uint8_t y = ins->y;
   chip->V[x] = chip->V[y];
 }
 
 /**
- * VX |= VY (set VX to VX | VY)
+ * template for the logic instructions; only ever called with constant
+ * arguments, so each instantiation below is specialized for one quirk
+ * setting and the check disappears
  */
-void op_8XY1(Chip8 *chip, uint16_t opcode) {
+QUIRK_TEMPLATE void logic(Chip8 *chip, const Chip8Instruction *ins,
+                          uint8_t op, bool reset_vf) {
   _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
-  uint8_t y = (opcode & 0x00F0) >> 4;
-  chip->V[x] |= chip->V[y];
-  if (chip->quirks->logic_resets_vf) {
+  uint8_t x = ins->x;
+  uint8_t y = ins->y;
+  if (op == OP_8XY1) {
+    chip->V[x] |= chip->V[y];
+  } else if (op == OP_8XY2) {
+    chip->V[x] &= chip->V[y];
+  } else {
+    chip->V[x] ^= chip->V[y];
+  }
+  if (reset_vf) {
     chip->V[0xF] = 0;
   }
 }
 
+/**
+ * VX |= VY (set VX to VX | VY)
+ *
+ * the _reset_vf variants also set VF to 0 (logic_resets_vf quirk)
+ */
+void op_8XY1(Chip8 *chip, const Chip8Instruction *ins) {
+  logic(chip, ins, OP_8XY1, false);
+}
+
+void op_8XY1_reset_vf(Chip8 *chip, const Chip8Instruction *ins) {
+  logic(chip, ins, OP_8XY1, true);
+}
+
 /**
  * VX &= VY (set VX to VX & VY)
  */
-void op_8XY2(Chip8 *chip, uint16_t opcode) {
-  _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
-  uint8_t y = (opcode & 0x00F0) >> 4;
-  chip->V[x] &= chip->V[y];
-  if (chip->quirks->logic_resets_vf) {
-    chip->V[0xF] = 0;
-  }
+void op_8XY2(Chip8 *chip, const Chip8Instruction *ins) {
+  logic(chip, ins, OP_8XY2, false);
+}
+
+void op_8XY2_reset_vf(Chip8 *chip, const Chip8Instruction *ins) {
+  logic(chip, ins, OP_8XY2, true);
 }
 
 /**
  * VX ^= VY (set VX to VX ^ VY)
  */
-void op_8XY3(Chip8 *chip, uint16_t opcode) {
-  _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
-  uint8_t y = (opcode & 0x00F0) >> 4;
-  chip->V[x] ^= chip->V[y];
-  if (chip->quirks->logic_resets_vf) {
-    chip->V[0xF] = 0;
-  }
+void op_8XY3(Chip8 *chip, const Chip8Instruction *ins) {
+  logic(chip, ins, OP_8XY3, false);
+}
+
+void op_8XY3_reset_vf(Chip8 *chip, const Chip8Instruction *ins) {
+  logic(chip, ins, OP_8XY3, true);
 }
 
 /**
  * VX += VY (set VX to VX + VY, set VF to 1 if carry occurs, else 0)
  */
-void op_8XY4(Chip8 *chip, uint16_t opcode) {
+void op_8XY4(Chip8 *chip, const Chip8Instruction *ins) {
   _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
-  uint8_t y = (opcode & 0x00F0) >> 4;
+  uint8_t x = ins->x;
+  uint8_t y = ins->y;
   uint16_t res = chip->V[x] + chip->V[y];
   chip->V[x] = res;
   chip->V[0xF] = res >> 8;
@@ -175,10 +201,10 @@ void op_8XY4(Chip8 *chip, uint16_t opcode) {
 /**
  * VX -= VY (set VX to VX - VY, set VF to 0 if borrow occurs, else 1)
  */
-void op_8XY5(Chip8 *chip, uint16_t opcode) {
+void op_8XY5(Chip8 *chip, const Chip8Instruction *ins) {
   _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
-  uint8_t y = (opcode & 0x00F0) >> 4;
+  uint8_t x = ins->x;
+  uint8_t y = ins->y;
   uint16_t res = chip->V[x] - chip->V[y];
   chip->V[x] = res;
   chip->V[0xF] = res <= 255;
@@ -187,23 +213,34 @@ void op_8XY5(Chip8 *chip, uint16_t opcode) {
 /**
  * set VX to VY >> 1 (shifted right one bit), set VF to least
  * significant (rightmost) bit prior to the shift
+ *
+ * the _vx variant shifts VX in place (shift_uses_vx quirk)
  */
-void op_8XY6(Chip8 *chip, uint16_t opcode) {
+QUIRK_TEMPLATE void shift_right(Chip8 *chip, const Chip8Instruction *ins,
+                                bool uses_vx) {
   _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
-  uint8_t y = (opcode & 0x00F0) >> 4;
+  uint8_t x = ins->x;
+  uint8_t y = uses_vx ? ins->x : ins->y;
   uint8_t carry = chip->V[y] & 1;
   chip->V[x] = chip->V[y] >> 1;
   chip->V[0xF] = carry;
 }
 
+void op_8XY6(Chip8 *chip, const Chip8Instruction *ins) {
+  shift_right(chip, ins, false);
+}
+
+void op_8XY6_vx(Chip8 *chip, const Chip8Instruction *ins) {
+  shift_right(chip, ins, true);
+}
+
 /**
  * set VX to VY - VX, set VF to 0 if borrow occurs, else 1)
  */
-void op_8XY7(Chip8 *chip, uint16_t opcode) {
+void op_8XY7(Chip8 *chip, const Chip8Instruction *ins) {
   _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
-  uint8_t y = (opcode & 0x00F0) >> 4;
+  uint8_t x = ins->x;
+  uint8_t y = ins->y;
   uint16_t res = chip->V[y] - chip->V[x];
   chip->V[x] = res;
   chip->V[0xF] = res <= 255;
@@ -212,23 +249,34 @@ void op_8XY7(Chip8 *chip, uint16_t opcode) {
 /**
  * set VX to VY << 1 (shifted left one bit), set VF to most
  * significant (leftmost) bit prior to the shift
+ *
+ * the _vx variant shifts VX in place (shift_uses_vx quirk)
  */
-void op_8XYE(Chip8 *chip, uint16_t opcode) {
+QUIRK_TEMPLATE void shift_left(Chip8 *chip, const Chip8Instruction *ins,
+                               bool uses_vx) {
   _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
-  uint8_t y = (opcode & 0x00F0) >> 4;
+  uint8_t x = ins->x;
+  uint8_t y = uses_vx ? ins->x : ins->y;
   uint8_t carry = chip->V[y] >> 7;
   chip->V[x] = chip->V[y] << 1;
   chip->V[0xF] = carry;
 }
 
+void op_8XYE(Chip8 *chip, const Chip8Instruction *ins) {
+  shift_left(chip, ins, false);
+}
+
+void op_8XYE_vx(Chip8 *chip, const Chip8Instruction *ins) {
+  shift_left(chip, ins, true);
+}
+
 /**
  * if VX == VY then execute the following instruction, else skip
  */
-void op_9XY0(Chip8 *chip, uint16_t opcode) {
+void op_9XY0(Chip8 *chip, const Chip8Instruction *ins) {
   _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
-  uint8_t y = (opcode & 0x00F0) >> 4;
+  uint8_t x = ins->x;
+  uint8_t y = ins->y;
   if (chip->V[x] != chip->V[y]) {
     _inc_pc(chip);
   }
@@ -237,92 +285,118 @@ void op_9XY0(Chip8 *chip, uint16_t opcode) {
 /**
  * I := NNN (store memory address NNN to register I)
  */
-void op_ANNN(Chip8 *chip, uint16_t opcode) {
+void op_ANNN(Chip8 *chip, const Chip8Instruction *ins) {
   _inc_pc(chip);
-  chip->I = opcode & 0x0FFF;
+  chip->I = ins->nnn;
 }
 
 /**
  * jump to address NNN + V0
  */
-void op_BNNN(Chip8 *chip, uint16_t opcode) {
-  uint16_t n = opcode & 0x0FFF;
+void op_BNNN(Chip8 *chip, const Chip8Instruction *ins) {
+  uint16_t n = ins->nnn;
   chip->PC = n + chip->V[0];
 }
 
+/**
+ * jump to address XNN + VX (jump_uses_vx quirk)
+ */
+void op_BXNN(Chip8 *chip, const Chip8Instruction *ins) {
+  uint16_t n = ins->nnn;
+  chip->PC = n + chip->V[ins->x];
+}
+
 /**
  * VX := RANDOM && NN (set VX to a random 8-bit (0-255) number with a
  * mask of NN)
  */
-void op_CXNN(Chip8 *chip, uint16_t opcode) {
+void op_CXNN(Chip8 *chip, const Chip8Instruction *ins) {
   _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
-  uint8_t n = (opcode & 0x00FF);
-  chip->V[x] = (rand() % 256) & n;
+  uint8_t x = ins->x;
+  uint8_t n = ins->nn;
+  chip->V[x] = chip8_random(chip) & n;
 }
 
 /**
  * draw a sprite at position (VX, VY) with N bytes of sprite data
  * starting at the address stored in register I
  * set VF to 1 on collision (i.e. any pixels change from 1 to 0)
+ *
+ * the variants wait for the vertical blank (draw_waits_for_vblank
+ * quirk) and/or clip the sprite at the edges of the display instead of
+ * wrapping it around (clip_sprites quirk)
  */
-void op_DXYN(Chip8 *chip, uint16_t opcode) {
+QUIRK_TEMPLATE void draw(Chip8 *chip, const Chip8Instruction *ins,
+                         bool waits_for_vblank, bool clip) {
 
   // if display is throttled to one update per frame, check flag
   // flag and exit before incrementing program counter
-  if (chip->quirks->draw_waits_for_vblank && !chip->draw_permitted) {
+  if (waits_for_vblank && !chip->draw_permitted) {
     // leave PC unchanged; program will encounter this opcode again
     return;
   }
 
   // block subsequent executions until next frame completes
-  if (chip->quirks->draw_waits_for_vblank) {
+  if (waits_for_vblank) {
     chip->draw_permitted = false;
   }
 
   _inc_pc(chip);
 
-  chip->V[0xF] = 0;
-  uint8_t x_register = (opcode & 0x0F00) >> 8;
-  uint8_t y_register = (opcode & 0x00F0) >> 4;
+  uint8_t x_register = ins->x;
+  uint8_t y_register = ins->y;
   uint8_t x = chip->V[x_register] % DISPLAY_WIDTH;
   uint8_t y = chip->V[y_register] % DISPLAY_HEIGHT;
-  uint8_t n = opcode & 0x000F;
+  uint8_t n = ins->n;
+  uint64_t collision = 0;
 
   for (uint8_t i = 0; i < n; i++) {
-    // read the next byte of the sprite
-    uint8_t byte = chip->memory[chip->I + i];
     uint8_t py = y + i;
-    // clip sprite if flag set
-    if (chip->quirks->clip_sprites && py > DISPLAY_HEIGHT) {
+    // clip or wrap the sprite at the bottom edge
+    if (clip && py >= DISPLAY_HEIGHT) {
       break;
     }
-    for (uint8_t j = 0; j < 8; j++) {
-      // read bits in byte from left to right
-      uint8_t bit = (1 << (7 - j) & byte) >> (7 - j);
-      uint8_t px = x + j;
-      // clip sprite if flag set
-      if (chip->quirks->clip_sprites && px > DISPLAY_WIDTH) {
-        break;
-      }
-      uint16_t pixel = py * DISPLAY_WIDTH + px;
-      chip->display[pixel] ^= bit;
-      if (chip->display[pixel] == 0 && bit == 1) {
-        chip->V[0xF] = 1;
-      }
+    py %= DISPLAY_HEIGHT;
+
+    // line the sprite byte up with the leftmost pixel and shift it into
+    // place; bits shifted past the right edge are dropped when clipping
+    // and rotated back in on the left when wrapping
+    uint64_t sprite = (uint64_t)chip->memory[chip->I + i] << 56;
+    uint64_t bits = sprite >> x;
+    if (!clip && x > 0) {
+      bits |= sprite << (DISPLAY_WIDTH - x);
     }
+    collision |= chip->display[py] & bits;
+    chip->display[py] ^= bits;
   }
+  chip->V[0xF] = collision != 0;
   chip->draw_flag = true;
 }
 
+void op_DXYN(Chip8 *chip, const Chip8Instruction *ins) {
+  draw(chip, ins, false, false);
+}
+
+void op_DXYN_clip(Chip8 *chip, const Chip8Instruction *ins) {
+  draw(chip, ins, false, true);
+}
+
+void op_DXYN_vblank(Chip8 *chip, const Chip8Instruction *ins) {
+  draw(chip, ins, true, false);
+}
+
+void op_DXYN_vblank_clip(Chip8 *chip, const Chip8Instruction *ins) {
+  draw(chip, ins, true, true);
+}
+
 /**
  * if the key corresponding to the value in VX is not pressed, execute
  * the following instruction; otherwise skip
  */
-void op_EX9E(Chip8 *chip, uint16_t opcode) {
+void op_EX9E(Chip8 *chip, const Chip8Instruction *ins) {
   _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
-  uint8_t key = chip->V[x];
+  uint8_t x = ins->x;
+  uint8_t key = chip->V[x] & 0xF;
   if (chip->keypad[key]) {
     _inc_pc(chip);
   }
@@ -332,10 +406,10 @@ void op_EX9E(Chip8 *chip, uint16_t opcode) {
  * if the key corresponding to the value in VX is pressed, execute
  * the following instruction; otherwise skip
  */
-void op_EXA1(Chip8 *chip, uint16_t opcode) {
+void op_EXA1(Chip8 *chip, const Chip8Instruction *ins) {
   _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
-  uint8_t key = chip->V[x];
+  uint8_t x = ins->x;
+  uint8_t key = chip->V[x] & 0xF;
   if (!chip->keypad[key]) {
     _inc_pc(chip);
   }
@@ -344,17 +418,17 @@ void op_EXA1(Chip8 *chip, uint16_t opcode) {
 /**
  * VX := delay (store current value of delay timer in VX)
  */
-void op_FX07(Chip8 *chip, uint16_t opcode) {
+void op_FX07(Chip8 *chip, const Chip8Instruction *ins) {
   _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
+  uint8_t x = ins->x;
   chip->V[x] = chip->delay_timer;
 }
 
 /**
  * VX := key (wait for keypress and store value in VX)
  */
-void op_FX0A(Chip8 *chip, uint16_t opcode) {
-  uint8_t x = (opcode & 0x0F00) >> 8;
+void op_FX0A(Chip8 *chip, const Chip8Instruction *ins) {
+  uint8_t x = ins->x;
 
   chip->FX0A_reg = x;
   chip->FX0A_waiting = true;
@@ -363,27 +437,27 @@ void op_FX0A(Chip8 *chip, uint16_t opcode) {
 /**
  * delay := VX (set the delay timer to the value of register VX)
  */
-void op_FX15(Chip8 *chip, uint16_t opcode) {
+void op_FX15(Chip8 *chip, const Chip8Instruction *ins) {
   _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
+  uint8_t x = ins->x;
   chip->delay_timer = chip->V[x];
 }
 
 /**
  * sound := VX (set the sound timer to the value of register VX)
  */
-void op_FX18(Chip8 *chip, uint16_t opcode) {
+void op_FX18(Chip8 *chip, const Chip8Instruction *ins) {
   _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
+  uint8_t x = ins->x;
   chip->sound_timer = chip->V[x];
 }
 
 /**
  * I += VX (add value stored in register VX to register I)
  */
-void op_FX1E(Chip8 *chip, uint16_t opcode) {
+void op_FX1E(Chip8 *chip, const Chip8Instruction *ins) {
   _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
+  uint8_t x = ins->x;
   chip->I += chip->V[x];
 }
 
@@ -391,9 +465,9 @@ void op_FX1E(Chip8 *chip, uint16_t opcode) {
  * I := hex VX (set I to the address corresponding to the hexadecimal
  * digit stored in the lower nibble of register VX)
  */
-void op_FX29(Chip8 *chip, uint16_t opcode) {
+void op_FX29(Chip8 *chip, const Chip8Instruction *ins) {
   _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
+  uint8_t x = ins->x;
   // zero out upper nibble because there are only 16 characters, so
   // the content of VX should be treated as a 4 bit value
   chip->I = FONT_START + FONT_SIZE_BYTES * (chip->V[x] & 0x0F);
@@ -403,73 +477,187 @@ void op_FX29(Chip8 *chip, uint16_t opcode) {
  * bcd VX (store the binary-coded decimal equivalent of the value stored
  * in VX at addresses I, I + 1, and I + 2)
  */
-void op_FX33(Chip8 *chip, uint16_t opcode) {
+void op_FX33(Chip8 *chip, const Chip8Instruction *ins) {
   _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
+  uint8_t x = ins->x;
   uint8_t val = chip->V[x];
   chip->memory[chip->I] = val / 100;
   chip->memory[chip->I + 1] = val % 100 / 10;
   chip->memory[chip->I + 2] = val % 10;
+  chip8_invalidate_code(chip, chip->I, 3);
 }
 
 /**
  * save VX (store the values of registers V0-VX in memory starting at
  * address I)
  *
- * note that some older implementations also set I := I + X + 1
+ * the _inc_i variant also sets I := I + X + 1, as the original
+ * interpreter did (load_store_increment_i quirk)
  */
-void op_FX55(Chip8 *chip, uint16_t opcode) {
+QUIRK_TEMPLATE void store(Chip8 *chip, const Chip8Instruction *ins,
+                          bool increment_i) {
   _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
+  uint8_t x = ins->x;
   for (int i = 0; i <= x; i++) {
     chip->memory[chip->I + i] = chip->V[i];
   }
-  // increment the index register for chip8
-  chip->I = chip->I + x + 1;
+  chip8_invalidate_code(chip, chip->I, x + 1);
+  if (increment_i) {
+    chip->I = chip->I + x + 1;
+  }
+}
+
+void op_FX55(Chip8 *chip, const Chip8Instruction *ins) {
+  store(chip, ins, false);
+}
+
+void op_FX55_inc_i(Chip8 *chip, const Chip8Instruction *ins) {
+  store(chip, ins, true);
 }
 
 /**
  * load VX (set values of regsiters V0-VX with the values in memory
  * starting at address I)
  *
- * note that some older implementations also set I := I + X + 1
+ * the _inc_i variant also sets I := I + X + 1 (load_store_increment_i
+ * quirk)
  */
-void op_FX65(Chip8 *chip, uint16_t opcode) {
+QUIRK_TEMPLATE void load(Chip8 *chip, const Chip8Instruction *ins,
+                         bool increment_i) {
   _inc_pc(chip);
-  uint8_t x = (opcode & 0x0F00) >> 8;
+  uint8_t x = ins->x;
   for (int i = 0; i <= x; i++) {
     chip->V[i] = chip->memory[chip->I + i];
   }
-  // increment the index register for chip8
-  chip->I = chip->I + x + 1;
+  if (increment_i) {
+    chip->I = chip->I + x + 1;
+  }
+}
+
+void op_FX65(Chip8 *chip, const Chip8Instruction *ins) {
+  load(chip, ins, false);
+}
+
+void op_FX65_inc_i(Chip8 *chip, const Chip8Instruction *ins) {
+  load(chip, ins, true);
 }
 
 /**
- * FUNCTION POINTER TABLES
+ * placeholder for opcodes that are not part of the instruction set;
+ * does nothing and leaves PC unchanged
  */
-OpcodeHandler opcode_0XXX_table[0x100] = {
-    [0xE0] = op_00E0,
-    [0xEE] = op_00EE,
+void op_unknown(__attribute__((unused)) Chip8 *chip,
+                __attribute__((unused)) const Chip8Instruction *ins) {}
+
+/**
+ * DECODE TABLES
+ *
+ * the five tables below map an opcode to its Chip8Op; which table is
+ * used depends on the highest nibble (see chip8_decode); entries left
+ * out of the initializers are zero, i.e. OP_UNKNOWN
+ */
+const uint8_t opcode_0XXX_table[0x100] = {
+    [0xE0] = OP_00E0,
+    [0xEE] = OP_00EE,
+};
+
+const uint8_t opcode_8XYN_table[0x10] = {
+    [0x0] = OP_8XY0, [0x1] = OP_8XY1, [0x2] = OP_8XY2,
+    [0x3] = OP_8XY3, [0x4] = OP_8XY4, [0x5] = OP_8XY5,
+    [0x6] = OP_8XY6, [0x7] = OP_8XY7, [0xE] = OP_8XYE,
 };
 
-OpcodeHandler opcode_8XYN_table[0x10] = {
-    [0x0] = op_8XY0, [0x1] = op_8XY1, [0x2] = op_8XY2,
-    [0x3] = op_8XY3, [0x4] = op_8XY4, [0x5] = op_8XY5,
-    [0x6] = op_8XY6, [0x7] = op_8XY7, [0xE] = op_8XYE,
+const uint8_t opcode_EXXX_table[0x100] = {
+    [0x9E] = OP_EX9E,
+    [0xA1] = OP_EXA1,
 };
 
-OpcodeHandler opcode_EXXX_table[0x100] = {
-    [0x9E] = op_EX9E,
-    [0xA1] = op_EXA1,
+const uint8_t opcode_FXXX_table[0x100] = {
+    [0x07] = OP_FX07, [0x0A] = OP_FX0A, [0x15] = OP_FX15,
+    [0x18] = OP_FX18, [0x1E] = OP_FX1E, [0x29] = OP_FX29,
+    [0x33] = OP_FX33, [0x55] = OP_FX55, [0x65] = OP_FX65,
 };
 
-OpcodeHandler opcode_FXXX_table[0x100] = {
-    [0x07] = op_FX07, [0x0A] = op_FX0A, [0x15] = op_FX15,
-    [0x18] = op_FX18, [0x1E] = op_FX1E, [0x29] = op_FX29,
-    [0x33] = op_FX33, [0x55] = op_FX55, [0x65] = op_FX65,
+const uint8_t opcode_main_table[0x10] = {
+    [0x1] = OP_1NNN, [0x2] = OP_2NNN, [0x3] = OP_3XNN, [0x4] = OP_4XNN,
+    [0x5] = OP_5XY0, [0x6] = OP_6XNN, [0x7] = OP_7XNN, [0x9] = OP_9XY0,
+    [0xA] = OP_ANNN, [0xB] = OP_BNNN, [0xC] = OP_CXNN, [0xD] = OP_DXYN};
+
+/**
+ * FUNCTION POINTER TABLE
+ */
+const OpcodeHandler opcode_handlers[OP_COUNT] = {
+    [OP_UNKNOWN] = op_unknown, [OP_00E0] = op_00E0, [OP_00EE] = op_00EE,
+    [OP_1NNN] = op_1NNN,       [OP_2NNN] = op_2NNN, [OP_3XNN] = op_3XNN,
+    [OP_4XNN] = op_4XNN,       [OP_5XY0] = op_5XY0, [OP_6XNN] = op_6XNN,
+    [OP_7XNN] = op_7XNN,       [OP_8XY0] = op_8XY0, [OP_8XY1] = op_8XY1,
+    [OP_8XY2] = op_8XY2,       [OP_8XY3] = op_8XY3, [OP_8XY4] = op_8XY4,
+    [OP_8XY5] = op_8XY5,       [OP_8XY6] = op_8XY6, [OP_8XY7] = op_8XY7,
+    [OP_8XYE] = op_8XYE,       [OP_9XY0] = op_9XY0, [OP_ANNN] = op_ANNN,
+    [OP_BNNN] = op_BNNN,       [OP_CXNN] = op_CXNN, [OP_DXYN] = op_DXYN,
+    [OP_EX9E] = op_EX9E,       [OP_EXA1] = op_EXA1, [OP_FX07] = op_FX07,
+    [OP_FX0A] = op_FX0A,       [OP_FX15] = op_FX15, [OP_FX18] = op_FX18,
+    [OP_FX1E] = op_FX1E,       [OP_FX29] = op_FX29, [OP_FX33] = op_FX33,
+    [OP_FX55] = op_FX55,       [OP_FX65] = op_FX65,
+
+    [OP_8XY1_RESET_VF] = op_8XY1_reset_vf,
+    [OP_8XY2_RESET_VF] = op_8XY2_reset_vf,
+    [OP_8XY3_RESET_VF] = op_8XY3_reset_vf,
+    [OP_8XY6_VX] = op_8XY6_vx,
+    [OP_8XYE_VX] = op_8XYE_vx,
+    [OP_BXNN] = op_BXNN,
+    [OP_DXYN_CLIP] = op_DXYN_clip,
+    [OP_DXYN_VBLANK] = op_DXYN_vblank,
+    [OP_DXYN_VBLANK_CLIP] = op_DXYN_vblank_clip,
+    [OP_FX55_INC_I] = op_FX55_inc_i,
+    [OP_FX65_INC_I] = op_FX65_inc_i,
+
+    [OP_SUPER_LOAD_RUN] = op_super_load_run,
+    [OP_SUPER_DELAY_POLL] = op_super_delay_poll,
+    [OP_SUPER_DELAY_SPIN] = op_super_delay_spin,
+    [OP_SUPER_DRAW] = op_super_draw,
 };
 
-OpcodeHandler opcode_main_table[0x10] = {
-    [0x1] = op_1NNN, [0x2] = op_2NNN, [0x3] = op_3XNN, [0x4] = op_4XNN,
-    [0x5] = op_5XY0, [0x6] = op_6XNN, [0x7] = op_7XNN, [0x9] = op_9XY0,
-    [0xA] = op_ANNN, [0xB] = op_BNNN, [0xC] = op_CXNN, [0xD] = op_DXYN};
+/**
+ * QUIRK SPECIALIZATION
+ *
+ * the decode tables produce the quirk-free variant of each
+ * instruction; this maps it to the variant implementing the given
+ * quirks, so the choice is made once at decode time and never again
+ * when the instruction is executed
+ */
+uint8_t opcode_specialize(const Chip8Quirks *quirks, uint8_t op) {
+  switch (op) {
+  case OP_8XY1:
+    return quirks->logic_resets_vf ? OP_8XY1_RESET_VF : op;
+  case OP_8XY2:
+    return quirks->logic_resets_vf ? OP_8XY2_RESET_VF : op;
+  case OP_8XY3:
+    return quirks->logic_resets_vf ? OP_8XY3_RESET_VF : op;
+  case OP_8XY6:
+    return quirks->shift_uses_vx ? OP_8XY6_VX : op;
+  case OP_8XYE:
+    return quirks->shift_uses_vx ? OP_8XYE_VX : op;
+  case OP_BNNN:
+    return quirks->jump_uses_vx ? OP_BXNN : op;
+  case OP_DXYN:
+    if (quirks->draw_waits_for_vblank) {
+      return quirks->clip_sprites ? OP_DXYN_VBLANK_CLIP : OP_DXYN_VBLANK;
+    }
+    return quirks->clip_sprites ? OP_DXYN_CLIP : op;
+  case OP_FX55:
+    return quirks->load_store_increment_i ? OP_FX55_INC_I : op;
+  case OP_FX65:
+    return quirks->load_store_increment_i ? OP_FX65_INC_I : op;
+  default:
+    return op;
+  }
+}
+
+/**
+ * true for DXYN and all of its quirk variants
+ */
+bool opcode_is_draw(uint8_t op) {
+  return op == OP_DXYN || op == OP_DXYN_CLIP || op == OP_DXYN_VBLANK ||
+         op == OP_DXYN_VBLANK_CLIP;
+}
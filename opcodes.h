@@ -2,56 +2,137 @@
 #define OPCODES_H
 
 #include "chip8.h"
+#include <stdbool.h>
 #include <stdint.h>
 
-typedef void (*OpcodeHandler)(Chip8 *chip, uint16_t opcode);
-
-extern OpcodeHandler opcode_0XXX_table[0x100];
-extern OpcodeHandler opcode_8XYN_table[0x10];
-extern OpcodeHandler opcode_EXXX_table[0x100];
-extern OpcodeHandler opcode_FXXX_table[0x100];
-extern OpcodeHandler opcode_main_table[0x10];
-
-// NOTE: we pass in opcode so that all functions have same signature,
-// but it is unused by these two instructions
-void op_00E0(Chip8 *chip, __attribute__((unused)) uint16_t opcode);
-void op_00EE(Chip8 *chip, __attribute__((unused)) uint16_t opcode);
-
-void op_1NNN(Chip8 *chip, uint16_t opcode);
-void op_2NNN(Chip8 *chip, uint16_t opcode);
-void op_3XNN(Chip8 *chip, uint16_t opcode);
-void op_4XNN(Chip8 *chip, uint16_t opcode);
-void op_5XY0(Chip8 *chip, uint16_t opcode);
-void op_6XNN(Chip8 *chip, uint16_t opcode);
-void op_7XNN(Chip8 *chip, uint16_t opcode);
-
-void op_8XY0(Chip8 *chip, uint16_t opcode);
-void op_8XY1(Chip8 *chip, uint16_t opcode);
-void op_8XY2(Chip8 *chip, uint16_t opcode);
-void op_8XY3(Chip8 *chip, uint16_t opcode);
-void op_8XY4(Chip8 *chip, uint16_t opcode);
-void op_8XY5(Chip8 *chip, uint16_t opcode);
-void op_8XY6(Chip8 *chip, uint16_t opcode);
-void op_8XY7(Chip8 *chip, uint16_t opcode);
-void op_8XYE(Chip8 *chip, uint16_t opcode);
-
-void op_9XY0(Chip8 *chip, uint16_t opcode);
-void op_ANNN(Chip8 *chip, uint16_t opcode);
-void op_BNNN(Chip8 *chip, uint16_t opcode);
-void op_CXNN(Chip8 *chip, uint16_t opcode);
-void op_DXYN(Chip8 *chip, uint16_t opcode);
-
-void op_EX9E(Chip8 *chip, uint16_t opcode);
-void op_EXA1(Chip8 *chip, uint16_t opcode);
-
-void op_FX07(Chip8 *chip, uint16_t opcode);
-void op_FX0A(Chip8 *chip, uint16_t opcode);
-void op_FX15(Chip8 *chip, uint16_t opcode);
-void op_FX18(Chip8 *chip, uint16_t opcode);
-void op_FX1E(Chip8 *chip, uint16_t opcode);
-void op_FX29(Chip8 *chip, uint16_t opcode);
-void op_FX33(Chip8 *chip, uint16_t opcode);
-void op_FX55(Chip8 *chip, uint16_t opcode);
-void op_FX65(Chip8 *chip, uint16_t opcode);
+/**
+ * identifies each instruction of the instruction set; stored in the
+ * op field of a decoded Chip8Instruction
+ */
+typedef enum Chip8Op {
+  OP_UNKNOWN,
+  OP_00E0,
+  OP_00EE,
+  OP_1NNN,
+  OP_2NNN,
+  OP_3XNN,
+  OP_4XNN,
+  OP_5XY0,
+  OP_6XNN,
+  OP_7XNN,
+  OP_8XY0,
+  OP_8XY1,
+  OP_8XY2,
+  OP_8XY3,
+  OP_8XY4,
+  OP_8XY5,
+  OP_8XY6,
+  OP_8XY7,
+  OP_8XYE,
+  OP_9XY0,
+  OP_ANNN,
+  OP_BNNN,
+  OP_CXNN,
+  OP_DXYN,
+  OP_EX9E,
+  OP_EXA1,
+  OP_FX07,
+  OP_FX0A,
+  OP_FX15,
+  OP_FX18,
+  OP_FX1E,
+  OP_FX29,
+  OP_FX33,
+  OP_FX55,
+  OP_FX65,
+  // variants of the instructions above for non-default quirk settings
+  // (see opcode_specialize)
+  OP_8XY1_RESET_VF,
+  OP_8XY2_RESET_VF,
+  OP_8XY3_RESET_VF,
+  OP_8XY6_VX,
+  OP_8XYE_VX,
+  OP_BXNN,
+  OP_DXYN_CLIP,
+  OP_DXYN_VBLANK,
+  OP_DXYN_VBLANK_CLIP,
+  OP_FX55_INC_I,
+  OP_FX65_INC_I,
+  // superinstructions (see blocks.c)
+  OP_SUPER_LOAD_RUN,
+  OP_SUPER_DELAY_POLL,
+  OP_SUPER_DELAY_SPIN,
+  OP_SUPER_DRAW,
+  OP_COUNT
+} Chip8Op;
+
+extern const uint8_t opcode_0XXX_table[0x100];
+extern const uint8_t opcode_8XYN_table[0x10];
+extern const uint8_t opcode_EXXX_table[0x100];
+extern const uint8_t opcode_FXXX_table[0x100];
+extern const uint8_t opcode_main_table[0x10];
+
+extern const OpcodeHandler opcode_handlers[OP_COUNT];
+
+uint8_t opcode_specialize(const Chip8Quirks *quirks, uint8_t op);
+
+bool opcode_is_draw(uint8_t op);
+
+void op_unknown(Chip8 *chip, const Chip8Instruction *ins);
+
+// NOTE: we pass in the decoded instruction so that all functions have
+// same signature, but it is unused by these two instructions
+void op_00E0(Chip8 *chip,
+             __attribute__((unused)) const Chip8Instruction *ins);
+void op_00EE(Chip8 *chip,
+             __attribute__((unused)) const Chip8Instruction *ins);
+
+void op_1NNN(Chip8 *chip, const Chip8Instruction *ins);
+void op_2NNN(Chip8 *chip, const Chip8Instruction *ins);
+void op_3XNN(Chip8 *chip, const Chip8Instruction *ins);
+void op_4XNN(Chip8 *chip, const Chip8Instruction *ins);
+void op_5XY0(Chip8 *chip, const Chip8Instruction *ins);
+void op_6XNN(Chip8 *chip, const Chip8Instruction *ins);
+void op_7XNN(Chip8 *chip, const Chip8Instruction *ins);
+
+void op_8XY0(Chip8 *chip, const Chip8Instruction *ins);
+void op_8XY1(Chip8 *chip, const Chip8Instruction *ins);
+void op_8XY1_reset_vf(Chip8 *chip, const Chip8Instruction *ins);
+void op_8XY2(Chip8 *chip, const Chip8Instruction *ins);
+void op_8XY2_reset_vf(Chip8 *chip, const Chip8Instruction *ins);
+void op_8XY3(Chip8 *chip, const Chip8Instruction *ins);
+void op_8XY3_reset_vf(Chip8 *chip, const Chip8Instruction *ins);
+void op_8XY4(Chip8 *chip, const Chip8Instruction *ins);
+void op_8XY5(Chip8 *chip, const Chip8Instruction *ins);
+void op_8XY6(Chip8 *chip, const Chip8Instruction *ins);
+void op_8XY6_vx(Chip8 *chip, const Chip8Instruction *ins);
+void op_8XY7(Chip8 *chip, const Chip8Instruction *ins);
+void op_8XYE(Chip8 *chip, const Chip8Instruction *ins);
+void op_8XYE_vx(Chip8 *chip, const Chip8Instruction *ins);
+
+void op_9XY0(Chip8 *chip, const Chip8Instruction *ins);
+void op_ANNN(Chip8 *chip, const Chip8Instruction *ins);
+void op_BNNN(Chip8 *chip, const Chip8Instruction *ins);
+void op_BXNN(Chip8 *chip, const Chip8Instruction *ins);
+void op_CXNN(Chip8 *chip, const Chip8Instruction *ins);
+void op_DXYN(Chip8 *chip, const Chip8Instruction *ins);
+void op_DXYN_clip(Chip8 *chip, const Chip8Instruction *ins);
+void op_DXYN_vblank(Chip8 *chip, const Chip8Instruction *ins);
+void op_DXYN_vblank_clip(Chip8 *chip, const Chip8Instruction *ins);
+
+void op_EX9E(Chip8 *chip, const Chip8Instruction *ins);
+void op_EXA1(Chip8 *chip, const Chip8Instruction *ins);
+
+void op_FX07(Chip8 *chip, const Chip8Instruction *ins);
+void op_FX0A(Chip8 *chip, const Chip8Instruction *ins);
+void op_FX15(Chip8 *chip, const Chip8Instruction *ins);
+void op_FX18(Chip8 *chip, const Chip8Instruction *ins);
+void op_FX1E(Chip8 *chip, const Chip8Instruction *ins);
+void op_FX29(Chip8 *chip, const Chip8Instruction *ins);
+void op_FX33(Chip8 *chip, const Chip8Instruction *ins);
+void op_FX55(Chip8 *chip, const Chip8Instruction *ins);
+void op_FX55_inc_i(Chip8 *chip, const Chip8Instruction *ins);
+void op_FX65(Chip8 *chip, const Chip8Instruction *ins);
+void op_FX65_inc_i(Chip8 *chip, const Chip8Instruction *ins);
 
 #endif
@@ -0,0 +1,545 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "opcodes.h"
+#include "profile.h"
+
+/**
+ * PROFILER
+ *
+ * counts the cycles spent at every address and in every instruction
+ * class, times draws on the host, and builds a call tree from 2NNN and
+ * 00EE so cycles can be attributed to the call stack they ran in
+ *
+ * the hooks in chip8_cycle and chip8_run_cycles only exist in builds
+ * with CHIP8_PROFILE defined (make CHIP8_PROFILE=1), so other builds pay
+ * nothing; with a profile attached, an instruction costs three counter
+ * increments, and one draw in DRAW_TIMING_INTERVAL two clock reads
+ *
+ * cycles skipped by idle detection (see chip8_skip_idle) are counted at
+ * the address the chip waits at, and shown as idle in the report
+ */
+
+// call tree nodes; calls past the limit are counted in their caller
+#define MAX_NODES 4096
+#define NODE_TABLE_SIZE (2 * MAX_NODES)
+#define REPORT_HOT_SPOTS 40
+// one draw in this many is timed; reading the clock costs about as much
+// as a draw
+#define DRAW_TIMING_INTERVAL 16
+
+/**
+ * a function in the call tree, by the path of calls leading to it
+ */
+typedef struct Node {
+  uint32_t parent;
+  uint16_t addr;
+  uint64_t cycles;
+  uint64_t calls;
+} Node;
+
+struct Chip8Profile {
+  uint64_t cycles;
+  uint64_t idle_cycles;
+  uint64_t hits[MEMORY_SIZE];
+  uint64_t ops[OP_COUNT];
+
+  uint64_t draws;
+  // draws that waited for the vertical blank instead
+  uint64_t draw_waits;
+  uint64_t draw_rows;
+  uint64_t draw_collisions;
+  // host time of the timed draws
+  uint64_t draws_timed;
+  uint64_t draw_ns;
+
+  // node of the function running at each stack depth (indexed by SP)
+  // and of the one running now, and cycles counted into the call tree
+  // so far
+  uint32_t stack[256];
+  uint32_t current;
+  uint64_t charged;
+  uint32_t node_count;
+  Node nodes[MAX_NODES];
+  // open addressing table of node index + 1 by (parent, addr)
+  uint32_t node_table[NODE_TABLE_SIZE];
+};
+
+/**
+ * instructions that need more than counting
+ */
+enum {
+  KIND_PLAIN,
+  KIND_DRAW,
+  KIND_CALL,
+  KIND_RETURN,
+};
+
+static const uint8_t op_kinds[OP_COUNT] = {
+    [OP_2NNN] = KIND_CALL,
+    [OP_00EE] = KIND_RETURN,
+    [OP_DXYN] = KIND_DRAW,
+    [OP_DXYN_CLIP] = KIND_DRAW,
+    [OP_DXYN_VBLANK] = KIND_DRAW,
+    [OP_DXYN_VBLANK_CLIP] = KIND_DRAW,
+};
+
+static const char *op_names[OP_COUNT] = {
+    [OP_UNKNOWN] = "unknown",
+    [OP_00E0] = "00E0",
+    [OP_00EE] = "00EE",
+    [OP_1NNN] = "1NNN",
+    [OP_2NNN] = "2NNN",
+    [OP_3XNN] = "3XNN",
+    [OP_4XNN] = "4XNN",
+    [OP_5XY0] = "5XY0",
+    [OP_6XNN] = "6XNN",
+    [OP_7XNN] = "7XNN",
+    [OP_8XY0] = "8XY0",
+    [OP_8XY1] = "8XY1",
+    [OP_8XY2] = "8XY2",
+    [OP_8XY3] = "8XY3",
+    [OP_8XY4] = "8XY4",
+    [OP_8XY5] = "8XY5",
+    [OP_8XY6] = "8XY6",
+    [OP_8XY7] = "8XY7",
+    [OP_8XYE] = "8XYE",
+    [OP_9XY0] = "9XY0",
+    [OP_ANNN] = "ANNN",
+    [OP_BNNN] = "BNNN",
+    [OP_CXNN] = "CXNN",
+    [OP_DXYN] = "DXYN",
+    [OP_EX9E] = "EX9E",
+    [OP_EXA1] = "EXA1",
+    [OP_FX07] = "FX07",
+    [OP_FX0A] = "FX0A",
+    [OP_FX15] = "FX15",
+    [OP_FX18] = "FX18",
+    [OP_FX1E] = "FX1E",
+    [OP_FX29] = "FX29",
+    [OP_FX33] = "FX33",
+    [OP_FX55] = "FX55",
+    [OP_FX65] = "FX65",
+    [OP_8XY1_RESET_VF] = "8XY1 (VF reset)",
+    [OP_8XY2_RESET_VF] = "8XY2 (VF reset)",
+    [OP_8XY3_RESET_VF] = "8XY3 (VF reset)",
+    [OP_8XY6_VX] = "8XY6 (in place)",
+    [OP_8XYE_VX] = "8XYE (in place)",
+    [OP_BXNN] = "BXNN",
+    [OP_DXYN_CLIP] = "DXYN (clip)",
+    [OP_DXYN_VBLANK] = "DXYN (vblank)",
+    [OP_DXYN_VBLANK_CLIP] = "DXYN (vblank, clip)",
+    [OP_FX55_INC_I] = "FX55 (I += X + 1)",
+    [OP_FX65_INC_I] = "FX65 (I += X + 1)",
+    [OP_SUPER_LOAD_RUN] = "load run",
+    [OP_SUPER_DELAY_POLL] = "delay poll",
+    [OP_SUPER_DELAY_SPIN] = "delay spin",
+    [OP_SUPER_DRAW] = "draw sequence",
+};
+
+/**
+ * HELPER FUNCTIONS
+ */
+
+/**
+ * the node for a call to addr from parent, created on first use;
+ * returns parent once the tree is full
+ */
+static uint32_t child_node(Chip8Profile *profile, uint32_t parent,
+                           uint16_t addr) {
+  uint32_t key = parent * 0x9E3779B1u ^ addr;
+  for (uint32_t i = 0; i < NODE_TABLE_SIZE; i++) {
+    uint32_t *slot = &profile->node_table[(key + i) % NODE_TABLE_SIZE];
+    if (*slot) {
+      const Node *node = &profile->nodes[*slot - 1];
+      if (node->parent == parent && node->addr == addr) {
+        return *slot - 1;
+      }
+      continue;
+    }
+    if (profile->node_count == MAX_NODES) {
+      return parent;
+    }
+    uint32_t index = profile->node_count++;
+    profile->nodes[index] = (Node){.parent = parent, .addr = addr};
+    *slot = index + 1;
+    return index;
+  }
+  return parent;
+}
+
+/**
+ * cycles are counted into the running function when the call stack
+ * changes, rather than one by one
+ */
+static void charge_current(Chip8Profile *profile) {
+  profile->nodes[profile->current].cycles +=
+      profile->cycles - profile->charged;
+  profile->charged = profile->cycles;
+}
+
+static void node_name(const Chip8Profile *profile, uint32_t index,
+                      char *name, size_t size) {
+  if (index == 0) {
+    snprintf(name, size, "main");
+  } else {
+    snprintf(name, size, "sub_%03X", profile->nodes[index].addr);
+  }
+}
+
+static double percent(uint64_t part, uint64_t total) {
+  return total ? 100.0 * part / total : 0.0;
+}
+
+/**
+ * an address or instruction with its count, sorted for the reports
+ */
+typedef struct Count {
+  uint16_t key;
+  uint64_t count;
+} Count;
+
+/**
+ * qsort comparators: descending by count
+ */
+static int by_count(const void *a, const void *b) {
+  uint64_t ca = ((const Count *)a)->count;
+  uint64_t cb = ((const Count *)b)->count;
+  return (ca < cb) - (ca > cb);
+}
+
+typedef struct Edge {
+  uint16_t caller;
+  uint16_t callee;
+  bool from_main;
+  uint64_t calls;
+} Edge;
+
+static int by_edge(const void *a, const void *b) {
+  const Edge *ea = a;
+  const Edge *eb = b;
+  if (ea->from_main != eb->from_main) {
+    return eb->from_main - ea->from_main;
+  }
+  if (ea->caller != eb->caller) {
+    return ea->caller - eb->caller;
+  }
+  return ea->callee - eb->callee;
+}
+
+static int by_calls(const void *a, const void *b) {
+  const Edge *ea = a;
+  const Edge *eb = b;
+  return (ea->calls < eb->calls) - (ea->calls > eb->calls);
+}
+
+/**
+ * PROFILING
+ */
+
+Chip8Profile *chip8_profile_create(void) {
+  Chip8Profile *profile = calloc(1, sizeof(Chip8Profile));
+  if (!profile) {
+    perror("Failed to allocate profile");
+    return NULL;
+  }
+  // the root of the call tree is the code running outside any call
+  profile->node_count = 1;
+  return profile;
+}
+
+void chip8_profile_destroy(Chip8Profile *profile) { free(profile); }
+
+/**
+ * start counting the execution of a chip into a profile (NULL stops);
+ * the chip is switched to the table engine so that every instruction
+ * passes chip8_cycle
+ *
+ * returns nonzero if the profiler is not built in
+ */
+int chip8_profile_attach(Chip8 *chip, Chip8Profile *profile) {
+#ifdef CHIP8_PROFILE
+  chip->profile = profile;
+  if (profile) {
+    chip8_set_engine(chip, CHIP8_ENGINE_TABLE);
+  }
+  return 0;
+#else
+  (void)chip;
+  (void)profile;
+  fprintf(stderr, "Profiler not built in, rebuild with "
+                  "make CHIP8_PROFILE=1\n");
+  return 1;
+#endif
+}
+
+/**
+ * execute a decoded instruction, counting it (called by chip8_cycle
+ * when a profile is attached); returns its length like chip8_cycle
+ */
+uint32_t chip8_profile_execute(Chip8 *chip, Chip8Instruction *ins) {
+  Chip8Profile *profile = chip->profile;
+  uint16_t pc = chip->PC;
+  // the handler may overwrite its own entry
+  uint32_t length = ins->length;
+  uint8_t op = ins->op;
+  profile->cycles += length;
+  profile->hits[pc] += length;
+  profile->ops[op] += length;
+
+  switch (op_kinds[op]) {
+  case KIND_DRAW: {
+    uint8_t rows = ins->n;
+    if ((profile->draws + profile->draw_waits) % DRAW_TIMING_INTERVAL) {
+      ins->handler(chip, ins);
+    } else {
+      uint64_t start = chip8_time_ns();
+      ins->handler(chip, ins);
+      profile->draw_ns += chip8_time_ns() - start;
+      profile->draws_timed++;
+    }
+    if (chip->PC == pc) {
+      profile->draw_waits++;
+    } else {
+      profile->draws++;
+      profile->draw_rows += rows;
+      profile->draw_collisions += chip->V[0xF];
+    }
+    break;
+  }
+  case KIND_CALL:
+    ins->handler(chip, ins);
+    charge_current(profile);
+    profile->current = child_node(profile, profile->current, chip->PC);
+    profile->nodes[profile->current].calls++;
+    profile->stack[chip->SP] = profile->current;
+    break;
+  case KIND_RETURN:
+    charge_current(profile);
+    ins->handler(chip, ins);
+    profile->current = profile->stack[chip->SP];
+    break;
+  default:
+    ins->handler(chip, ins);
+  }
+  return length;
+}
+
+/**
+ * count cycles skipped while the chip waits idle at its program counter
+ * (called by chip8_run_cycles when a profile is attached)
+ */
+void chip8_profile_idle(Chip8 *chip, uint64_t cycles) {
+  Chip8Profile *profile = chip->profile;
+  uint16_t pc = chip->PC % MEMORY_SIZE;
+  uint8_t op = chip->decode_cache[pc >> 1].op;
+  if ((pc & 1) || !chip->decode_cache[pc >> 1].length) {
+    Chip8Instruction ins;
+    chip8_decode(chip->quirks,
+                 chip->memory[pc] << 8 | chip->memory[(pc + 1) % MEMORY_SIZE],
+                 &ins);
+    op = ins.op;
+  }
+  profile->cycles += cycles;
+  profile->idle_cycles += cycles;
+  profile->hits[pc] += cycles;
+  profile->ops[op] += cycles;
+}
+
+/**
+ * REPORTS
+ */
+
+static int write_hot_spots(const Chip8Profile *profile, FILE *file) {
+  Count *addrs = malloc(MEMORY_SIZE * sizeof(Count));
+  if (!addrs) {
+    perror("Failed to allocate hot spots");
+    return 1;
+  }
+  size_t count = 0;
+  for (uint16_t addr = 0; addr < MEMORY_SIZE; addr++) {
+    if (profile->hits[addr]) {
+      addrs[count++] = (Count){.key = addr, .count = profile->hits[addr]};
+    }
+  }
+  qsort(addrs, count, sizeof(Count), by_count);
+
+  fprintf(file, "HOT SPOTS\n");
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < count && i < REPORT_HOT_SPOTS; i++) {
+    uint64_t hits = addrs[i].count;
+    cumulative += hits;
+    fprintf(file, "  %03X  %14" PRIu64 "  %6.2f%%  %6.2f%%\n", addrs[i].key,
+            hits, percent(hits, profile->cycles),
+            percent(cumulative, profile->cycles));
+  }
+  fprintf(file, "\n");
+  free(addrs);
+  return 0;
+}
+
+static void write_opcodes(const Chip8Profile *profile, FILE *file) {
+  Count ops[OP_COUNT];
+  size_t count = 0;
+  for (uint16_t op = 0; op < OP_COUNT; op++) {
+    if (profile->ops[op]) {
+      ops[count++] = (Count){.key = op, .count = profile->ops[op]};
+    }
+  }
+  qsort(ops, count, sizeof(Count), by_count);
+
+  fprintf(file, "INSTRUCTIONS\n");
+  for (size_t i = 0; i < count; i++) {
+    uint64_t hits = ops[i].count;
+    fprintf(file, "  %-20s  %14" PRIu64 "  %6.2f%%\n", op_names[ops[i].key],
+            hits, percent(hits, profile->cycles));
+  }
+  fprintf(file, "\n");
+}
+
+static void write_draws(const Chip8Profile *profile, FILE *file) {
+  fprintf(file, "DRAWS\n");
+  fprintf(file, "  draws %" PRIu64 ", vblank waits %" PRIu64
+                ", rows %" PRIu64 ", with collision %" PRIu64 "\n",
+          profile->draws, profile->draw_waits, profile->draw_rows,
+          profile->draw_collisions);
+  // extrapolated from the timed draws
+  double ns = profile->draws_timed
+                  ? (double)profile->draw_ns / profile->draws_timed
+                  : 0.0;
+  fprintf(file, "  host time %.3f ms, %.1f ns per draw\n\n",
+          ns * (profile->draws + profile->draw_waits) / 1e6, ns);
+}
+
+/**
+ * calls between functions, merged over the call paths they occur in
+ */
+static int write_calls(const Chip8Profile *profile, FILE *file) {
+  Edge *edges = malloc(profile->node_count * sizeof(Edge));
+  if (!edges) {
+    perror("Failed to allocate call graph");
+    return 1;
+  }
+  size_t count = 0;
+  for (uint32_t i = 1; i < profile->node_count; i++) {
+    const Node *node = &profile->nodes[i];
+    edges[count++] = (Edge){
+        .caller = profile->nodes[node->parent].addr,
+        .callee = node->addr,
+        .from_main = node->parent == 0,
+        .calls = node->calls,
+    };
+  }
+  qsort(edges, count, sizeof(Edge), by_edge);
+  size_t merged = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (merged && by_edge(&edges[merged - 1], &edges[i]) == 0) {
+      edges[merged - 1].calls += edges[i].calls;
+    } else {
+      edges[merged++] = edges[i];
+    }
+  }
+  qsort(edges, merged, sizeof(Edge), by_calls);
+
+  fprintf(file, "CALLS\n");
+  for (size_t i = 0; i < merged; i++) {
+    char caller[16];
+    if (edges[i].from_main) {
+      snprintf(caller, sizeof(caller), "main");
+    } else {
+      snprintf(caller, sizeof(caller), "sub_%03X", edges[i].caller);
+    }
+    fprintf(file, "  %-8s -> sub_%03X  %14" PRIu64 "\n", caller,
+            edges[i].callee, edges[i].calls);
+  }
+  free(edges);
+  return 0;
+}
+
+/**
+ * readable report: cycles by address and by instruction, draw costs and
+ * the call graph, each sorted by count
+ */
+static int write_report(const Chip8Profile *profile, const char *path) {
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    perror("Failed to create profile report");
+    return 1;
+  }
+  fprintf(file, "cycles %" PRIu64 ", idle %" PRIu64 " (%.2f%%)\n\n",
+          profile->cycles, profile->idle_cycles,
+          percent(profile->idle_cycles, profile->cycles));
+  int err = write_hot_spots(profile, file);
+  write_opcodes(profile, file);
+  write_draws(profile, file);
+  err |= write_calls(profile, file);
+  if (ferror(file) | fclose(file)) {
+    perror("Failed to write profile report");
+    err = 1;
+  }
+  return err;
+}
+
+/**
+ * cycles of every call path in the folded stack format read by
+ * flamegraph.pl and compatible tools ("main;sub_2A0;sub_300 1234")
+ */
+static int write_folded(const Chip8Profile *profile, const char *path) {
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    perror("Failed to create folded stacks");
+    return 1;
+  }
+  for (uint32_t i = 0; i < profile->node_count; i++) {
+    uint64_t cycles = profile->nodes[i].cycles;
+    if (i == profile->current) {
+      cycles += profile->cycles - profile->charged;
+    }
+    if (!cycles) {
+      continue;
+    }
+    // paths are at most as deep as the tree is large
+    uint32_t path_nodes[MAX_NODES];
+    size_t depth = 0;
+    for (uint32_t node = i; node != 0; node = profile->nodes[node].parent) {
+      path_nodes[depth++] = node;
+    }
+    path_nodes[depth++] = 0;
+    while (depth--) {
+      char name[16];
+      node_name(profile, path_nodes[depth], name, sizeof(name));
+      fprintf(file, "%s%c", name, depth ? ';' : ' ');
+    }
+    fprintf(file, "%" PRIu64 "\n", cycles);
+  }
+  int err = 0;
+  if (ferror(file) | fclose(file)) {
+    perror("Failed to write folded stacks");
+    err = 1;
+  }
+  return err;
+}
+
+/**
+ * write the report to path and the folded stacks to path.folded; safe
+ * to call again later to overwrite both with newer counts
+ *
+ * returns nonzero if either file cannot be written
+ */
+int chip8_profile_write(const Chip8Profile *profile, const char *path) {
+  size_t size = strlen(path) + sizeof(".folded");
+  char *folded = malloc(size);
+  if (!folded) {
+    perror("Failed to allocate path");
+    return 1;
+  }
+  snprintf(folded, size, "%s.folded", path);
+  int err = write_report(profile, path) | write_folded(profile, folded);
+  free(folded);
+  return err;
+}
@@ -0,0 +1,25 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+/**
+ * per-address and per-opcode cycle counts of a run (see profile.c)
+ */
+typedef struct Chip8Profile Chip8Profile;
+
+Chip8Profile *chip8_profile_create(void);
+
+void chip8_profile_destroy(Chip8Profile *profile);
+
+int chip8_profile_attach(Chip8 *chip, Chip8Profile *profile);
+
+uint32_t chip8_profile_execute(Chip8 *chip, Chip8Instruction *ins);
+
+void chip8_profile_idle(Chip8 *chip, uint64_t cycles);
+
+int chip8_profile_write(const Chip8Profile *profile, const char *path);
+
+#endif
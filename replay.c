@@ -0,0 +1,259 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "replay.h"
+
+/**
+ * INPUT RECORDING
+ *
+ * a run is fully determined by the rom, the quirk profile, the state of
+ * the random number generator at the start and, for every key event and
+ * frame tick, the number of instructions executed before it; that is
+ * all a recording holds, so replaying it reproduces the run exactly,
+ * with none of the wall clock timing of the original
+ *
+ * file layout (integers little endian):
+ *   "C8RP", version, quirk profile name (8 bytes, NUL padded), rom hash
+ *   (8 bytes), random number generator state (8 bytes)
+ * then one record per event: a tag byte and the instructions executed
+ * since the previous record as a LEB128 varint
+ *   0x00 - 0x1F  key event: the key in the low nibble, 0x10 if released
+ *   0x20         frame tick, followed by the low 32 bits of the state
+ *                hash after the tick (see chip8_state_hash)
+ *
+ * a frame takes about 6 bytes, so an hour of play is under 2 MB
+ */
+
+#define REPLAY_VERSION 1
+#define PROFILE_NAME_SIZE 8
+#define TAG_KEY_RELEASED 0x10
+#define TAG_FRAME 0x20
+
+struct Chip8Recorder {
+  FILE *file;
+  Chip8 *chip;
+  // instruction count at the previous record
+  uint64_t cycles;
+};
+
+static const struct {
+  const char *name;
+  const Chip8Quirks *quirks;
+} profiles[] = {
+    {"vip", &chip8_quirks_vip},
+    {"schip", &chip8_quirks_schip},
+    {"xo-chip", &chip8_quirks_xochip},
+};
+
+static const char *profile_name(const Chip8Quirks *quirks) {
+  for (size_t i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++) {
+    if (memcmp(quirks, profiles[i].quirks, sizeof(Chip8Quirks)) == 0) {
+      return profiles[i].name;
+    }
+  }
+  return NULL;
+}
+
+static void write_u64(FILE *file, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    putc(value >> (8 * i) & 0xFF, file);
+  }
+}
+
+static bool read_u64(FILE *file, uint64_t *value, int bytes) {
+  *value = 0;
+  for (int i = 0; i < bytes; i++) {
+    int c = getc(file);
+    if (c == EOF) {
+      return false;
+    }
+    *value |= (uint64_t)c << (8 * i);
+  }
+  return true;
+}
+
+static void write_varint(FILE *file, uint64_t value) {
+  while (value >= 0x80) {
+    putc((value & 0x7F) | 0x80, file);
+    value >>= 7;
+  }
+  putc(value, file);
+}
+
+static bool read_varint(FILE *file, uint64_t *value) {
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int c = getc(file);
+    if (c == EOF) {
+      return false;
+    }
+    *value |= (uint64_t)(c & 0x7F) << shift;
+    if (!(c & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * start recording the input of a chip into a file; the chip must have
+ * its rom loaded but not have run yet, and stays attached to the
+ * recorder (chip->recorder) until chip8_recorder_close
+ *
+ * returns NULL if the chip has already run, uses quirks that are not a
+ * profile or the file cannot be created
+ */
+Chip8Recorder *chip8_recorder_create(const char *path, Chip8 *chip) {
+  const char *profile = profile_name(chip->quirks);
+  if (!profile) {
+    fprintf(stderr, "Only quirk profiles can be recorded\n");
+    return NULL;
+  }
+  if (chip->cycles) {
+    fprintf(stderr, "Recording must start before the chip runs\n");
+    return NULL;
+  }
+
+  Chip8Recorder *recorder = calloc(1, sizeof(Chip8Recorder));
+  if (!recorder) {
+    perror("Failed to allocate recorder");
+    return NULL;
+  }
+  recorder->file = fopen(path, "wb");
+  if (!recorder->file) {
+    perror("Failed to create recording");
+    free(recorder);
+    return NULL;
+  }
+
+  char name[PROFILE_NAME_SIZE] = {0};
+  strncpy(name, profile, PROFILE_NAME_SIZE - 1);
+  fwrite("C8RP", 1, 4, recorder->file);
+  putc(REPLAY_VERSION, recorder->file);
+  fwrite(name, 1, PROFILE_NAME_SIZE, recorder->file);
+  write_u64(recorder->file, chip->rom_hash, 8);
+  write_u64(recorder->file, chip->rng_state, 8);
+
+  recorder->chip = chip;
+  chip->recorder = recorder;
+  return recorder;
+}
+
+/**
+ * detach the recorder from its chip and finish the file; returns
+ * nonzero if anything could not be written
+ */
+int chip8_recorder_close(Chip8Recorder *recorder) {
+  if (!recorder) {
+    return 0;
+  }
+  recorder->chip->recorder = NULL;
+  int err = ferror(recorder->file);
+  if (fclose(recorder->file) || err) {
+    perror("Failed to write recording");
+    err = 1;
+  }
+  free(recorder);
+  return err;
+}
+
+/**
+ * record a key event (called by chip8_key_event)
+ */
+void chip8_recorder_key(Chip8Recorder *recorder, const Chip8 *chip,
+                        uint8_t key, Chip8EventType type) {
+  putc((key & 0xF) | (type == CHIP8_KEY_UP ? TAG_KEY_RELEASED : 0),
+       recorder->file);
+  write_varint(recorder->file, chip->cycles - recorder->cycles);
+  recorder->cycles = chip->cycles;
+}
+
+/**
+ * record a frame tick (called by chip8_frame_tick)
+ */
+void chip8_recorder_frame(Chip8Recorder *recorder, const Chip8 *chip) {
+  putc(TAG_FRAME, recorder->file);
+  write_varint(recorder->file, chip->cycles - recorder->cycles);
+  write_u64(recorder->file, chip8_state_hash(chip), 4);
+  recorder->cycles = chip->cycles;
+}
+
+/**
+ * replay a recording as fast as possible into a chip that has the
+ * recorded rom loaded but has not run yet; the quirk profile and random
+ * number generator state are taken from the recording, and the table
+ * engine is selected as it executes exactly the instructions asked for
+ *
+ * every frame's state hash is checked against the recording and the
+ * replay stops at the first one that differs (result->diverged)
+ *
+ * returns nonzero if the recording cannot be read or was made with
+ * another rom
+ */
+int chip8_replay(Chip8 *chip, const char *path, Chip8ReplayResult *result) {
+  *result = (Chip8ReplayResult){0};
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    perror("Failed to open recording");
+    return 1;
+  }
+
+  char magic[4];
+  char name[PROFILE_NAME_SIZE];
+  uint64_t rom_hash;
+  uint64_t rng_state;
+  const Chip8Quirks *quirks;
+  if (fread(magic, 1, 4, file) != 4 || memcmp(magic, "C8RP", 4) != 0 ||
+      getc(file) != REPLAY_VERSION ||
+      fread(name, 1, PROFILE_NAME_SIZE, file) != PROFILE_NAME_SIZE ||
+      name[PROFILE_NAME_SIZE - 1] != '\0' || !read_u64(file, &rom_hash, 8) ||
+      !read_u64(file, &rng_state, 8) || chip8_parse_profile(name, &quirks)) {
+    fprintf(stderr, "Not a recording: %s\n", path);
+    fclose(file);
+    return 1;
+  }
+  if (rom_hash != chip->rom_hash) {
+    fprintf(stderr, "Recording was made with another rom\n");
+    fclose(file);
+    return 1;
+  }
+
+  chip->quirks = quirks;
+  chip->rng_state = rng_state;
+  chip8_set_engine(chip, CHIP8_ENGINE_TABLE);
+
+  int err = 0;
+  int tag;
+  while ((tag = getc(file)) != EOF) {
+    uint64_t cycles;
+    uint64_t hash = 0;
+    if (!read_varint(file, &cycles) ||
+        (tag == TAG_FRAME && !read_u64(file, &hash, 4)) || tag > TAG_FRAME) {
+      fprintf(stderr, "Corrupt recording: %s\n", path);
+      err = 1;
+      break;
+    }
+    if (cycles) {
+      chip8_run_cycles(chip, cycles);
+    }
+    if (tag != TAG_FRAME) {
+      chip8_key_event(chip, tag & 0xF,
+                      tag & TAG_KEY_RELEASED ? CHIP8_KEY_UP : CHIP8_KEY_DOWN);
+      continue;
+    }
+    chip8_frame_tick(chip);
+    result->frames++;
+    if ((uint32_t)chip8_state_hash(chip) != hash) {
+      result->diverged = true;
+      break;
+    }
+  }
+
+  result->cycles = chip->cycles;
+  fclose(file);
+  return err;
+}
@@ -0,0 +1,36 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+/**
+ * writes the input of a run to a file as it happens (see replay.c)
+ */
+typedef struct Chip8Recorder Chip8Recorder;
+
+/**
+ * how far a replay got
+ */
+typedef struct Chip8ReplayResult {
+  uint64_t frames;
+  uint64_t cycles;
+  // the state hash of a frame did not match the recording; replay
+  // stopped after that frame
+  bool diverged;
+} Chip8ReplayResult;
+
+Chip8Recorder *chip8_recorder_create(const char *path, Chip8 *chip);
+
+int chip8_recorder_close(Chip8Recorder *recorder);
+
+void chip8_recorder_key(Chip8Recorder *recorder, const Chip8 *chip,
+                        uint8_t key, Chip8EventType type);
+
+void chip8_recorder_frame(Chip8Recorder *recorder, const Chip8 *chip);
+
+int chip8_replay(Chip8 *chip, const char *path, Chip8ReplayResult *result);
+
+#endif
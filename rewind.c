@@ -0,0 +1,330 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "rewind.h"
+
+/**
+ * REWIND
+ *
+ * the state of every frame (see chip8_snapshot) is recorded as the
+ * difference to the frame before: the two states are XORed word by word
+ * and the result stored as runs of changed words, so a frame that only
+ * moved a sprite and ticked the timers takes a few dozen bytes instead
+ * of the whole state
+ *
+ * the runs are kept in a ring buffer of fixed size, oldest dropped
+ * first; besides the ring only the state at the cursor is kept. XOR is
+ * its own inverse, so the same difference leads from a frame to the one
+ * before and back again: stepping either way decodes one entry, however
+ * long the history
+ *
+ * recording after stepping back discards the frames that were ahead of
+ * the cursor, like undo
+ */
+
+#define STATE_WORDS (sizeof(Chip8State) / sizeof(uint64_t))
+// largest encoded difference: every word changed, in as many runs as
+// there can be
+#define MAX_DELTA                                                              \
+  (STATE_WORDS * sizeof(uint64_t) + (STATE_WORDS / 2 + 1) * sizeof(Run))
+
+/**
+ * header of a run of changed words, followed by the XORed words
+ */
+typedef struct Run {
+  // unchanged words before the run
+  uint16_t skip;
+  uint16_t count;
+} Run;
+
+/**
+ * a state viewed as words for XORing (padding bytes stay zero, as the
+ * buffers start zeroed and chip8_snapshot never writes them)
+ */
+typedef union StateWords {
+  Chip8State state;
+  uint64_t words[STATE_WORDS];
+} StateWords;
+
+_Static_assert(sizeof(Chip8State) % sizeof(uint64_t) == 0,
+               "Chip8State must be a whole number of words");
+
+/**
+ * entries are stored as their size, the runs and the size again, so the
+ * ring can be walked in both directions; positions only grow and are
+ * taken modulo the capacity
+ */
+struct Chip8Rewind {
+  uint8_t *ring;
+  uint64_t capacity;
+  uint64_t tail;
+  uint64_t head;
+  uint64_t cursor;
+  // entries between tail and head, and between tail and cursor
+  uint64_t entries;
+  uint64_t position;
+  bool recording;
+  // state at the cursor, and the buffer the next frame is recorded into
+  StateWords *current;
+  StateWords *next;
+  StateWords states[2];
+  uint8_t delta[MAX_DELTA];
+};
+
+/**
+ * HELPER FUNCTIONS
+ */
+
+static void ring_write(Chip8Rewind *rewind, uint64_t pos, const void *src,
+                       size_t len) {
+  size_t at = pos % rewind->capacity;
+  size_t first = len < rewind->capacity - at ? len : rewind->capacity - at;
+  memcpy(&rewind->ring[at], src, first);
+  memcpy(rewind->ring, (const uint8_t *)src + first, len - first);
+}
+
+static void ring_read(const Chip8Rewind *rewind, uint64_t pos, void *dst,
+                      size_t len) {
+  size_t at = pos % rewind->capacity;
+  size_t first = len < rewind->capacity - at ? len : rewind->capacity - at;
+  memcpy(dst, &rewind->ring[at], first);
+  memcpy((uint8_t *)dst + first, rewind->ring, len - first);
+}
+
+/**
+ * encode the difference of two states into out; returns its size
+ */
+static uint32_t encode_delta(const uint64_t *from, const uint64_t *to,
+                             uint8_t *out) {
+  uint32_t size = 0;
+  size_t w = 0;
+  while (w < STATE_WORDS) {
+    size_t unchanged = w;
+    while (w < STATE_WORDS && from[w] == to[w]) {
+      w++;
+    }
+    if (w == STATE_WORDS) {
+      break;
+    }
+    size_t changed = w;
+    while (w < STATE_WORDS && from[w] != to[w]) {
+      w++;
+    }
+    Run run = {.skip = changed - unchanged, .count = w - changed};
+    memcpy(&out[size], &run, sizeof(run));
+    size += sizeof(run);
+    for (size_t i = changed; i < w; i++) {
+      uint64_t word = from[i] ^ to[i];
+      memcpy(&out[size], &word, sizeof(word));
+      size += sizeof(word);
+    }
+  }
+  return size;
+}
+
+static void apply_delta(const uint8_t *delta, uint32_t size,
+                        uint64_t *words) {
+  size_t w = 0;
+  for (uint32_t at = 0; at < size;) {
+    Run run;
+    memcpy(&run, &delta[at], sizeof(run));
+    at += sizeof(run);
+    w += run.skip;
+    for (int i = 0; i < run.count; i++, w++) {
+      uint64_t word;
+      memcpy(&word, &delta[at], sizeof(word));
+      at += sizeof(word);
+      words[w] ^= word;
+    }
+  }
+}
+
+static void drop_oldest(Chip8Rewind *rewind) {
+  uint32_t size;
+  ring_read(rewind, rewind->tail, &size, sizeof(size));
+  rewind->tail += size + 2 * sizeof(size);
+  rewind->entries--;
+  rewind->position--;
+}
+
+/**
+ * move the cursor one frame back, updating the state at the cursor;
+ * returns false at the oldest frame
+ */
+static bool move_back(Chip8Rewind *rewind) {
+  if (rewind->cursor == rewind->tail) {
+    return false;
+  }
+  uint32_t size;
+  ring_read(rewind, rewind->cursor - sizeof(size), &size, sizeof(size));
+  rewind->cursor -= size + 2 * sizeof(size);
+  ring_read(rewind, rewind->cursor + sizeof(size), rewind->delta, size);
+  apply_delta(rewind->delta, size, rewind->current->words);
+  rewind->position--;
+  return true;
+}
+
+/**
+ * move the cursor one frame forward; returns false at the newest frame
+ */
+static bool move_forward(Chip8Rewind *rewind) {
+  if (rewind->cursor == rewind->head) {
+    return false;
+  }
+  uint32_t size;
+  ring_read(rewind, rewind->cursor, &size, sizeof(size));
+  ring_read(rewind, rewind->cursor + sizeof(size), rewind->delta, size);
+  apply_delta(rewind->delta, size, rewind->current->words);
+  rewind->cursor += size + 2 * sizeof(size);
+  rewind->position++;
+  return true;
+}
+
+/**
+ * create a rewind buffer keeping as many frames as fit in the given
+ * number of bytes (a few dozen to a few hundred bytes per frame, so a
+ * few MB hold minutes); returns NULL if memory runs out
+ */
+Chip8Rewind *chip8_rewind_create(size_t bytes) {
+  Chip8Rewind *rewind = calloc(1, sizeof(Chip8Rewind));
+  if (!rewind) {
+    perror("Failed to allocate rewind buffer");
+    return NULL;
+  }
+  rewind->ring = malloc(bytes);
+  if (!rewind->ring) {
+    perror("Failed to allocate rewind buffer");
+    free(rewind);
+    return NULL;
+  }
+  rewind->capacity = bytes;
+  rewind->current = &rewind->states[0];
+  rewind->next = &rewind->states[1];
+  return rewind;
+}
+
+void chip8_rewind_destroy(Chip8Rewind *rewind) {
+  if (rewind) {
+    free(rewind->ring);
+    free(rewind);
+  }
+}
+
+/**
+ * forget all recorded frames
+ */
+void chip8_rewind_clear(Chip8Rewind *rewind) {
+  rewind->tail = rewind->head = rewind->cursor = 0;
+  rewind->entries = rewind->position = 0;
+  rewind->recording = false;
+}
+
+/**
+ * record the state of the chip as the newest frame, dropping the
+ * oldest frames if the buffer is full and any frames ahead of the
+ * cursor
+ */
+void chip8_rewind_record(Chip8Rewind *rewind, const Chip8 *chip) {
+  chip8_snapshot(chip, &rewind->next->state);
+  StateWords *recorded = rewind->next;
+  rewind->next = rewind->current;
+  rewind->current = recorded;
+  if (!rewind->recording) {
+    rewind->recording = true;
+    return;
+  }
+
+  rewind->head = rewind->cursor;
+  rewind->entries = rewind->position;
+  uint32_t size =
+      encode_delta(rewind->next->words, rewind->current->words, rewind->delta);
+  uint64_t needed = size + 2 * sizeof(size);
+  if (needed > rewind->capacity) {
+    // not even one frame fits: history starts over here
+    rewind->tail = rewind->head;
+    rewind->entries = rewind->position = 0;
+    return;
+  }
+  while (rewind->capacity - (rewind->head - rewind->tail) < needed) {
+    drop_oldest(rewind);
+  }
+  ring_write(rewind, rewind->head, &size, sizeof(size));
+  ring_write(rewind, rewind->head + sizeof(size), rewind->delta, size);
+  ring_write(rewind, rewind->head + sizeof(size) + size, &size, sizeof(size));
+  rewind->head += needed;
+  rewind->cursor = rewind->head;
+  rewind->entries++;
+  rewind->position++;
+}
+
+/**
+ * put the chip into the state of the frame before the cursor (see
+ * chip8_restore); returns nonzero, leaving the chip alone, at the
+ * oldest frame
+ */
+int chip8_rewind_back(Chip8Rewind *rewind, Chip8 *chip) {
+  if (!move_back(rewind)) {
+    return 1;
+  }
+  chip8_restore(chip, &rewind->current->state);
+  return 0;
+}
+
+/**
+ * put the chip into the state of the frame after the cursor; returns
+ * nonzero, leaving the chip alone, at the newest frame
+ */
+int chip8_rewind_forward(Chip8Rewind *rewind, Chip8 *chip) {
+  if (!move_forward(rewind)) {
+    return 1;
+  }
+  chip8_restore(chip, &rewind->current->state);
+  return 0;
+}
+
+/**
+ * put the chip into the state of a recorded frame, counted from the
+ * oldest one (e.g. to bisect over the history); takes time proportional
+ * to the distance from the cursor
+ *
+ * returns nonzero, leaving the chip alone, if the frame is not recorded
+ */
+int chip8_rewind_seek(Chip8Rewind *rewind, Chip8 *chip, uint64_t frame) {
+  if (frame >= chip8_rewind_length(rewind)) {
+    return 1;
+  }
+  while (rewind->position > frame) {
+    move_back(rewind);
+  }
+  while (rewind->position < frame) {
+    move_forward(rewind);
+  }
+  chip8_restore(chip, &rewind->current->state);
+  return 0;
+}
+
+/**
+ * number of recorded frames
+ */
+uint64_t chip8_rewind_length(const Chip8Rewind *rewind) {
+  return rewind->recording ? rewind->entries + 1 : 0;
+}
+
+/**
+ * the frame at the cursor, counted from the oldest one
+ */
+uint64_t chip8_rewind_position(const Chip8Rewind *rewind) {
+  return rewind->position;
+}
+
+/**
+ * bytes of the ring buffer holding recorded frames
+ */
+uint64_t chip8_rewind_bytes_used(const Chip8Rewind *rewind) {
+  return rewind->head - rewind->tail;
+}
@@ -0,0 +1,35 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+/**
+ * a ring buffer of per-frame states for stepping back and forth through
+ * execution history (see rewind.c)
+ */
+typedef struct Chip8Rewind Chip8Rewind;
+
+Chip8Rewind *chip8_rewind_create(size_t bytes);
+
+void chip8_rewind_destroy(Chip8Rewind *rewind);
+
+void chip8_rewind_clear(Chip8Rewind *rewind);
+
+void chip8_rewind_record(Chip8Rewind *rewind, const Chip8 *chip);
+
+int chip8_rewind_back(Chip8Rewind *rewind, Chip8 *chip);
+
+int chip8_rewind_forward(Chip8Rewind *rewind, Chip8 *chip);
+
+int chip8_rewind_seek(Chip8Rewind *rewind, Chip8 *chip, uint64_t frame);
+
+uint64_t chip8_rewind_length(const Chip8Rewind *rewind);
+
+uint64_t chip8_rewind_position(const Chip8Rewind *rewind);
+
+uint64_t chip8_rewind_bytes_used(const Chip8Rewind *rewind);
+
+#endif
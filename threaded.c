@@ -0,0 +1,318 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "opcodes.h"
+#include "threaded.h"
+
+/**
+ * direct threaded interpreter
+ *
+ * runs from the same decode cache as table dispatch, but instead of an
+ * indirect call through the entry's handler, every instruction body
+ * ends with its own copy of the dispatch code jumping straight to the
+ * body of the next instruction (labels as values, a GCC/Clang
+ * extension); each copy gets its own slot in the branch predictor, and
+ * there is no call, return or shared switch on the hot path
+ *
+ * the simple register, timer and branch instructions are inlined
+ * below with the semantics of their handlers in opcodes.c (including
+ * one body per quirk variant, see opcode_specialize); draw, load/store
+ * and the other memory heavy instructions call the handler
+ *
+ * builds without computed goto support (or with CHIP8_NO_COMPUTED_GOTO
+ * defined) leave the engine unavailable and chip8_set_engine falls back
+ * to table dispatch
+ */
+
+#if defined(__GNUC__) && !defined(CHIP8_NO_COMPUTED_GOTO)
+
+bool chip8_threaded_available(void) { return true; }
+
+uint64_t chip8_threaded_run(Chip8 *chip, uint64_t cycles) {
+  static const void *const labels[OP_COUNT] = {
+      [OP_UNKNOWN] = &&do_handler, [OP_00E0] = &&do_00E0,
+      [OP_00EE] = &&do_00EE,       [OP_1NNN] = &&do_1NNN,
+      [OP_2NNN] = &&do_2NNN,       [OP_3XNN] = &&do_3XNN,
+      [OP_4XNN] = &&do_4XNN,       [OP_5XY0] = &&do_5XY0,
+      [OP_6XNN] = &&do_6XNN,       [OP_7XNN] = &&do_7XNN,
+      [OP_8XY0] = &&do_8XY0,       [OP_8XY1] = &&do_8XY1,
+      [OP_8XY2] = &&do_8XY2,       [OP_8XY3] = &&do_8XY3,
+      [OP_8XY4] = &&do_8XY4,       [OP_8XY5] = &&do_8XY5,
+      [OP_8XY6] = &&do_8XY6,       [OP_8XY7] = &&do_8XY7,
+      [OP_8XYE] = &&do_8XYE,       [OP_9XY0] = &&do_9XY0,
+      [OP_ANNN] = &&do_ANNN,       [OP_BNNN] = &&do_handler,
+      [OP_CXNN] = &&do_CXNN,       [OP_DXYN] = &&do_DXYN,
+      [OP_EX9E] = &&do_EX9E,       [OP_EXA1] = &&do_EXA1,
+      [OP_FX07] = &&do_FX07,       [OP_FX0A] = &&do_FX0A,
+      [OP_FX15] = &&do_FX15,       [OP_FX18] = &&do_FX18,
+      [OP_FX1E] = &&do_FX1E,       [OP_FX29] = &&do_FX29,
+      [OP_FX33] = &&do_handler,    [OP_FX55] = &&do_handler,
+      [OP_FX65] = &&do_handler,
+      [OP_8XY1_RESET_VF] = &&do_8XY1_reset_vf,
+      [OP_8XY2_RESET_VF] = &&do_8XY2_reset_vf,
+      [OP_8XY3_RESET_VF] = &&do_8XY3_reset_vf,
+      [OP_8XY6_VX] = &&do_8XY6_vx,
+      [OP_8XYE_VX] = &&do_8XYE_vx,
+      [OP_BXNN] = &&do_handler,
+      [OP_DXYN_CLIP] = &&do_DXYN,
+      [OP_DXYN_VBLANK] = &&do_DXYN,
+      [OP_DXYN_VBLANK_CLIP] = &&do_DXYN,
+      [OP_FX55_INC_I] = &&do_handler,
+      [OP_FX65_INC_I] = &&do_handler,
+      // superinstructions are only decoded by the block engine
+      [OP_SUPER_LOAD_RUN] = &&do_handler,
+      [OP_SUPER_DELAY_POLL] = &&do_handler,
+      [OP_SUPER_DELAY_SPIN] = &&do_handler,
+      [OP_SUPER_DRAW] = &&do_handler,
+  };
+
+  uint8_t *const V = chip->V;
+  uint64_t executed = 0;
+  Chip8Instruction *ins;
+  uint16_t pc;
+
+  if (chip->FX0A_waiting) {
+    return cycles;
+  }
+
+  // fetch the cached instruction at PC and jump to its body; odd or out
+  // of range addresses (never cached) and cold entries go the slow way
+#define DISPATCH()                                                             \
+  do {                                                                         \
+    if (executed >= cycles) {                                                  \
+      return executed;                                                         \
+    }                                                                          \
+    pc = chip->PC;                                                             \
+    if ((pc & 1) || pc >= MEMORY_SIZE) {                                       \
+      goto uncached;                                                           \
+    }                                                                          \
+    ins = &chip->decode_cache[pc >> 1];                                        \
+    if (!ins->length) {                                                        \
+      goto decode;                                                             \
+    }                                                                          \
+    goto *labels[ins->op];                                                     \
+  } while (0)
+
+#define NEXT(advance)                                                          \
+  do {                                                                         \
+    chip->PC += (advance);                                                     \
+    executed++;                                                                \
+    DISPATCH();                                                                \
+  } while (0)
+
+  DISPATCH();
+
+uncached:
+  chip8_decode_execute(chip, chip8_fetch(chip));
+  executed++;
+  if (chip->FX0A_waiting) {
+    return cycles;
+  }
+  DISPATCH();
+
+decode:
+  chip8_decode(chip->quirks, chip8_fetch(chip), ins);
+  goto *labels[ins->op];
+
+do_handler: {
+  // read the length first: the handler may overwrite (and so
+  // invalidate) its own entry
+  uint32_t length = ins->length;
+  ins->handler(chip, ins);
+  executed += length;
+  DISPATCH();
+}
+
+do_00E0:
+  memset(chip->display, 0, sizeof(chip->display));
+  chip->draw_flag = true;
+  NEXT(2);
+
+do_00EE:
+  chip->PC = chip->stack[chip->SP];
+  chip->SP--;
+  NEXT(0);
+
+do_1NNN:
+  chip->PC = ins->nnn;
+  if (ins->nnn == pc || ins->nnn + 4 == pc) {
+    // the back edge of what may be an idle wait
+    executed++;
+    if (executed < cycles) {
+      executed += chip8_skip_idle(chip, cycles - executed);
+    }
+    DISPATCH();
+  }
+  NEXT(0);
+
+do_2NNN:
+  chip->SP++;
+  chip->stack[chip->SP] = chip->PC + 2;
+  chip->PC = ins->nnn;
+  NEXT(0);
+
+do_3XNN:
+  NEXT(V[ins->x] == ins->nn ? 4 : 2);
+
+do_4XNN:
+  NEXT(V[ins->x] != ins->nn ? 4 : 2);
+
+do_5XY0:
+  NEXT(V[ins->x] == V[ins->y] ? 4 : 2);
+
+do_6XNN:
+  V[ins->x] = ins->nn;
+  NEXT(2);
+
+do_7XNN:
+  V[ins->x] += ins->nn;
+  NEXT(2);
+
+do_8XY0:
+  V[ins->x] = V[ins->y];
+  NEXT(2);
+
+do_8XY1:
+  V[ins->x] |= V[ins->y];
+  NEXT(2);
+
+do_8XY1_reset_vf:
+  V[ins->x] |= V[ins->y];
+  V[0xF] = 0;
+  NEXT(2);
+
+do_8XY2:
+  V[ins->x] &= V[ins->y];
+  NEXT(2);
+
+do_8XY2_reset_vf:
+  V[ins->x] &= V[ins->y];
+  V[0xF] = 0;
+  NEXT(2);
+
+do_8XY3:
+  V[ins->x] ^= V[ins->y];
+  NEXT(2);
+
+do_8XY3_reset_vf:
+  V[ins->x] ^= V[ins->y];
+  V[0xF] = 0;
+  NEXT(2);
+
+do_8XY4: {
+  uint16_t res = V[ins->x] + V[ins->y];
+  V[ins->x] = res;
+  V[0xF] = res >> 8;
+  NEXT(2);
+}
+
+do_8XY5: {
+  uint16_t res = V[ins->x] - V[ins->y];
+  V[ins->x] = res;
+  V[0xF] = res <= 255;
+  NEXT(2);
+}
+
+do_8XY6: {
+  uint8_t carry = V[ins->y] & 1;
+  V[ins->x] = V[ins->y] >> 1;
+  V[0xF] = carry;
+  NEXT(2);
+}
+
+do_8XY6_vx: {
+  uint8_t carry = V[ins->x] & 1;
+  V[ins->x] >>= 1;
+  V[0xF] = carry;
+  NEXT(2);
+}
+
+do_8XY7: {
+  uint16_t res = V[ins->y] - V[ins->x];
+  V[ins->x] = res;
+  V[0xF] = res <= 255;
+  NEXT(2);
+}
+
+do_8XYE: {
+  uint8_t carry = V[ins->y] >> 7;
+  V[ins->x] = V[ins->y] << 1;
+  V[0xF] = carry;
+  NEXT(2);
+}
+
+do_8XYE_vx: {
+  uint8_t carry = V[ins->x] >> 7;
+  V[ins->x] <<= 1;
+  V[0xF] = carry;
+  NEXT(2);
+}
+
+do_9XY0:
+  NEXT(V[ins->x] != V[ins->y] ? 4 : 2);
+
+do_ANNN:
+  chip->I = ins->nnn;
+  NEXT(2);
+
+do_CXNN:
+  V[ins->x] = chip8_random(chip) & ins->nn;
+  NEXT(2);
+
+do_DXYN:
+  ins->handler(chip, ins);
+  if (chip->PC == pc) {
+    // throttled until the next frame: the draw would be retried for the
+    // rest of the budget without changing any state
+    return cycles;
+  }
+  executed++;
+  DISPATCH();
+
+do_EX9E:
+  NEXT(chip->keypad[V[ins->x] & 0xF] ? 4 : 2);
+
+do_EXA1:
+  NEXT(!chip->keypad[V[ins->x] & 0xF] ? 4 : 2);
+
+do_FX07:
+  V[ins->x] = chip->delay_timer;
+  NEXT(2);
+
+do_FX0A:
+  // waiting for a key consumes the rest of the budget
+  op_FX0A(chip, ins);
+  return cycles;
+
+do_FX15:
+  chip->delay_timer = V[ins->x];
+  NEXT(2);
+
+do_FX18:
+  chip->sound_timer = V[ins->x];
+  NEXT(2);
+
+do_FX1E:
+  chip->I += V[ins->x];
+  NEXT(2);
+
+do_FX29:
+  chip->I = FONT_START + FONT_SIZE_BYTES * (V[ins->x] & 0x0F);
+  NEXT(2);
+
+#undef NEXT
+#undef DISPATCH
+}
+
+#else
+
+bool chip8_threaded_available(void) { return false; }
+
+uint64_t chip8_threaded_run(__attribute__((unused)) Chip8 *chip,
+                            uint64_t cycles) {
+  return cycles;
+}
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef THREADED_H
+#define THREADED_H
+
+#include "chip8.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+bool chip8_threaded_available(void);
+
+uint64_t chip8_threaded_run(Chip8 *chip, uint64_t cycles);
+
+#endif
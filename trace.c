@@ -0,0 +1,313 @@
+#define _DEFAULT_SOURCE
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chip8.h"
+#include "trace.h"
+
+/**
+ * INSTRUCTION TRACE
+ *
+ * with a trace attached, chip8_cycle appends one fixed size record per
+ * executed instruction to a ring buffer: the cycle it started at, its
+ * address and opcode, and after it ran I, VX (X from the opcode) and VF,
+ * which between them cover what almost every instruction changes
+ *
+ * the emulation thread is the only writer and never waits: a record is
+ * two relaxed stores and two counter updates, cheap enough to leave the
+ * trace on at full speed; the ring is drained into the file by a
+ * background writer thread or on demand (chip8_trace_flush); if the
+ * emulation laps the reader, the oldest records are overwritten and the
+ * file gets a marker saying how many were lost
+ *
+ * the writer publishes `claimed` before overwriting a slot and
+ * `published` after, so the reader can tell which of the records it
+ * copied may have been overwritten while it did (a sequence lock over
+ * the whole ring) and drops those rather than writing torn records
+ *
+ * traced instructions go through chip8_cycle, so attaching selects the
+ * table engine in place of the jit and threaded ones; with the block
+ * engine, a superinstruction is one record of its first instruction
+ *
+ * file layout (integers little endian):
+ *   "C8TR", version, three zero bytes
+ * then CHIP8_TRACE_RECORD_SIZE bytes per record: cycle (8 bytes), PC,
+ * opcode, I (2 bytes each), VX, VF; a record with cycle
+ * CHIP8_TRACE_LOST holds the number of instructions lost in place of
+ * the rest
+ */
+
+// records copied out of the ring per write
+#define FLUSH_BATCH 4096
+#define WRITER_INTERVAL_NS 5000000
+
+/**
+ * a record as stored in the ring: the cycle, and PC, opcode, I, VX and
+ * VF packed into one word (in that order from the low bits)
+ */
+typedef struct Slot {
+  _Atomic uint64_t cycle;
+  _Atomic uint64_t state;
+} Slot;
+
+struct Chip8Trace {
+  Slot *ring;
+  uint64_t mask;
+
+  // emulation thread only: next record and cycle count
+  uint64_t next;
+  uint64_t cycle;
+  // records the emulation thread has started and finished writing
+  _Atomic uint64_t claimed;
+  _Atomic uint64_t published;
+
+  // reader side, under lock
+  pthread_mutex_t lock;
+  FILE *file;
+  uint64_t read;
+  int err;
+
+  bool background;
+  pthread_t writer;
+  _Atomic bool stopping;
+};
+
+static void put_u64(uint8_t *out, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    out[i] = value >> (8 * i) & 0xFF;
+  }
+}
+
+static void write_lost(Chip8Trace *trace, uint64_t lost) {
+  uint8_t record[CHIP8_TRACE_RECORD_SIZE];
+  put_u64(record, CHIP8_TRACE_LOST, 8);
+  put_u64(record + 8, lost, 8);
+  fwrite(record, 1, sizeof(record), trace->file);
+}
+
+/**
+ * drain the ring into the file; the caller holds the lock
+ */
+static void flush_locked(Chip8Trace *trace) {
+  uint64_t capacity = trace->mask + 1;
+  uint64_t lost = 0;
+  for (;;) {
+    uint64_t end =
+        atomic_load_explicit(&trace->published, memory_order_acquire);
+    uint64_t start = trace->read;
+    if (end - start > capacity) {
+      lost += end - capacity - start;
+      start = end - capacity;
+    }
+    if (start == end) {
+      break;
+    }
+    if (end - start > FLUSH_BATCH) {
+      end = start + FLUSH_BATCH;
+    }
+
+    uint8_t out[FLUSH_BATCH * CHIP8_TRACE_RECORD_SIZE];
+    for (uint64_t i = start; i < end; i++) {
+      Slot *slot = &trace->ring[i & trace->mask];
+      uint8_t *record = &out[(i - start) * CHIP8_TRACE_RECORD_SIZE];
+      put_u64(record,
+              atomic_load_explicit(&slot->cycle, memory_order_relaxed), 8);
+      put_u64(record + 8,
+              atomic_load_explicit(&slot->state, memory_order_relaxed), 8);
+    }
+    // records older than a ring behind the newest claimed one may have
+    // been overwritten while they were copied
+    atomic_thread_fence(memory_order_acquire);
+    uint64_t claimed =
+        atomic_load_explicit(&trace->claimed, memory_order_relaxed);
+    uint64_t valid = start;
+    if (claimed - start > capacity) {
+      valid = claimed - capacity < end ? claimed - capacity : end;
+      lost += valid - start;
+    }
+
+    if (lost) {
+      write_lost(trace, lost);
+      lost = 0;
+    }
+    fwrite(&out[(valid - start) * CHIP8_TRACE_RECORD_SIZE],
+           CHIP8_TRACE_RECORD_SIZE, end - valid, trace->file);
+    trace->read = end;
+  }
+  if (lost) {
+    write_lost(trace, lost);
+  }
+}
+
+static void *writer_main(void *arg) {
+  Chip8Trace *trace = arg;
+  struct timespec interval = {0, WRITER_INTERVAL_NS};
+  while (!atomic_load_explicit(&trace->stopping, memory_order_relaxed)) {
+    nanosleep(&interval, NULL);
+    chip8_trace_flush(trace);
+  }
+  return NULL;
+}
+
+/**
+ * create a trace writing into a file, with room for the given number of
+ * records (rounded up to a power of two) between flushes; with
+ * background set, a writer thread flushes it every few milliseconds
+ *
+ * returns NULL if the file cannot be created
+ */
+Chip8Trace *chip8_trace_create(const char *path, size_t records,
+                               bool background) {
+  Chip8Trace *trace = calloc(1, sizeof(Chip8Trace));
+  if (!trace) {
+    perror("Failed to allocate trace");
+    return NULL;
+  }
+  uint64_t capacity = 1;
+  while (capacity < records) {
+    capacity <<= 1;
+  }
+  trace->ring = calloc(capacity, sizeof(Slot));
+  if (!trace->ring) {
+    perror("Failed to allocate trace");
+    free(trace);
+    return NULL;
+  }
+  trace->mask = capacity - 1;
+  trace->file = fopen(path, "wb");
+  if (!trace->file) {
+    perror("Failed to create trace");
+    free(trace->ring);
+    free(trace);
+    return NULL;
+  }
+  fwrite("C8TR", 1, 4, trace->file);
+  uint8_t version[4] = {CHIP8_TRACE_VERSION};
+  fwrite(version, 1, sizeof(version), trace->file);
+  pthread_mutex_init(&trace->lock, NULL);
+
+  if (background) {
+    // signals are for the application's threads, not the writer
+    sigset_t all;
+    sigset_t old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int err = pthread_create(&trace->writer, NULL, writer_main, trace);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err) {
+      fprintf(stderr, "Failed to start trace writer: %s\n", strerror(err));
+      fclose(trace->file);
+      pthread_mutex_destroy(&trace->lock);
+      free(trace->ring);
+      free(trace);
+      return NULL;
+    }
+    trace->background = true;
+  }
+  return trace;
+}
+
+/**
+ * stop the writer, flush what is left and close the file; the trace
+ * must have been detached from its chip (chip8_trace_attach(chip, NULL))
+ * or the chip must no longer run
+ */
+void chip8_trace_destroy(Chip8Trace *trace) {
+  if (!trace) {
+    return;
+  }
+  if (trace->background) {
+    atomic_store_explicit(&trace->stopping, true, memory_order_relaxed);
+    pthread_join(trace->writer, NULL);
+  }
+  chip8_trace_flush(trace);
+  if (fclose(trace->file) || trace->err) {
+    perror("Failed to write trace");
+  }
+  pthread_mutex_destroy(&trace->lock);
+  free(trace->ring);
+  free(trace);
+}
+
+/**
+ * start tracing a chip's instructions (NULL stops); cycles are counted
+ * from the chip's instruction count at the time
+ *
+ * returns nonzero if a profile is attached, as it takes the same hook
+ */
+int chip8_trace_attach(Chip8 *chip, Chip8Trace *trace) {
+  if (trace && chip->profile) {
+    fprintf(stderr, "Cannot trace and profile at the same time\n");
+    return 1;
+  }
+  chip->trace = trace;
+  if (trace) {
+    trace->cycle = chip->cycles;
+    if (chip->engine == CHIP8_ENGINE_JIT ||
+        chip->engine == CHIP8_ENGINE_THREADED) {
+      chip8_set_engine(chip, CHIP8_ENGINE_TABLE);
+    }
+  }
+  return 0;
+}
+
+/**
+ * execute a decoded instruction, recording it (called by chip8_cycle
+ * when a trace is attached); returns its length like chip8_cycle
+ */
+uint32_t chip8_trace_execute(Chip8 *chip, Chip8Instruction *ins) {
+  Chip8Trace *trace = chip->trace;
+  uint16_t pc = chip->PC;
+  uint16_t opcode = chip->memory[pc] << 8 | chip->memory[pc + 1];
+  // the handler may overwrite its own entry
+  uint32_t length = ins->length;
+  ins->handler(chip, ins);
+
+  uint64_t index = trace->next++;
+  atomic_store_explicit(&trace->claimed, index + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  Slot *slot = &trace->ring[index & trace->mask];
+  atomic_store_explicit(&slot->cycle, trace->cycle, memory_order_relaxed);
+  atomic_store_explicit(&slot->state,
+                        pc | (uint64_t)opcode << 16 |
+                            (uint64_t)chip->I << 32 |
+                            (uint64_t)chip->V[opcode >> 8 & 0xF] << 48 |
+                            (uint64_t)chip->V[0xF] << 56,
+                        memory_order_relaxed);
+  atomic_store_explicit(&trace->published, index + 1, memory_order_release);
+  trace->cycle += length;
+  return length;
+}
+
+/**
+ * count cycles skipped by idle detection (see chip8_skip_idle); they
+ * show up as a gap in the cycles of the trace
+ */
+void chip8_trace_idle(Chip8 *chip, uint64_t cycles) {
+  chip->trace->cycle += cycles;
+}
+
+/**
+ * write out the records in the ring; may be called from any thread
+ * while the chip runs
+ *
+ * returns nonzero if the file could not be written
+ */
+int chip8_trace_flush(Chip8Trace *trace) {
+  pthread_mutex_lock(&trace->lock);
+  flush_locked(trace);
+  if (fflush(trace->file) || ferror(trace->file)) {
+    trace->err = 1;
+  }
+  int err = trace->err;
+  pthread_mutex_unlock(&trace->lock);
+  return err;
+}
@@ -0,0 +1,40 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+/**
+ * a ring buffer of executed instructions, written to a file in the
+ * background (see trace.c)
+ */
+typedef struct Chip8Trace Chip8Trace;
+
+// file format version, after the "C8TR" magic
+#define CHIP8_TRACE_VERSION 1
+// size of a trace record in the file
+#define CHIP8_TRACE_RECORD_SIZE 16
+// cycle of a record standing for instructions lost to an overrun; the
+// other word holds how many
+#define CHIP8_TRACE_LOST UINT64_MAX
+// trace file and ring size used by the frontends for --debug
+#define CHIP8_TRACE_DEFAULT_PATH "chip8.trace"
+#define CHIP8_TRACE_DEFAULT_RECORDS (1 << 20)
+
+Chip8Trace *chip8_trace_create(const char *path, size_t records,
+                               bool background);
+
+void chip8_trace_destroy(Chip8Trace *trace);
+
+int chip8_trace_attach(Chip8 *chip, Chip8Trace *trace);
+
+uint32_t chip8_trace_execute(Chip8 *chip, Chip8Instruction *ins);
+
+void chip8_trace_idle(Chip8 *chip, uint64_t cycles);
+
+int chip8_trace_flush(Chip8Trace *trace);
+
+#endif
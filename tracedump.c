@@ -0,0 +1,237 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+/**
+ * trace decoder
+ *
+ * prints an instruction trace written with --trace or --debug (see
+ * trace.c) as one line per instruction: the cycle it started at, its
+ * address, opcode and mnemonic, then I, VX and VF after it ran
+ *
+ * --from and --to limit the output to a range of cycles, --pc to the
+ * instructions at one address
+ */
+
+/**
+ * format an opcode as an assembler mnemonic
+ */
+static void disassemble(uint16_t opcode, char *out, size_t size) {
+  unsigned x = opcode >> 8 & 0xF;
+  unsigned y = opcode >> 4 & 0xF;
+  unsigned n = opcode & 0xF;
+  unsigned nn = opcode & 0xFF;
+  unsigned nnn = opcode & 0xFFF;
+  static const char *const alu[16] = {
+      [0x0] = "LD", [0x1] = "OR",  [0x2] = "AND",  [0x3] = "XOR",
+      [0x4] = "ADD", [0x5] = "SUB", [0x6] = "SHR", [0x7] = "SUBN",
+      [0xE] = "SHL",
+  };
+
+  switch (opcode >> 12) {
+  case 0x0:
+    if (opcode == 0x00E0) {
+      snprintf(out, size, "CLS");
+    } else if (opcode == 0x00EE) {
+      snprintf(out, size, "RET");
+    } else {
+      snprintf(out, size, "SYS %03X", nnn);
+    }
+    return;
+  case 0x1:
+    snprintf(out, size, "JP %03X", nnn);
+    return;
+  case 0x2:
+    snprintf(out, size, "CALL %03X", nnn);
+    return;
+  case 0x3:
+    snprintf(out, size, "SE V%X, %02X", x, nn);
+    return;
+  case 0x4:
+    snprintf(out, size, "SNE V%X, %02X", x, nn);
+    return;
+  case 0x5:
+    if (n == 0) {
+      snprintf(out, size, "SE V%X, V%X", x, y);
+      return;
+    }
+    break;
+  case 0x6:
+    snprintf(out, size, "LD V%X, %02X", x, nn);
+    return;
+  case 0x7:
+    snprintf(out, size, "ADD V%X, %02X", x, nn);
+    return;
+  case 0x8:
+    if (alu[n]) {
+      snprintf(out, size, "%s V%X, V%X", alu[n], x, y);
+      return;
+    }
+    break;
+  case 0x9:
+    if (n == 0) {
+      snprintf(out, size, "SNE V%X, V%X", x, y);
+      return;
+    }
+    break;
+  case 0xA:
+    snprintf(out, size, "LD I, %03X", nnn);
+    return;
+  case 0xB:
+    snprintf(out, size, "JP V0, %03X", nnn);
+    return;
+  case 0xC:
+    snprintf(out, size, "RND V%X, %02X", x, nn);
+    return;
+  case 0xD:
+    snprintf(out, size, "DRW V%X, V%X, %X", x, y, n);
+    return;
+  case 0xE:
+    if (nn == 0x9E) {
+      snprintf(out, size, "SKP V%X", x);
+      return;
+    }
+    if (nn == 0xA1) {
+      snprintf(out, size, "SKNP V%X", x);
+      return;
+    }
+    break;
+  case 0xF:
+    switch (nn) {
+    case 0x07:
+      snprintf(out, size, "LD V%X, DT", x);
+      return;
+    case 0x0A:
+      snprintf(out, size, "LD V%X, K", x);
+      return;
+    case 0x15:
+      snprintf(out, size, "LD DT, V%X", x);
+      return;
+    case 0x18:
+      snprintf(out, size, "LD ST, V%X", x);
+      return;
+    case 0x1E:
+      snprintf(out, size, "ADD I, V%X", x);
+      return;
+    case 0x29:
+      snprintf(out, size, "LD F, V%X", x);
+      return;
+    case 0x33:
+      snprintf(out, size, "LD B, V%X", x);
+      return;
+    case 0x55:
+      snprintf(out, size, "LD [I], V%X", x);
+      return;
+    case 0x65:
+      snprintf(out, size, "LD V%X, [I]", x);
+      return;
+    }
+    break;
+  }
+  snprintf(out, size, "DW %04X", opcode);
+}
+
+static uint64_t get_u64(const uint8_t *in, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; i++) {
+    value |= (uint64_t)in[i] << (8 * i);
+  }
+  return value;
+}
+
+int main(int argc, char *argv[]) {
+  const char *path = NULL;
+  uint64_t from = 0;
+  uint64_t to = UINT64_MAX;
+  long pc_filter = -1;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (arg[0] != '-') {
+      if (path) {
+        fprintf(stderr, "Unknown extra argument: %s\n", arg);
+        return 1;
+      }
+      path = arg;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      fprintf(stderr, "Missing value for %s\n", arg);
+      return 1;
+    }
+    const char *value = argv[++i];
+    if (strcmp(arg, "--from") == 0) {
+      from = strtoull(value, NULL, 10);
+    } else if (strcmp(arg, "--to") == 0) {
+      to = strtoull(value, NULL, 10);
+    } else if (strcmp(arg, "--pc") == 0) {
+      pc_filter = strtol(value, NULL, 16);
+    } else {
+      fprintf(stderr, "Unknown option: %s\n", arg);
+      return 1;
+    }
+  }
+  if (!path) {
+    fprintf(stderr, "Usage: %s <trace_file> [--from CYCLE] [--to CYCLE] "
+                    "[--pc ADDR]\n",
+            argv[0]);
+    return 1;
+  }
+
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    perror("Failed to open trace");
+    return 1;
+  }
+  uint8_t header[8];
+  if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+      memcmp(header, "C8TR", 4) != 0) {
+    fprintf(stderr, "Not a trace: %s\n", path);
+    fclose(file);
+    return 1;
+  }
+  if (header[4] != CHIP8_TRACE_VERSION) {
+    fprintf(stderr, "Unsupported trace version %d\n", header[4]);
+    fclose(file);
+    return 1;
+  }
+
+  printf("%12s  %-4s %-4s  %-16s %-5s %-5s %s\n", "cycle", "PC", "op",
+         "instruction", "I", "VX", "VF");
+  uint8_t record[CHIP8_TRACE_RECORD_SIZE];
+  uint64_t records = 0;
+  uint64_t lost = 0;
+  while (fread(record, 1, sizeof(record), file) == sizeof(record)) {
+    uint64_t cycle = get_u64(record, 8);
+    if (cycle == CHIP8_TRACE_LOST) {
+      uint64_t count = get_u64(record + 8, 8);
+      lost += count;
+      printf("... %" PRIu64 " instructions lost (trace overrun)\n", count);
+      continue;
+    }
+    records++;
+    uint16_t pc = get_u64(record + 8, 2);
+    uint16_t opcode = get_u64(record + 10, 2);
+    if (cycle < from || cycle > to || (pc_filter >= 0 && pc != pc_filter)) {
+      continue;
+    }
+    char mnemonic[32];
+    disassemble(opcode, mnemonic, sizeof(mnemonic));
+    printf("%12" PRIu64 "  %03X  %04X  %-16s I=%03X V%X=%02X VF=%02X\n",
+           cycle, pc, opcode, mnemonic, (unsigned)get_u64(record + 12, 2),
+           opcode >> 8 & 0xF, record[14], record[15]);
+  }
+  int err = ferror(file);
+  if (err) {
+    perror("Failed to read trace");
+  }
+  fclose(file);
+  fprintf(stderr, "%" PRIu64 " instructions traced, %" PRIu64 " lost\n",
+          records, lost);
+  return err != 0;
+}